@@ -0,0 +1,540 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Common.h"
+#include "FileUtils.h"
+#include "DiffIndex.h"
+#include "DirectoryDiff.h"
+#include "LineDiff.h"
+
+#include "TreeGenerator.h"
+
+// dwrap_bench: times the scan, sort, compare and diff stages on generated trees and
+// writes the results as JSON, so runs of different versions can be compared.
+
+struct BenchParams
+{
+	std::string outputPath;
+	std::string workDir;
+	std::vector<int> sizes;
+	// Path counts for the in-memory path sort benchmarks, no trees are generated for these
+	std::vector<int> sortSizes;
+	std::vector<std::string> scenarios;
+	// Groups of benchmarks to run, all of them when empty
+	std::vector<std::string> benches;
+	int repetitions;
+	uint64_t hugeFileSize;
+	bool keepTrees;
+};
+
+struct BenchResult
+{
+	std::string benchmark;
+	std::string scenario;
+	int entries;
+	uint64_t items;
+	uint64_t bytes;
+	std::vector<double> timesMs;
+};
+
+static std::vector<BenchResult> s_results;
+
+bool ParseList(const std::string& list, not_null<std::vector<std::string>> outItems)
+{
+	std::stringstream stream(list);
+	std::string item;
+	while (std::getline(stream, item, ','))
+	{
+		if (!item.empty())
+			outItems->push_back(item);
+	}
+	return !outItems->empty();
+}
+
+bool InitBenchParams(const std::vector<std::string>& arguments, not_null<BenchParams> outParams)
+{
+	outParams->workDir = "/tmp/dwrap_bench";
+	outParams->sizes = { 10000, 100000, 1000000 };
+	outParams->sortSizes = { 1000000 };
+	outParams->repetitions = 3;
+	outParams->hugeFileSize = 256ull * 1024 * 1024;
+	outParams->keepTrees = false;
+
+	for (int i = 0, argCount = arguments.size(); i < argCount; ++i)
+	{
+		const std::string& s = arguments[i];
+		const bool hasValue = i < argCount - 1;
+		if (s == "--out" && hasValue)
+		{
+			outParams->outputPath = arguments[++i];
+		}
+		else if (s == "--work-dir" && hasValue)
+		{
+			outParams->workDir = arguments[++i];
+		}
+		else if (s == "--sizes" && hasValue)
+		{
+			std::vector<std::string> sizes;
+			if (!ParseList(arguments[++i], &sizes))
+				return false;
+			outParams->sizes.clear();
+			for (const auto& size : sizes)
+				outParams->sizes.push_back(atoi(size.c_str()));
+		}
+		else if (s == "--sort-sizes" && hasValue)
+		{
+			std::vector<std::string> sizes;
+			if (!ParseList(arguments[++i], &sizes))
+				return false;
+			outParams->sortSizes.clear();
+			for (const auto& size : sizes)
+				outParams->sortSizes.push_back(atoi(size.c_str()));
+		}
+		else if (s == "--scenarios" && hasValue)
+		{
+			if (!ParseList(arguments[++i], &outParams->scenarios))
+				return false;
+		}
+		else if (s == "--benches" && hasValue)
+		{
+			if (!ParseList(arguments[++i], &outParams->benches))
+				return false;
+		}
+		else if (s == "--reps" && hasValue)
+		{
+			outParams->repetitions = std::max(1, atoi(arguments[++i].c_str()));
+		}
+		else if (s == "--huge-size" && hasValue)
+		{
+			outParams->hugeFileSize = strtoull(arguments[++i].c_str(), nullptr, 10);
+		}
+		else if (s == "--keep")
+		{
+			outParams->keepTrees = true;
+		}
+		else
+		{
+			LogLine(kError, "unrecognized parameter '%s'", s.c_str());
+			LogLine(kError, "usage: dwrap_bench [--out file.json] [--work-dir dir] [--sizes 10000,100000] [--sort-sizes 1000000,10000000] [--scenarios a,b] [--benches trees,sort,filter,linediff] [--reps n] [--huge-size bytes] [--keep]");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool IsSelected(const std::vector<std::string>& selection, const char* name)
+{
+	return selection.empty() || std::find(selection.begin(), selection.end(), name) != selection.end();
+}
+
+// Drops the clean pages of the files from the page cache, so the next read goes to the device
+void EvictFromPageCache(const std::vector<DiffEntry>& entries)
+{
+#ifdef POSIX_FADV_DONTNEED
+	for (const DiffEntry& entry : entries)
+	{
+		for (const FileInfo* f : { entry.leftFile, entry.rightFile })
+		{
+			if (f == nullptr || IsDir(*f))
+				continue;
+			const int fd = open(f->absolutePath.c_str(), O_RDONLY);
+			if (fd < 0)
+				continue;
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			close(fd);
+		}
+	}
+#endif
+}
+
+void RunBenchmark(const char* benchmark, const char* scenario, const int entries, const int repetitions,
+	const std::function<void()>& setup, const std::function<void(not_null<uint64_t>, not_null<uint64_t>)>& run)
+{
+	BenchResult result;
+	result.benchmark = benchmark;
+	result.scenario = scenario;
+	result.entries = entries;
+	result.items = 0;
+	result.bytes = 0;
+
+	for (int rep = 0; rep < repetitions; ++rep)
+	{
+		if (setup)
+			setup();
+
+		uint64_t items = 0;
+		uint64_t bytes = 0;
+		const auto start = std::chrono::steady_clock::now();
+		run(&items, &bytes);
+		const auto end = std::chrono::steady_clock::now();
+
+		result.timesMs.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+		result.items = items;
+		result.bytes = bytes;
+	}
+
+	std::vector<double> sorted = result.timesMs;
+	std::sort(sorted.begin(), sorted.end());
+	// Progress goes to stderr so the JSON on stdout stays clean
+	fprintf(stderr, "%-28s %-18s %8d  median %10.3f ms\n", benchmark, scenario, entries, sorted[sorted.size() / 2]);
+
+	s_results.push_back(result);
+}
+
+void BenchScenario(const BenchParams& params, const TreeScenario& scenario, const int size)
+{
+	char dirName[128];
+	snprintf(dirName, sizeof(dirName), "%s_%d", scenario.name, size);
+	const std::string root = params.workDir + "/" + dirName;
+	const std::string leftRoot = root + "/left";
+	const std::string rightRoot = root + "/right";
+	const std::string marker = root + "/.generated";
+
+	struct stat markerStat;
+	if (stat(marker.c_str(), &markerStat) != 0)
+	{
+		fprintf(stderr, "Generating %s (%d entries)...\n", scenario.name, size);
+
+		TreeGeneratorParams generatorParams;
+		generatorParams.fileCount = size;
+		generatorParams.hugeFileSize = params.hugeFileSize;
+		generatorParams.seed = 0x6477726170ull;
+		if (!GenerateTreePair(scenario, generatorParams, leftRoot, rightRoot))
+			return;
+
+		FILE* markerFile = fopen(marker.c_str(), "w");
+		if (markerFile)
+			fclose(markerFile);
+	}
+
+	const int reps = params.repetitions;
+
+	std::vector<FileInfo> files;
+	RunBenchmark("ListFilesInDirRecursively", scenario.name, size, reps,
+		[&files]() { files.clear(); },
+		[&files, &leftRoot](not_null<uint64_t> items, not_null<uint64_t>)
+		{
+			ListFilesInDirRecursively(leftRoot, "", 0, &files);
+			*items = files.size();
+		});
+
+	std::vector<FileInfo> shuffled = files;
+	std::mt19937_64 shuffleRandom(size);
+	std::shuffle(shuffled.begin(), shuffled.end(), shuffleRandom);
+	std::vector<FileInfo> sortFiles;
+	RunBenchmark("SortFileList", scenario.name, size, reps,
+		[&sortFiles, &shuffled]() { sortFiles = shuffled; },
+		[&sortFiles](not_null<uint64_t> items, not_null<uint64_t>)
+		{
+			SortFileList(&sortFiles);
+			*items = sortFiles.size();
+		});
+	sortFiles.clear();
+	shuffled.clear();
+
+	DirectoryDiffState diffState;
+	PathSet paths = { leftRoot, rightRoot };
+	RunBenchmark("GenerateDirectoryDiffState", scenario.name, size, reps, nullptr,
+		[&diffState, &paths](not_null<uint64_t> items, not_null<uint64_t>)
+		{
+			GenerateDirectoryDiffState(paths, &diffState);
+			*items = diffState.sortedEntries.size();
+		});
+
+	auto compareAll = [&diffState](not_null<uint64_t> items, not_null<uint64_t> bytes)
+	{
+		for (const DiffEntry& entry : diffState.sortedEntries)
+		{
+			if (!entry.leftFile || !entry.rightFile || IsDir(*entry.leftFile))
+				continue;
+			FileEquals(*entry.leftFile, *entry.rightFile);
+			*items += 1;
+			*bytes += entry.leftFile->status.st_size;
+		}
+	};
+
+	// The diff above read every file, so FileEquals starts from an evicted page cache and
+	// FileEqualsCached measures the compare alone
+	RunBenchmark("FileEquals", scenario.name, size, reps,
+		[&diffState]() { EvictFromPageCache(diffState.sortedEntries); },
+		compareAll);
+	RunBenchmark("FileEqualsCached", scenario.name, size, reps, nullptr, compareAll);
+
+	if (!params.keepTrees)
+	{
+		const std::string command = "rm -rf '" + root + "'";
+		if (system(command.c_str()) != 0)
+			LogLine(kError, "Could not remove '%s'", root.c_str());
+	}
+}
+
+// Paths as a large volume lists them, deep under a shared prefix, or all in one directory
+void GeneratePaths(const bool deepPrefix, const int count, not_null<std::vector<FileInfo>> outFiles)
+{
+	outFiles->clear();
+	outFiles->resize(count);
+	char buf[160];
+	for (int i = 0; i < count; ++i)
+	{
+		if (deepPrefix)
+			snprintf(buf, sizeof(buf), "storage/volume01/projects/engine/build/intermediate/dir%04d/sub%03d/file%07d.obj", i % 1000, (i / 1000) % 100, i);
+		else
+			snprintf(buf, sizeof(buf), "file%08d", i);
+		FileInfo& f = (*outFiles)[i];
+		f.relativePath = buf;
+		f.isDir = false;
+		f.level = 0;
+	}
+
+	std::mt19937_64 shuffleRandom(count);
+	std::shuffle(outFiles->begin(), outFiles->end(), shuffleRandom);
+}
+
+void BenchPathSort(const BenchParams& params, const int size)
+{
+	for (const bool deepPrefix : { true, false })
+	{
+		const char* scenario = deepPrefix ? "deep_prefix_paths" : "flat_paths";
+		std::vector<FileInfo> shuffled;
+		GeneratePaths(deepPrefix, size, &shuffled);
+
+		std::vector<FileInfo> sortFiles;
+		RunBenchmark("SortFileList", scenario, size, params.repetitions,
+			[&sortFiles, &shuffled]() { sortFiles = shuffled; },
+			[&sortFiles](not_null<uint64_t> items, not_null<uint64_t>)
+			{
+				SortFileList(&sortFiles);
+				*items = sortFiles.size();
+			});
+
+		// The comparison sort SortFileList used before, and a check that the orders agree
+		std::vector<FileInfo> baselineFiles;
+		RunBenchmark("StdSortFileList", scenario, size, params.repetitions,
+			[&baselineFiles, &shuffled]() { baselineFiles = shuffled; },
+			[&baselineFiles](not_null<uint64_t> items, not_null<uint64_t>)
+			{
+				std::sort(baselineFiles.begin(), baselineFiles.end(), &FileInfoSortFunc);
+				*items = baselineFiles.size();
+			});
+
+		for (size_t i = 0; i < sortFiles.size(); ++i)
+		{
+			if (sortFiles[i].relativePath != baselineFiles[i].relativePath)
+			{
+				LogLine(kError, "SortFileList order differs from std::sort at %lu", (unsigned long)i);
+				break;
+			}
+		}
+	}
+}
+
+// Filters as the folder compare view runs them while typing, and the directory rollups it
+// opens with, over a diff of generated paths
+void BenchDiffFilter(const BenchParams& params, const int size)
+{
+	const char* scenario = "deep_prefix_paths";
+	std::vector<FileInfo> files;
+	GeneratePaths(true, size, &files);
+	std::set<std::string> directories;
+	for (const FileInfo& f : files)
+	{
+		for (size_t slash = f.relativePath.find('/'); slash != std::string::npos; slash = f.relativePath.find('/', slash + 1))
+			directories.insert(f.relativePath.substr(0, slash));
+	}
+	for (const std::string& directory : directories)
+	{
+		FileInfo dir;
+		dir.relativePath = directory;
+		dir.isDir = true;
+		dir.level = GetPathDepth(directory.data(), directory.size()) + 1;
+		files.push_back(dir);
+	}
+	std::mt19937_64 random(size);
+	for (FileInfo& f : files)
+	{
+		const size_t slash = f.relativePath.rfind('/');
+		f.name = f.relativePath.substr(slash + 1);
+		f.status.st_size = random() % (1 << 20);
+	}
+	SortFileList(&files);
+
+	// Mostly identical, with a few percent of every kind of change
+	std::vector<DiffEntry> entries(files.size());
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		const int kind = (int)(random() % 100);
+		entries[i] = DiffEntry { (kind == 0) ? nullptr : &files[i], (kind == 1) ? nullptr : &files[i], kind < 4 };
+	}
+
+	std::vector<DirectoryRollup> rollups;
+	RunBenchmark("DirectoryRollups", scenario, size, params.repetitions, nullptr,
+		[&entries, &rollups](not_null<uint64_t> items, not_null<uint64_t>)
+		{
+			ComputeDirectoryRollups(entries, &rollups);
+			*items = rollups.size();
+		});
+
+	std::unique_ptr<DiffIndex> index;
+	RunBenchmark("BuildDiffIndex", scenario, size, params.repetitions,
+		[&index]() { index.reset(); },
+		[&index, &entries](not_null<uint64_t> items, not_null<uint64_t>)
+		{
+			index.reset(new DiffIndex(entries));
+			*items = entries.size();
+		});
+
+	struct FilterCase
+	{
+		const char* name;
+		unsigned statuses;
+		const char* search;
+		DiffOrder order;
+	};
+	const FilterCase cases[] =
+	{
+		{ "FilterModified", 1u << kDiffModified, "", kOrderByPath },
+		{ "FilterChangedBySize", ~(1u << kDiffIdentical), "", kOrderBySize },
+		{ "FilterSearchName", ~0u, "FILE00123", kOrderByPath },
+		{ "FilterSearchShort", ~0u, "7.", kOrderByPath },
+		{ "FilterAllBySize", ~0u, "", kOrderBySize },
+	};
+	std::vector<uint32_t> rows;
+	for (const FilterCase& filterCase : cases)
+	{
+		DiffFilter filter;
+		filter.statuses = filterCase.statuses;
+		filter.nameSearch = filterCase.search;
+		filter.order = filterCase.order;
+		RunBenchmark(filterCase.name, scenario, size, params.repetitions, nullptr,
+			[&index, &filter, &rows](not_null<uint64_t> items, not_null<uint64_t>)
+			{
+				index->Filter(filter, &rows);
+				*items = rows.size();
+			});
+	}
+}
+
+// The line diff the preview pane runs, over a text of size lines with a few hundred of them
+// edited, inserted or deleted
+void BenchLineDiff(const BenchParams& params, const int size)
+{
+	const char* scenario = "scattered_edits";
+	std::string left;
+	std::string right;
+	std::mt19937_64 random(size);
+	const int editEvery = std::max(size / 300, 1);
+	char line[64];
+	for (int i = 0; i < size; ++i)
+	{
+		snprintf(line, sizeof(line), "line %d of the text, %llu\n", i, (unsigned long long)(random() % 1000));
+		left += line;
+		if (i % editEvery != editEvery / 2)
+		{
+			right += line;
+			continue;
+		}
+		switch (random() % 3)
+		{
+			case 0: right += "edited\n"; break;
+			case 1: right += line; right += "inserted\n"; break;
+			default: break;
+		}
+	}
+
+	TextLines leftLines;
+	TextLines rightLines;
+	std::vector<LineChange> changes;
+	std::vector<LineHunk> hunks;
+	RunBenchmark("LineDiff", scenario, size, params.repetitions, nullptr,
+		[&](not_null<uint64_t> items, not_null<uint64_t> bytes)
+		{
+			leftLines.Split(left.data(), left.size(), nullptr);
+			rightLines.Split(right.data(), right.size(), nullptr);
+			DiffLines(leftLines, rightLines, nullptr, &changes);
+			GroupLineHunks(changes, leftLines.GetCount(), rightLines.GetCount(), 3, &hunks);
+			*items = leftLines.GetCount() + rightLines.GetCount();
+			*bytes = left.size() + right.size();
+		});
+}
+
+void WriteResults(FILE* file, const BenchParams& params)
+{
+	fprintf(file, "{\n  \"timestamp\": %lld,\n  \"hardware_threads\": %u,\n  \"repetitions\": %d,\n  \"results\": [\n",
+		(long long)time(nullptr), std::thread::hardware_concurrency(), params.repetitions);
+
+	for (size_t i = 0; i < s_results.size(); ++i)
+	{
+		const BenchResult& result = s_results[i];
+		std::vector<double> sorted = result.timesMs;
+		std::sort(sorted.begin(), sorted.end());
+		double mean = 0.0;
+		for (double t : sorted)
+			mean += t;
+		mean /= sorted.size();
+		const double median = sorted[sorted.size() / 2];
+
+		fprintf(file, "    { \"benchmark\": \"%s\", \"scenario\": \"%s\", \"entries\": %d, \"items\": %llu, \"bytes\": %llu, "
+			"\"min_ms\": %.3f, \"median_ms\": %.3f, \"mean_ms\": %.3f, \"items_per_sec\": %.1f }%s\n",
+			result.benchmark.c_str(), result.scenario.c_str(), result.entries, (unsigned long long)result.items,
+			(unsigned long long)result.bytes, sorted.front(), median, mean,
+			median > 0.0 ? result.items / (median / 1000.0) : 0.0, (i + 1 < s_results.size()) ? "," : "");
+	}
+
+	fprintf(file, "  ]\n}\n");
+}
+
+int main(const int argc, const char* argv[])
+{
+	std::vector<std::string> arguments(argv + 1, argv + argc);
+
+	BenchParams params;
+	if (!InitBenchParams(arguments, &params))
+		return EX_USAGE;
+
+	for (const int size : params.sortSizes)
+	{
+		if (IsSelected(params.benches, "sort"))
+			BenchPathSort(params, size);
+		if (IsSelected(params.benches, "filter"))
+			BenchDiffFilter(params, size);
+		if (IsSelected(params.benches, "linediff"))
+			BenchLineDiff(params, size);
+	}
+
+	for (const TreeScenario& scenario : kTreeScenarios)
+	{
+		if (!IsSelected(params.benches, "trees") || !IsSelected(params.scenarios, scenario.name))
+			continue;
+
+		for (const int size : params.sizes)
+			BenchScenario(params, scenario, size);
+	}
+
+	FILE* file = params.outputPath.empty() ? stdout : fopen(params.outputPath.c_str(), "w");
+	if (file == nullptr)
+	{
+		LogLine(kError, "Could not write results to '%s'", params.outputPath.c_str());
+		return EX_IOERR;
+	}
+
+	WriteResults(file, params);
+	if (file != stdout)
+		fclose(file);
+
+	return EX_OK;
+}
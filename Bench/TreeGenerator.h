@@ -0,0 +1,223 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "Common.h"
+
+// Deterministic generator for left/right directory tree pairs. The same scenario, size and seed
+// always produce byte identical trees, so results are comparable between versions.
+
+enum TreeShape
+{
+	kShapeDeepNarrow,
+	kShapeFlatWide,
+	kShapeManySmallFiles,
+	kShapeFewHugeFiles,
+};
+
+enum TreeDelta
+{
+	kDeltaNone,
+	kDeltaMostlyIdentical,
+	kDeltaMostlyDifferent,
+	kDeltaManyRenames,
+};
+
+struct TreeScenario
+{
+	const char* name;
+	TreeShape shape;
+	TreeDelta delta;
+};
+
+const TreeScenario kTreeScenarios[] =
+{
+	{ "deep_narrow", kShapeDeepNarrow, kDeltaNone },
+	{ "flat_wide", kShapeFlatWide, kDeltaNone },
+	{ "many_small_files", kShapeManySmallFiles, kDeltaNone },
+	{ "few_huge_files", kShapeFewHugeFiles, kDeltaNone },
+	{ "mostly_identical", kShapeManySmallFiles, kDeltaMostlyIdentical },
+	{ "mostly_different", kShapeManySmallFiles, kDeltaMostlyDifferent },
+	{ "many_renames", kShapeManySmallFiles, kDeltaManyRenames },
+};
+
+struct TreeGeneratorParams
+{
+	int fileCount;
+	uint64_t hugeFileSize;
+	uint64_t seed;
+};
+
+// SplitMix64, small and good enough to derive independent per-file streams from one seed
+inline uint64_t NextRandom(uint64_t& state)
+{
+	uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+inline int GetShapeFileCount(const TreeShape shape, const int requestedCount)
+{
+	// Huge files are about bytes, not entries
+	return (shape == kShapeFewHugeFiles) ? 4 : requestedCount;
+}
+
+inline std::string GetGeneratedRelativePath(const TreeShape shape, const int index)
+{
+	char buf[64];
+	switch (shape)
+	{
+		case kShapeDeepNarrow:
+		{
+			// Chains of 48 nested directories with one file per level
+			const int kChainDepth = 48;
+			const int chain = index / kChainDepth;
+			std::string path;
+			snprintf(buf, sizeof(buf), "c%03d/c%03d", chain / 256, chain % 256);
+			path = buf;
+			for (int level = 0; level < index % kChainDepth; ++level)
+				path += "/d";
+			snprintf(buf, sizeof(buf), "/f%d", index);
+			return path + buf;
+		}
+		case kShapeFlatWide:
+		{
+			snprintf(buf, sizeof(buf), "f%07d", index);
+			return buf;
+		}
+		case kShapeManySmallFiles:
+		{
+			const int dir = index / 64;
+			snprintf(buf, sizeof(buf), "d%03d/d%03d/f%d", dir / 256, dir % 256, index);
+			return buf;
+		}
+		case kShapeFewHugeFiles:
+		{
+			snprintf(buf, sizeof(buf), "huge%d.bin", index);
+			return buf;
+		}
+	}
+	return std::string();
+}
+
+inline uint64_t GetGeneratedFileSize(const TreeShape shape, const TreeGeneratorParams& params, uint64_t& random)
+{
+	switch (shape)
+	{
+		case kShapeDeepNarrow: return NextRandom(random) % 1024;
+		case kShapeFlatWide: return NextRandom(random) % 1024;
+		case kShapeManySmallFiles: return NextRandom(random) % 4096;
+		case kShapeFewHugeFiles: return params.hugeFileSize;
+	}
+	return 0;
+}
+
+inline bool MakeDirectories(const std::string& path)
+{
+	for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1))
+	{
+		const std::string sub = path.substr(0, pos);
+		if (mkdir(sub.c_str(), 0755) != 0 && errno != EEXIST)
+		{
+			LogLine(kError, "Could not create directory '%s'", sub.c_str());
+			return false;
+		}
+		if (pos == std::string::npos)
+			break;
+	}
+	return true;
+}
+
+inline bool WriteGeneratedFile(const std::string& path, uint64_t size, uint64_t contentSeed, const int64_t flipOffset)
+{
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr)
+	{
+		const size_t slash = path.rfind('/');
+		if (slash == std::string::npos || !MakeDirectories(path.substr(0, slash)))
+			return false;
+		file = fopen(path.c_str(), "wb");
+		if (file == nullptr)
+		{
+			LogLine(kError, "Could not create file '%s'", path.c_str());
+			return false;
+		}
+	}
+
+	uint64_t buf[8192];
+	uint64_t offset = 0;
+	while (offset < size)
+	{
+		for (auto& word : buf)
+			word = NextRandom(contentSeed);
+
+		const uint64_t chunk = std::min<uint64_t>(sizeof(buf), size - offset);
+		if (flipOffset >= (int64_t)offset && flipOffset < (int64_t)(offset + chunk))
+			((unsigned char*)buf)[flipOffset - offset] ^= 0xFF;
+
+		fwrite(buf, 1, chunk, file);
+		offset += chunk;
+	}
+
+	fclose(file);
+	return true;
+}
+
+// Writes the left and right tree of a scenario below leftRoot and rightRoot
+inline bool GenerateTreePair(const TreeScenario& scenario, const TreeGeneratorParams& params, const std::string& leftRoot, const std::string& rightRoot)
+{
+	if (!MakeDirectories(leftRoot) || !MakeDirectories(rightRoot))
+		return false;
+
+	const int fileCount = GetShapeFileCount(scenario.shape, params.fileCount);
+	for (int i = 0; i < fileCount; ++i)
+	{
+		uint64_t random = params.seed ^ ((uint64_t)i * 0xD6E8FEB86659FD93ull);
+		const uint64_t size = GetGeneratedFileSize(scenario.shape, params, random);
+		const uint64_t contentSeed = NextRandom(random);
+		const uint64_t roll = NextRandom(random) % 100;
+		std::string relativePath = GetGeneratedRelativePath(scenario.shape, i);
+
+		if (!WriteGeneratedFile(leftRoot + "/" + relativePath, size, contentSeed, -1))
+			return false;
+
+		// The single modified file of an unchanged huge tree keeps FileEquals reading to the end
+		int64_t flipOffset = -1;
+		uint64_t rightSize = size;
+		switch (scenario.delta)
+		{
+			case kDeltaNone:
+				if (scenario.shape == kShapeFewHugeFiles && i == fileCount - 1 && size > 0)
+					flipOffset = size - 1;
+				break;
+			case kDeltaMostlyIdentical:
+				if (roll < 1 && size > 0)
+					flipOffset = NextRandom(random) % size;
+				break;
+			case kDeltaMostlyDifferent:
+				if (roll < 45)
+					rightSize = size + 1 + NextRandom(random) % 64;
+				else if (roll < 90 && size > 0)
+					flipOffset = NextRandom(random) % size;
+				break;
+			case kDeltaManyRenames:
+				if (roll < 30)
+					relativePath += ".renamed";
+				break;
+		}
+
+		if (!WriteGeneratedFile(rightRoot + "/" + relativePath, rightSize, contentSeed, flipOffset))
+			return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,1147 @@
+#include "Archive.h"
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Hash.h"
+#include "PathFilter.h"
+#include "Stats.h"
+#include "Trace.h"
+
+// gzip and zip deflate need zlib, zstd compressed tars need libzstd
+#ifndef DWRAP_WITH_ZLIB
+#define DWRAP_WITH_ZLIB 1
+#endif
+
+#ifndef DWRAP_WITH_ZSTD
+#define DWRAP_WITH_ZSTD 0
+#endif
+
+#if DWRAP_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#if DWRAP_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace
+{
+	const size_t kTarBlockSize = 512;
+	const size_t kStreamBufferSize = 64 * 1024;
+
+	enum ArchiveFormat
+	{
+		kNotAnArchive,
+		kArchiveTar,
+		kArchiveTarGzip,
+		kArchiveTarZstd,
+		kArchiveZip
+	};
+
+	enum StreamDecoder
+	{
+		kDecodeNone,
+		kDecodeGzip,
+		kDecodeZstd,
+		kDecodeDeflate
+	};
+
+	class InputStream
+	{
+	public:
+		virtual ~InputStream() {}
+
+		// Returns the number of bytes read, 0 at the end of the stream and -1 on errors
+		virtual long Read(char* buffer, const size_t size) = 0;
+
+		virtual bool Skip(uint64_t size)
+		{
+			char buffer[4096];
+			while (size > 0)
+			{
+				const long bytesRead = Read(buffer, (size_t)std::min<uint64_t>(size, sizeof(buffer)));
+				if (bytesRead <= 0)
+					return false;
+				size -= bytesRead;
+			}
+			return true;
+		}
+
+		bool ReadFully(char* buffer, size_t size)
+		{
+			while (size > 0)
+			{
+				const long bytesRead = Read(buffer, size);
+				if (bytesRead <= 0)
+					return false;
+				buffer += bytesRead;
+				size -= bytesRead;
+			}
+			return true;
+		}
+	};
+
+	// A byte range of an open file
+	class FileStream : public InputStream
+	{
+	public:
+		FileStream(const int fd, const uint64_t offset, const uint64_t length)
+			: m_Fd(fd)
+			, m_Offset(offset)
+			, m_End(offset + length)
+		{
+		}
+
+		long Read(char* buffer, const size_t size) override
+		{
+			const size_t toRead = (size_t)std::min<uint64_t>(size, m_End - m_Offset);
+			if (toRead == 0)
+				return 0;
+
+			CountStat(kCounterRead);
+			const ssize_t bytesRead = pread(m_Fd, buffer, toRead, (off_t)m_Offset);
+			if (bytesRead < 0)
+				return -1;
+
+			CountStat(kCounterBytesRead, bytesRead);
+			m_Offset += bytesRead;
+			return (long)bytesRead;
+		}
+
+		bool Skip(const uint64_t size) override
+		{
+			if (size > m_End - m_Offset)
+				return false;
+			m_Offset += size;
+			return true;
+		}
+
+	private:
+		int m_Fd;
+		uint64_t m_Offset;
+		uint64_t m_End;
+	};
+
+#if DWRAP_WITH_ZLIB
+	class InflateStream : public InputStream
+	{
+	public:
+		InflateStream(InputStream& source, const bool gzip)
+			: m_Source(source)
+			, m_Buffer(kStreamBufferSize)
+			, m_Gzip(gzip)
+			, m_SourceDone(false)
+			, m_StreamDone(false)
+			, m_AtMemberStart(true)
+			, m_MembersRead(0)
+		{
+			memset(&m_Stream, 0, sizeof(m_Stream));
+			m_Initialized = inflateInit2(&m_Stream, gzip ? 15 + 16 : -15) == Z_OK;
+		}
+
+		~InflateStream()
+		{
+			if (m_Initialized)
+				inflateEnd(&m_Stream);
+		}
+
+		long Read(char* buffer, const size_t size) override
+		{
+			if (!m_Initialized)
+				return -1;
+
+			m_Stream.next_out = (Bytef*)buffer;
+			m_Stream.avail_out = (uInt)size;
+			while (m_Stream.avail_out > 0 && !m_StreamDone)
+			{
+				if (m_Stream.avail_in == 0 && !m_SourceDone)
+				{
+					const long bytesRead = m_Source.Read(m_Buffer.data(), m_Buffer.size());
+					if (bytesRead < 0)
+						return -1;
+					m_SourceDone = (bytesRead == 0);
+					m_Stream.next_in = (Bytef*)m_Buffer.data();
+					m_Stream.avail_in = (uInt)bytesRead;
+				}
+
+				const uInt availIn = m_Stream.avail_in;
+				const uInt availOut = m_Stream.avail_out;
+				const int result = inflate(&m_Stream, Z_NO_FLUSH);
+				const bool progressed = (m_Stream.avail_in != availIn || m_Stream.avail_out != availOut);
+
+				if (result == Z_STREAM_END)
+				{
+					// gzip files can be several members concatenated
+					++m_MembersRead;
+					if (m_Gzip)
+					{
+						inflateReset(&m_Stream);
+						m_AtMemberStart = true;
+					}
+					else
+					{
+						m_StreamDone = true;
+					}
+				}
+				else if (result == Z_OK || result == Z_BUF_ERROR)
+				{
+					if (progressed)
+					{
+						m_AtMemberStart = false;
+					}
+					else if (m_SourceDone && m_Stream.avail_in == 0)
+					{
+						// Running out of input halfway through a member means the file is truncated
+						if (!m_AtMemberStart)
+							return -1;
+						m_StreamDone = true;
+					}
+				}
+				else
+				{
+					// Padding after the last gzip member is ignored, like gzip does
+					if (!m_Gzip || !m_AtMemberStart || m_MembersRead == 0)
+						return -1;
+					m_StreamDone = true;
+				}
+			}
+
+			return (long)(size - m_Stream.avail_out);
+		}
+
+	private:
+		InputStream& m_Source;
+		std::vector<char> m_Buffer;
+		z_stream m_Stream;
+		bool m_Initialized;
+		bool m_Gzip;
+		bool m_SourceDone;
+		bool m_StreamDone;
+		bool m_AtMemberStart;
+		int m_MembersRead;
+	};
+#endif
+
+#if DWRAP_WITH_ZSTD
+	class ZstdStream : public InputStream
+	{
+	public:
+		ZstdStream(InputStream& source)
+			: m_Source(source)
+			, m_Buffer(ZSTD_DStreamInSize())
+			, m_Stream(ZSTD_createDStream())
+			, m_SourceDone(false)
+			, m_FrameDone(true)
+		{
+			m_Input.src = m_Buffer.data();
+			m_Input.size = 0;
+			m_Input.pos = 0;
+			if (m_Stream)
+				ZSTD_initDStream(m_Stream);
+		}
+
+		~ZstdStream()
+		{
+			ZSTD_freeDStream(m_Stream);
+		}
+
+		long Read(char* buffer, const size_t size) override
+		{
+			if (m_Stream == nullptr)
+				return -1;
+			if (size == 0)
+				return 0;
+
+			ZSTD_outBuffer output = { buffer, size, 0 };
+			while (true)
+			{
+				// Called even without new input, the decoder may still hold output
+				const size_t inputPos = m_Input.pos;
+				const size_t result = ZSTD_decompressStream(m_Stream, &output, &m_Input);
+				if (ZSTD_isError(result))
+					return -1;
+				if (m_Input.pos != inputPos || output.pos > 0)
+					m_FrameDone = (result == 0);
+
+				if (output.pos > 0)
+					return (long)output.pos;
+				if (m_Input.pos < m_Input.size)
+					continue;
+				if (m_SourceDone)
+					return m_FrameDone ? 0 : -1;
+
+				const long bytesRead = m_Source.Read(m_Buffer.data(), m_Buffer.size());
+				if (bytesRead < 0)
+					return -1;
+				m_SourceDone = (bytesRead == 0);
+				m_Input.size = bytesRead;
+				m_Input.pos = 0;
+			}
+		}
+
+	private:
+		InputStream& m_Source;
+		std::vector<char> m_Buffer;
+		ZSTD_DStream* m_Stream;
+		ZSTD_inBuffer m_Input;
+		bool m_SourceDone;
+		bool m_FrameDone;
+	};
+#endif
+
+	// An open archive file and the streams decoding the part of it being read
+	class ArchiveInput
+	{
+	public:
+		ArchiveInput() : m_Fd(-1), m_FileSize(0) {}
+		~ArchiveInput()
+		{
+			if (m_Fd >= 0)
+				close(m_Fd);
+		}
+
+		bool Open(const std::string& path)
+		{
+			CountStat(kCounterOpen);
+			m_Fd = open(path.c_str(), O_RDONLY);
+			struct stat status;
+			CountStat(kCounterStat);
+			if (m_Fd < 0 || fstat(m_Fd, &status) != 0)
+			{
+				LogLine(kError, "Could not open archive '%s'", path.c_str());
+				return false;
+			}
+			m_FileSize = status.st_size;
+			return true;
+		}
+
+		int GetFd() const { return m_Fd; }
+		uint64_t GetFileSize() const { return m_FileSize; }
+
+		// Replaces the current stream, returns nullptr if the decoder is not compiled in
+		InputStream* OpenStream(const uint64_t offset, const uint64_t length, const StreamDecoder decoder)
+		{
+			m_Decoder.reset();
+			m_File.reset(new FileStream(m_Fd, offset, length));
+			switch (decoder)
+			{
+				case kDecodeNone:
+					return m_File.get();
+#if DWRAP_WITH_ZLIB
+				case kDecodeGzip:
+				case kDecodeDeflate:
+					m_Decoder.reset(new InflateStream(*m_File, decoder == kDecodeGzip));
+					return m_Decoder.get();
+#endif
+#if DWRAP_WITH_ZSTD
+				case kDecodeZstd:
+					m_Decoder.reset(new ZstdStream(*m_File));
+					return m_Decoder.get();
+#endif
+				default:
+					LogLine(kError, "This build of dwrap cannot read %s compressed archives.", (decoder == kDecodeZstd) ? "zstd" : "deflate");
+					return nullptr;
+			}
+		}
+
+	private:
+		int m_Fd;
+		uint64_t m_FileSize;
+		std::unique_ptr<InputStream> m_File;
+		std::unique_ptr<InputStream> m_Decoder;
+	};
+
+	uint16_t ReadLE16(const unsigned char* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+	uint32_t ReadLE32(const unsigned char* p) { return (uint32_t)ReadLE16(p) | ((uint32_t)ReadLE16(p + 2) << 16); }
+	uint64_t ReadLE64(const unsigned char* p) { return (uint64_t)ReadLE32(p) | ((uint64_t)ReadLE32(p + 4) << 32); }
+
+	uint64_t ParseTarNumber(const char* field, const size_t length)
+	{
+		// Values too large for octal are stored base-256 with the high bit of the first byte set
+		if ((unsigned char)field[0] & 0x80)
+		{
+			uint64_t value = (unsigned char)field[0] & 0x7f;
+			for (size_t i = 1; i < length; ++i)
+				value = (value << 8) | (unsigned char)field[i];
+			return value;
+		}
+
+		size_t i = 0;
+		while (i < length && field[i] == ' ')
+			++i;
+		uint64_t value = 0;
+		for (; i < length && field[i] >= '0' && field[i] <= '7'; ++i)
+			value = value * 8 + (field[i] - '0');
+		return value;
+	}
+
+	bool IsTarHeader(const char* block)
+	{
+		// The checksum is computed with its own field taken as spaces
+		uint64_t sum = 0;
+		for (size_t i = 0; i < kTarBlockSize; ++i)
+			sum += (i >= 148 && i < 156) ? ' ' : (unsigned char)block[i];
+		return sum == ParseTarNumber(block + 148, 8);
+	}
+
+	bool IsZeroBlock(const char* block)
+	{
+		for (size_t i = 0; i < kTarBlockSize; ++i)
+		{
+			if (block[i] != 0)
+				return false;
+		}
+		return true;
+	}
+
+	std::string GetTarString(const char* field, const size_t length)
+	{
+		return std::string(field, strnlen(field, length));
+	}
+
+	int64_t ParsePaxTime(const std::string& value)
+	{
+		// Seconds with an optional fraction, "1546300800.123456789"
+		char* end = nullptr;
+		const int64_t seconds = strtoll(value.c_str(), &end, 10);
+		int64_t nanoseconds = 0;
+		if (*end == '.')
+		{
+			int64_t scale = 100000000;
+			for (const char* c = end + 1; *c >= '0' && *c <= '9' && scale > 0; ++c, scale /= 10)
+				nanoseconds += (*c - '0') * scale;
+		}
+		return seconds * 1000000000ll + ((seconds < 0) ? -nanoseconds : nanoseconds);
+	}
+
+	int64_t DosTimeToNs(const uint16_t time, const uint16_t date)
+	{
+		struct tm t;
+		memset(&t, 0, sizeof(t));
+		t.tm_year = ((date >> 9) & 0x7f) + 80;
+		t.tm_mon = ((date >> 5) & 0xf) - 1;
+		t.tm_mday = date & 0x1f;
+		t.tm_hour = time >> 11;
+		t.tm_min = (time >> 5) & 0x3f;
+		t.tm_sec = (time & 0x1f) * 2;
+		t.tm_isdst = -1;
+		return (int64_t)mktime(&t) * 1000000000ll;
+	}
+
+	// Archive paths may start with "./" or "/" and directory names end with '/'
+	bool NormalizeMemberPath(not_null<std::string> path)
+	{
+		size_t start = 0;
+		while (true)
+		{
+			if (path->compare(start, 2, "./") == 0)
+				start += 2;
+			else if (start < path->size() && (*path)[start] == '/')
+				start += 1;
+			else
+				break;
+		}
+		path->erase(0, start);
+		while (!path->empty() && path->back() == '/')
+			path->pop_back();
+		return !path->empty() && *path != ".";
+	}
+
+	// Collects the members of an archive into FileInfos, applying the scan filter
+	class ArchiveListing
+	{
+	public:
+		ArchiveListing(const std::string& archivePath, const ScanOptions& options)
+			: m_ArchivePath(std::make_shared<const std::string>(archivePath))
+			, m_Options(options)
+		{
+		}
+
+		std::shared_ptr<ArchiveMember> NewMember(const ArchiveMemberEncoding encoding, const uint64_t offset, const uint64_t storedSize, const uint64_t size)
+		{
+			std::shared_ptr<ArchiveMember> member = std::make_shared<ArchiveMember>();
+			member->archivePath = m_ArchivePath;
+			member->encoding = encoding;
+			member->offset = offset;
+			member->storedSize = storedSize;
+			member->size = size;
+			return member;
+		}
+
+		bool IsExcluded(const std::string& path, const bool isDir)
+		{
+			CountStat(kCounterEntriesScanned);
+			if (m_Options.filter == nullptr)
+				return false;
+
+			if (IsPathExcluded(path, isDir))
+			{
+				CountStat(kCounterEntriesExcluded);
+				return true;
+			}
+			return false;
+		}
+
+		// Later members replace earlier ones with the same path, like they do when extracting
+		FileInfo& Add(const std::string& path, const bool isDir, const uint32_t mode, const uint64_t size, const int64_t mtimeNs)
+		{
+			auto it = m_Indices.find(path);
+			if (it == m_Indices.end())
+			{
+				it = m_Indices.emplace(path, m_Files.size()).first;
+				m_Files.emplace_back();
+			}
+
+			FileInfo& f = m_Files[it->second];
+			f = FileInfo();
+			f.relativePath = path;
+			const size_t slash = path.rfind('/');
+			f.name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+			f.isDir = isDir;
+			f.level = GetPathDepth(path.c_str(), path.size()) + (isDir ? 1 : 0);
+			memset(&f.status, 0, sizeof(f.status));
+			f.status.st_mode = (isDir ? S_IFDIR : S_IFREG) | (mode & 07777);
+			f.status.st_size = isDir ? 0 : size;
+			SetModificationTimeNs(mtimeNs, &f.status);
+			return f;
+		}
+
+		void AddSymlink(const std::string& path, const std::string& target, const int64_t mtimeNs)
+		{
+			if (m_Options.symlinks == kSymlinkSkip)
+			{
+				LogLine(kDebug, "Skipping symlink '%s'", path.c_str());
+				return;
+			}
+
+			FileInfo& f = Add(path, false, 0777, target.size(), mtimeNs);
+			f.status.st_mode = S_IFLNK | 0777;
+			std::shared_ptr<ArchiveMember> member = NewMember(kMemberSymlink, 0, 0, target.size());
+			member->linkTarget = target;
+			f.archiveMember = member;
+		}
+
+		// Archives do not need to list the directories their members are in
+		void AddImplicitDirs()
+		{
+			for (size_t i = 0; i < m_Files.size(); ++i)
+			{
+				const std::string path = m_Files[i].relativePath;
+				for (size_t slash = path.rfind('/'); slash != std::string::npos && slash > 0; slash = path.rfind('/', slash - 1))
+				{
+					const std::string parent = path.substr(0, slash);
+					if (m_Indices.find(parent) != m_Indices.end())
+						break;
+					Add(parent, true, 0755, 0, 0);
+				}
+			}
+		}
+
+		void MoveTo(not_null<std::vector<FileInfo>> outFiles)
+		{
+			outFiles->reserve(outFiles->size() + m_Files.size());
+			for (FileInfo& f : m_Files)
+			{
+				SetPathMatchKey(m_Options, &f);
+				outFiles->push_back(std::move(f));
+			}
+			m_Files.clear();
+			m_Indices.clear();
+		}
+
+	private:
+		bool IsPathExcluded(const std::string& path, const bool isDir)
+		{
+			// Members come in any order, so the parent directories are checked for every member
+			const size_t slash = path.rfind('/');
+			if (slash != std::string::npos && IsDirExcluded(path.substr(0, slash)))
+				return true;
+
+			const std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+			return m_Options.filter->IsExcluded(path, name, isDir);
+		}
+
+		bool IsDirExcluded(const std::string& dir)
+		{
+			auto it = m_DirExcluded.find(dir);
+			if (it != m_DirExcluded.end())
+				return it->second;
+
+			const bool excluded = IsPathExcluded(dir, true);
+			m_DirExcluded.emplace(dir, excluded);
+			return excluded;
+		}
+
+		std::shared_ptr<const std::string> m_ArchivePath;
+		const ScanOptions& m_Options;
+		std::vector<FileInfo> m_Files;
+		std::unordered_map<std::string, size_t> m_Indices;
+		std::unordered_map<std::string, bool> m_DirExcluded;
+	};
+
+	bool HashStream(InputStream& stream, uint64_t size, not_null<uint64_t> outHash)
+	{
+		ContentHasher hasher;
+		std::vector<char> buffer(kStreamBufferSize);
+		while (size > 0)
+		{
+			const size_t toRead = (size_t)std::min<uint64_t>(size, buffer.size());
+			if (!stream.ReadFully(buffer.data(), toRead))
+				return false;
+			hasher.Update(buffer.data(), toRead);
+			size -= toRead;
+		}
+		*outHash = hasher.Digest();
+		return true;
+	}
+
+	StreamDecoder GetTarDecoder(const ArchiveFormat format)
+	{
+		switch (format)
+		{
+			case kArchiveTarGzip: return kDecodeGzip;
+			case kArchiveTarZstd: return kDecodeZstd;
+			default: return kDecodeNone;
+		}
+	}
+
+	ArchiveFormat DetectArchiveFormat(const std::string& path)
+	{
+		const int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return kNotAnArchive;
+
+		char block[kTarBlockSize];
+		const ssize_t bytesRead = pread(fd, block, sizeof(block), 0);
+		close(fd);
+		if (bytesRead < 4)
+			return kNotAnArchive;
+
+		if (memcmp(block, "PK\3\4", 4) == 0 || memcmp(block, "PK\5\6", 4) == 0)
+			return kArchiveZip;
+
+		if ((size_t)bytesRead == kTarBlockSize && IsTarHeader(block))
+			return kArchiveTar;
+
+		// A compressed file is only an archive if it decompresses to a tar
+		ArchiveFormat format = kNotAnArchive;
+		if ((unsigned char)block[0] == 0x1f && (unsigned char)block[1] == 0x8b)
+			format = kArchiveTarGzip;
+		else if (memcmp(block, "\x28\xb5\x2f\xfd", 4) == 0)
+			format = kArchiveTarZstd;
+		else
+			return kNotAnArchive;
+
+#if !DWRAP_WITH_ZSTD
+		// Reported as one so listing it explains what is missing
+		if (format == kArchiveTarZstd)
+			return format;
+#endif
+
+		ArchiveInput input;
+		if (!input.Open(path))
+			return kNotAnArchive;
+		InputStream* stream = input.OpenStream(0, input.GetFileSize(), GetTarDecoder(format));
+		if (stream == nullptr || !stream->ReadFully(block, kTarBlockSize) || !IsTarHeader(block))
+			return kNotAnArchive;
+		return format;
+	}
+
+	bool ListTar(const std::string& archivePath, const ArchiveFormat format, ArchiveListing& listing)
+	{
+		ArchiveInput input;
+		if (!input.Open(archivePath))
+			return false;
+		InputStream* stream = input.OpenStream(0, input.GetFileSize(), GetTarDecoder(format));
+		if (stream == nullptr)
+			return false;
+
+		// Position in the (decompressed) tar stream
+		uint64_t position = 0;
+		char block[kTarBlockSize];
+
+		// GNU long names and pax headers apply to the member that follows them
+		std::string nextPath;
+		std::string nextLinkPath;
+		bool hasNextSize = false;
+		uint64_t nextSize = 0;
+		bool hasNextMtime = false;
+		int64_t nextMtimeNs = 0;
+
+		while (true)
+		{
+			const long firstRead = stream->Read(block, kTarBlockSize);
+			if (firstRead == 0)
+				break;
+			if (firstRead < 0 || !stream->ReadFully(block + firstRead, kTarBlockSize - firstRead))
+			{
+				LogLine(kError, "Archive '%s' is truncated", archivePath.c_str());
+				return false;
+			}
+			position += kTarBlockSize;
+
+			if (IsZeroBlock(block))
+				break;
+			if (!IsTarHeader(block))
+			{
+				LogLine(kError, "Archive '%s' is corrupt", archivePath.c_str());
+				return false;
+			}
+
+			const char type = block[156];
+			const bool isExtension = (type == 'L' || type == 'K' || type == 'x' || type == 'g');
+			const uint64_t size = (hasNextSize && !isExtension) ? nextSize : ParseTarNumber(block + 124, 12);
+			const uint64_t padding = (kTarBlockSize - size % kTarBlockSize) % kTarBlockSize;
+
+			if (type == 'L' || type == 'K' || type == 'x')
+			{
+				std::string data(size, '\0');
+				if (!stream->ReadFully(&data[0], size) || !stream->Skip(padding))
+				{
+					LogLine(kError, "Archive '%s' is truncated", archivePath.c_str());
+					return false;
+				}
+				position += size + padding;
+
+				if (type == 'L' || type == 'K')
+				{
+					(type == 'L' ? nextPath : nextLinkPath) = data.c_str();
+					continue;
+				}
+
+				// pax records are "<length> <key>=<value>\n"
+				for (size_t recordStart = 0; recordStart < data.size();)
+				{
+					const size_t recordLength = strtoul(data.c_str() + recordStart, nullptr, 10);
+					const size_t space = data.find(' ', recordStart);
+					const size_t equals = data.find('=', recordStart);
+					if (recordLength == 0 || space == std::string::npos || equals == std::string::npos || recordStart + recordLength > data.size())
+						break;
+
+					const std::string key = data.substr(space + 1, equals - space - 1);
+					const std::string value = data.substr(equals + 1, recordStart + recordLength - 1 - equals - 1);
+					if (key == "path")
+					{
+						nextPath = value;
+					}
+					else if (key == "linkpath")
+					{
+						nextLinkPath = value;
+					}
+					else if (key == "size")
+					{
+						hasNextSize = true;
+						nextSize = strtoull(value.c_str(), nullptr, 10);
+					}
+					else if (key == "mtime")
+					{
+						hasNextMtime = true;
+						nextMtimeNs = ParsePaxTime(value);
+					}
+
+					recordStart += recordLength;
+				}
+				continue;
+			}
+
+			if (type == 'g')
+			{
+				if (!stream->Skip(size + padding))
+				{
+					LogLine(kError, "Archive '%s' is truncated", archivePath.c_str());
+					return false;
+				}
+				position += size + padding;
+				continue;
+			}
+
+			std::string path = nextPath;
+			if (path.empty())
+			{
+				path = GetTarString(block, 100);
+				const std::string prefix = GetTarString(block + 345, 155);
+				if (memcmp(block + 257, "ustar", 5) == 0 && !prefix.empty())
+					path = prefix + "/" + path;
+			}
+			const bool isDir = (type == '5') || (type == '\0' && !path.empty() && path.back() == '/');
+			const bool isFile = !isDir && (type == '0' || type == '\0' || type == '7');
+			const bool isSymlink = (type == '2');
+			const int64_t mtimeNs = hasNextMtime ? nextMtimeNs : (int64_t)ParseTarNumber(block + 136, 12) * 1000000000ll;
+			const uint32_t mode = (uint32_t)ParseTarNumber(block + 100, 8);
+			const std::string linkPath = nextLinkPath.empty() ? GetTarString(block + 157, 100) : nextLinkPath;
+
+			nextPath.clear();
+			nextLinkPath.clear();
+			hasNextSize = false;
+			hasNextMtime = false;
+
+			const uint64_t dataOffset = position;
+			bool skipData = true;
+			if (isSymlink && NormalizeMemberPath(&path) && !listing.IsExcluded(path, false))
+			{
+				listing.AddSymlink(path, linkPath, mtimeNs);
+			}
+			else if ((isDir || isFile) && NormalizeMemberPath(&path) && !listing.IsExcluded(path, isDir))
+			{
+				FileInfo& f = listing.Add(path, isDir, mode, size, mtimeNs);
+				if (isFile && format == kArchiveTar)
+				{
+					f.archiveMember = listing.NewMember(kMemberStored, dataOffset, size, size);
+				}
+				else if (isFile)
+				{
+					// Compressed tars can only be read front to back, so members are hashed right away
+					f.archiveMember = listing.NewMember((format == kArchiveTarGzip) ? kMemberInGzipStream : kMemberInZstdStream, dataOffset, size, size);
+
+					TraceScope trace("HashArchiveMember", f.relativePath.c_str(), size);
+					if (!HashStream(*stream, size, &f.contentHash))
+					{
+						LogLine(kError, "Archive '%s' is truncated", archivePath.c_str());
+						return false;
+					}
+					f.hasContentHash = true;
+					skipData = false;
+				}
+			}
+			else if (!isDir && !isFile && !isSymlink)
+			{
+				LogLine(kDebug, "Skipping archive member '%s'", path.c_str());
+			}
+
+			if (!stream->Skip((skipData ? size : 0) + padding))
+			{
+				LogLine(kError, "Archive '%s' is truncated", archivePath.c_str());
+				return false;
+			}
+			position += size + padding;
+		}
+
+		return true;
+	}
+
+	InputStream* OpenMember(const ArchiveMember& member, ArchiveInput& input);
+
+	bool ReadSymlinkTarget(const ArchiveMember& member, ArchiveInput& input, not_null<std::string> outTarget)
+	{
+		if (member.size > PATH_MAX)
+			return false;
+
+		InputStream* stream = OpenMember(member, input);
+		outTarget->resize(member.size);
+		return stream != nullptr && (member.size == 0 || stream->ReadFully(&(*outTarget)[0], member.size));
+	}
+
+	bool ListZip(const std::string& archivePath, ArchiveListing& listing)
+	{
+		ArchiveInput input;
+		if (!input.Open(archivePath))
+			return false;
+		const int fd = input.GetFd();
+		const uint64_t fileSize = input.GetFileSize();
+
+		// The end of central directory record is in the last 64KB, followed only by a comment
+		const size_t kEndRecordSize = 22;
+		const size_t tailSize = (size_t)std::min<uint64_t>(fileSize, kEndRecordSize + 0xffff);
+		std::vector<unsigned char> tail(tailSize);
+		CountStat(kCounterRead);
+		if (tailSize < kEndRecordSize || pread(fd, tail.data(), tailSize, fileSize - tailSize) != (ssize_t)tailSize)
+		{
+			LogLine(kError, "Archive '%s' is truncated", archivePath.c_str());
+			return false;
+		}
+
+		size_t endRecord = tailSize - kEndRecordSize + 1;
+		while (endRecord-- > 0)
+		{
+			if (memcmp(&tail[endRecord], "PK\5\6", 4) == 0)
+				break;
+		}
+		if (endRecord == (size_t)-1)
+		{
+			LogLine(kError, "Archive '%s' has no central directory", archivePath.c_str());
+			return false;
+		}
+
+		uint64_t entryCount = ReadLE16(&tail[endRecord + 10]);
+		uint64_t directorySize = ReadLE32(&tail[endRecord + 12]);
+		uint64_t directoryOffset = ReadLE32(&tail[endRecord + 16]);
+
+		// zip64 archives keep the real values in another record, found through a locator right before this one
+		if (entryCount == 0xffff || directorySize == 0xffffffff || directoryOffset == 0xffffffff)
+		{
+			unsigned char record[56];
+			const uint64_t locator = fileSize - tailSize + endRecord - 20;
+			if (endRecord + (fileSize - tailSize) < 20 || pread(fd, record, 20, locator) != 20 || memcmp(record, "PK\6\7", 4) != 0
+				|| pread(fd, record, 56, ReadLE64(record + 8)) != 56 || memcmp(record, "PK\6\6", 4) != 0)
+			{
+				LogLine(kError, "Archive '%s' has a corrupt zip64 directory", archivePath.c_str());
+				return false;
+			}
+			entryCount = ReadLE64(record + 32);
+			directorySize = ReadLE64(record + 40);
+			directoryOffset = ReadLE64(record + 48);
+		}
+
+		FileStream directory(fd, directoryOffset, directorySize);
+		std::string path;
+		std::vector<unsigned char> extra;
+		for (uint64_t i = 0; i < entryCount; ++i)
+		{
+			unsigned char header[46];
+			if (!directory.ReadFully((char*)header, sizeof(header)) || memcmp(header, "PK\1\2", 4) != 0)
+			{
+				LogLine(kError, "Archive '%s' has a corrupt central directory", archivePath.c_str());
+				return false;
+			}
+
+			const uint16_t madeBy = ReadLE16(header + 4);
+			const uint16_t flags = ReadLE16(header + 8);
+			const uint16_t method = ReadLE16(header + 10);
+			uint64_t storedSize = ReadLE32(header + 20);
+			uint64_t size = ReadLE32(header + 24);
+			const uint16_t nameLength = ReadLE16(header + 28);
+			const uint16_t extraLength = ReadLE16(header + 30);
+			const uint16_t commentLength = ReadLE16(header + 32);
+			const uint32_t externalAttributes = ReadLE32(header + 38);
+			uint64_t localHeader = ReadLE32(header + 42);
+			int64_t mtimeNs = DosTimeToNs(ReadLE16(header + 12), ReadLE16(header + 14));
+
+			path.resize(nameLength);
+			extra.resize(extraLength);
+			if (!directory.ReadFully(&path[0], nameLength) || !directory.ReadFully((char*)extra.data(), extraLength) || !directory.Skip(commentLength))
+			{
+				LogLine(kError, "Archive '%s' has a corrupt central directory", archivePath.c_str());
+				return false;
+			}
+
+			for (size_t e = 0; e + 4 <= extra.size();)
+			{
+				const uint16_t id = ReadLE16(&extra[e]);
+				const uint16_t length = ReadLE16(&extra[e + 2]);
+				const unsigned char* data = &extra[e + 4];
+				if (e + 4 + length > extra.size())
+					break;
+
+				if (id == 0x0001)
+				{
+					// zip64 sizes, only present for the fields that overflowed
+					const unsigned char* field = data;
+					const unsigned char* fieldsEnd = data + length;
+					for (uint64_t* value : { &size, &storedSize, &localHeader })
+					{
+						if (*value == 0xffffffff && field + 8 <= fieldsEnd)
+						{
+							*value = ReadLE64(field);
+							field += 8;
+						}
+					}
+				}
+				else if (id == 0x5455 && length >= 5 && (data[0] & 1))
+				{
+					// Extended timestamp, the mtime in Unix seconds
+					mtimeNs = (int64_t)(int32_t)ReadLE32(data + 1) * 1000000000ll;
+				}
+				e += 4 + length;
+			}
+
+			const uint32_t unixMode = ((madeBy >> 8) == 3) ? (externalAttributes >> 16) : 0;
+			const bool isSymlink = S_ISLNK(unixMode);
+			const bool isDir = !isSymlink && ((!path.empty() && path.back() == '/') || S_ISDIR(unixMode));
+
+			std::string memberPath = path;
+			if (!NormalizeMemberPath(&memberPath) || listing.IsExcluded(memberPath, isDir))
+				continue;
+
+			if (!isDir && (flags & 1))
+			{
+				LogLine(kError, "'%s' in archive '%s' is encrypted", memberPath.c_str(), archivePath.c_str());
+				return false;
+			}
+			if (!isDir && method != 0 && method != 8)
+			{
+				LogLine(kError, "'%s' in archive '%s' uses unsupported compression method %u", memberPath.c_str(), archivePath.c_str(), method);
+				return false;
+			}
+
+			const ArchiveMemberEncoding encoding = (method == 8) ? kMemberZipDeflated : kMemberZipStored;
+			if (isSymlink)
+			{
+				// The target is stored as the member's contents
+				std::string target;
+				if (!ReadSymlinkTarget(*listing.NewMember(encoding, localHeader, storedSize, size), input, &target))
+				{
+					LogLine(kError, "Could not read symlink '%s' in archive '%s'", memberPath.c_str(), archivePath.c_str());
+					return false;
+				}
+				listing.AddSymlink(memberPath, target, mtimeNs);
+				continue;
+			}
+
+			FileInfo& f = listing.Add(memberPath, isDir, unixMode ? unixMode : 0644, size, mtimeNs);
+			if (!isDir)
+				f.archiveMember = listing.NewMember(encoding, localHeader, storedSize, size);
+		}
+
+		return true;
+	}
+
+	InputStream* OpenMember(const ArchiveMember& member, ArchiveInput& input)
+	{
+		switch (member.encoding)
+		{
+			case kMemberStored:
+				return input.OpenStream(member.offset, member.size, kDecodeNone);
+
+			case kMemberZipStored:
+			case kMemberZipDeflated:
+			{
+				// The data follows the local header, whose name and extra field can differ from the central directory's
+				unsigned char header[30];
+				CountStat(kCounterRead);
+				if (pread(input.GetFd(), header, sizeof(header), member.offset) != sizeof(header) || memcmp(header, "PK\3\4", 4) != 0)
+					return nullptr;
+				const uint64_t dataOffset = member.offset + sizeof(header) + ReadLE16(header + 26) + ReadLE16(header + 28);
+				return input.OpenStream(dataOffset, member.storedSize, (member.encoding == kMemberZipDeflated) ? kDecodeDeflate : kDecodeNone);
+			}
+
+			case kMemberInGzipStream:
+			case kMemberInZstdStream:
+			{
+				InputStream* stream = input.OpenStream(0, input.GetFileSize(), (member.encoding == kMemberInGzipStream) ? kDecodeGzip : kDecodeZstd);
+				if (stream == nullptr || !stream->Skip(member.offset))
+					return nullptr;
+				return stream;
+			}
+
+			case kMemberSymlink:
+				return nullptr;
+		}
+		return nullptr;
+	}
+
+	// Member names come from the archive, only a plain basename of them goes into a temporary path
+	const size_t kMaxTempNameLength = 64;
+
+	std::string GetSafeTempName(const std::string& name)
+	{
+		const size_t slash = name.find_last_of('/');
+		std::string safeName = name.substr(slash == std::string::npos ? 0 : slash + 1);
+		if (safeName.size() > kMaxTempNameLength)
+			safeName.erase(0, safeName.size() - kMaxTempNameLength);
+		for (char& c : safeName)
+		{
+			if (!isalnum((unsigned char)c) && c != '.' && c != '_' && c != '-' && c != '+')
+				c = '_';
+		}
+		// A leading dot or dash would hide the file or read as an option
+		if (safeName.empty() || safeName[0] == '.' || safeName[0] == '-')
+			safeName.insert(0, "member");
+		return safeName;
+	}
+}
+
+bool IsArchiveFile(const std::string& path)
+{
+	return DetectArchiveFormat(path) != kNotAnArchive;
+}
+
+bool ListFilesInArchive(const std::string& archivePath, const ScanOptions& options, not_null<std::vector<FileInfo>> outFiles)
+{
+	TraceScope trace("ListArchive", archivePath.c_str());
+
+	ArchiveListing listing(archivePath, options);
+	const ArchiveFormat format = DetectArchiveFormat(archivePath);
+	switch (format)
+	{
+		case kArchiveTar:
+		case kArchiveTarGzip:
+		case kArchiveTarZstd:
+			if (!ListTar(archivePath, format, listing))
+				return false;
+			break;
+		case kArchiveZip:
+			if (!ListZip(archivePath, listing))
+				return false;
+			break;
+		default:
+			LogLine(kError, "'%s' is not an archive", archivePath.c_str());
+			return false;
+	}
+
+	listing.AddImplicitDirs();
+	listing.MoveTo(outFiles);
+	return true;
+}
+
+bool HashArchiveMember(const ArchiveMember& member, not_null<uint64_t> outHash)
+{
+	TraceScope trace("HashArchiveMember", member.archivePath->c_str(), member.size);
+
+	if (member.encoding == kMemberSymlink)
+	{
+		ContentHasher hasher;
+		hasher.Update(member.linkTarget.data(), member.linkTarget.size());
+		*outHash = hasher.Digest();
+		return true;
+	}
+
+	ArchiveInput input;
+	if (!input.Open(*member.archivePath))
+		return false;
+
+	InputStream* stream = OpenMember(member, input);
+	if (stream == nullptr || !HashStream(*stream, member.size, outHash))
+	{
+		LogLine(kError, "Could not read member at offset %llu of archive '%s'", (unsigned long long)member.offset, member.archivePath->c_str());
+		return false;
+	}
+	return true;
+}
+
+bool ExtractArchiveMember(const ArchiveMember& member, const std::string& name, not_null<std::string> outTempPath)
+{
+	// The member's name is kept as the suffix, tools pick their syntax highlighting from it
+	const char* tempDir = getenv("TMPDIR");
+	const std::string safeName = GetSafeTempName(name);
+	std::string tempPath = std::string((tempDir && tempDir[0]) ? tempDir : "/tmp") + "/dwrap-XXXXXX-" + safeName;
+	const int fd = mkstemps(&tempPath[0], (int)safeName.size() + 1);
+	if (fd < 0)
+	{
+		LogLine(kError, "Could not create a temporary file for '%s'", name.c_str());
+		return false;
+	}
+
+	ArchiveInput input;
+	const bool isSymlink = (member.encoding == kMemberSymlink);
+	InputStream* stream = (!isSymlink && input.Open(*member.archivePath)) ? OpenMember(member, input) : nullptr;
+
+	// A symlink is extracted as a file holding its target, which is what its diff shows
+	bool extracted = isSymlink ? write(fd, member.linkTarget.data(), member.linkTarget.size()) == (ssize_t)member.linkTarget.size() : (stream != nullptr);
+	std::vector<char> buffer(kStreamBufferSize);
+	for (uint64_t remaining = isSymlink ? 0 : member.size; extracted && remaining > 0;)
+	{
+		const size_t toRead = (size_t)std::min<uint64_t>(remaining, buffer.size());
+		extracted = stream->ReadFully(buffer.data(), toRead) && write(fd, buffer.data(), toRead) == (ssize_t)toRead;
+		remaining -= toRead;
+	}
+	extracted = (close(fd) == 0) && extracted;
+
+	if (!extracted)
+	{
+		LogLine(kError, "Could not extract '%s' from archive '%s'", name.c_str(), member.archivePath->c_str());
+		unlink(tempPath.c_str());
+		return false;
+	}
+
+	*outTempPath = tempPath;
+	return true;
+}
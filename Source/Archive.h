@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "FileUtils.h"
+
+// Archive sources: tar (plain, gzip or zstd compressed) and zip files listed as if they were
+// an extracted directory. Member contents are streamed out of the archive when they are
+// hashed, they are only written to disk when a diff tool needs a real file.
+
+enum ArchiveMemberEncoding
+{
+	// offset is where the data starts in the archive file
+	kMemberStored,
+	// offset is the local header of a zip member, its data is stored or deflated
+	kMemberZipStored,
+	kMemberZipDeflated,
+	// offset is where the data starts in the decompressed archive stream
+	kMemberInGzipStream,
+	kMemberInZstdStream,
+	// a symlink, its contents are linkTarget
+	kMemberSymlink,
+};
+
+struct ArchiveMember
+{
+	std::shared_ptr<const std::string> archivePath;
+	ArchiveMemberEncoding encoding;
+	uint64_t offset;
+	uint64_t storedSize;
+	uint64_t size;
+	std::string linkTarget;
+};
+
+bool IsArchiveFile(const std::string& path);
+
+// Lists the members of an archive like a directory scan would, unsorted. Directories that
+// only exist implicitly as a member's parent are listed too. Symlinks cannot be followed inside
+// an archive, they are listed as links unless the scan skips them.
+bool ListFilesInArchive(const std::string& archivePath, const ScanOptions& options, not_null<std::vector<FileInfo>> outFiles);
+
+bool HashArchiveMember(const ArchiveMember& member, not_null<uint64_t> outHash);
+
+// Writes the member to a new temporary file named after it, the caller removes it when done
+bool ExtractArchiveMember(const ArchiveMember& member, const std::string& name, not_null<std::string> outTempPath);
@@ -1,3 +1,200 @@
 #include "Common.h"
 
-LogLevel g_LogLevel = kOutput;
\ No newline at end of file
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+std::atomic<int> g_LogLevel(kOutput);
+
+namespace
+{
+	const size_t kLogBufferFlushSize = 64 * 1024;
+	const std::chrono::milliseconds kLogFlushInterval(20);
+
+	struct LogBuffer
+	{
+		std::mutex mutex;
+		// Consecutive writes to the same stream share a chunk, so stdout/stderr order is kept
+		std::vector<std::pair<FILE*, std::string>> chunks;
+		size_t bufferedSize = 0;
+		bool threadExited = false;
+	};
+
+	std::mutex s_registryMutex;
+	std::vector<std::shared_ptr<LogBuffer>> s_logBuffers;
+
+	// Held while writing so chunks from different drains never interleave or reorder
+	std::mutex s_outputMutex;
+
+	std::mutex s_flusherMutex;
+	std::condition_variable s_flusherWakeup;
+	std::thread s_flusherThread;
+	std::atomic<bool> s_flusherRunning(false);
+	bool s_flusherStop = false;
+
+	void DrainLogBuffer(LogBuffer& buffer)
+	{
+		std::lock_guard<std::mutex> outputLock(s_outputMutex);
+
+		std::vector<std::pair<FILE*, std::string>> chunks;
+		{
+			std::lock_guard<std::mutex> lock(buffer.mutex);
+			chunks.swap(buffer.chunks);
+			buffer.bufferedSize = 0;
+		}
+
+		for (const auto& chunk : chunks)
+		{
+			fwrite(chunk.second.data(), 1, chunk.second.size(), chunk.first);
+			fflush(chunk.first);
+		}
+	}
+
+	void DrainAllLogBuffers()
+	{
+		std::vector<std::shared_ptr<LogBuffer>> buffers;
+		{
+			std::lock_guard<std::mutex> lock(s_registryMutex);
+			buffers = s_logBuffers;
+
+			// Buffers of exited threads only need one last drain
+			s_logBuffers.erase(std::remove_if(s_logBuffers.begin(), s_logBuffers.end(),
+				[](const std::shared_ptr<LogBuffer>& b) { std::lock_guard<std::mutex> l(b->mutex); return b->threadExited; }),
+				s_logBuffers.end());
+		}
+
+		for (const auto& buffer : buffers)
+			DrainLogBuffer(*buffer);
+	}
+
+	class ThreadLogBuffer
+	{
+	public:
+		ThreadLogBuffer()
+			: m_Buffer(std::make_shared<LogBuffer>())
+		{
+			std::lock_guard<std::mutex> lock(s_registryMutex);
+			s_logBuffers.push_back(m_Buffer);
+		}
+		~ThreadLogBuffer()
+		{
+			DrainLogBuffer(*m_Buffer);
+			std::lock_guard<std::mutex> lock(m_Buffer->mutex);
+			m_Buffer->threadExited = true;
+		}
+		LogBuffer& Get()
+		{
+			return *m_Buffer;
+		}
+	private:
+		std::shared_ptr<LogBuffer> m_Buffer;
+	};
+
+	thread_local ThreadLogBuffer t_logBuffer;
+
+	void FlusherLoop()
+	{
+		std::unique_lock<std::mutex> lock(s_flusherMutex);
+		while (!s_flusherStop)
+		{
+			s_flusherWakeup.wait_for(lock, kLogFlushInterval);
+			lock.unlock();
+			DrainAllLogBuffers();
+			lock.lock();
+		}
+	}
+
+	void FormatLine(std::string& target, const LogLevel level, const bool newLine, const char* format, va_list args)
+	{
+		if (newLine && level != kOutput)
+			target += "drwap: ";
+
+		char stackBuf[512];
+		va_list argsCopy;
+		va_copy(argsCopy, args);
+		const int length = vsnprintf(stackBuf, sizeof(stackBuf), format, argsCopy);
+		va_end(argsCopy);
+
+		if (length > 0)
+		{
+			if (length < (int)sizeof(stackBuf))
+			{
+				target.append(stackBuf, length);
+			}
+			else
+			{
+				const size_t offset = target.size();
+				target.resize(offset + length + 1);
+				vsnprintf(&target[offset], length + 1, format, args);
+				target.resize(offset + length);
+			}
+		}
+
+		if (newLine)
+			target += '\n';
+	}
+}
+
+void LogWrite(const LogLevel level, const bool newLine, const char* format, ...)
+{
+	LogBuffer& buffer = t_logBuffer.Get();
+
+	size_t bufferedSize;
+	{
+		std::lock_guard<std::mutex> lock(buffer.mutex);
+		FILE* stream = (level == kOutput) ? stdout : stderr;
+		if (buffer.chunks.empty() || buffer.chunks.back().first != stream)
+			buffer.chunks.emplace_back(stream, std::string());
+
+		std::string& target = buffer.chunks.back().second;
+		const size_t sizeBefore = target.size();
+		va_list args;
+		va_start(args, format);
+		FormatLine(target, level, newLine, format, args);
+		va_end(args);
+		buffer.bufferedSize += target.size() - sizeBefore;
+		bufferedSize = buffer.bufferedSize;
+	}
+
+	// Errors are never held back, and without a flusher we write through
+	if (level == kError || !s_flusherRunning.load(std::memory_order_relaxed))
+		DrainLogBuffer(buffer);
+	else if (bufferedSize >= kLogBufferFlushSize)
+		s_flusherWakeup.notify_one();
+}
+
+void LogFlush()
+{
+	DrainAllLogBuffers();
+}
+
+void StartLogFlusher()
+{
+	std::lock_guard<std::mutex> lock(s_flusherMutex);
+	if (s_flusherRunning)
+		return;
+
+	s_flusherStop = false;
+	s_flusherThread = std::thread(FlusherLoop);
+	s_flusherRunning = true;
+}
+
+void StopLogFlusher()
+{
+	{
+		std::lock_guard<std::mutex> lock(s_flusherMutex);
+		if (!s_flusherRunning)
+			return;
+		s_flusherStop = true;
+		s_flusherRunning = false;
+	}
+	s_flusherWakeup.notify_one();
+	s_flusherThread.join();
+
+	DrainAllLogBuffers();
+}
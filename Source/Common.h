@@ -1,9 +1,12 @@
 #pragma once
 
+#include <atomic>
+#include <cassert>
 #include <cstdio>
 #include <stdarg.h>
 
 #define EX_OK           0       /* successful termination */
+#define EX_DIFFERENT    1       /* the compared paths differ, like diff(1) */
 #define EX_USAGE        64      /* command line usage error */
 #define EX_IOERR        74      /* input/output error */
 
@@ -36,6 +39,11 @@ private:
 	T* m_Ptr;
 };
 
+// Debug level logging can be compiled out entirely by building with DWRAP_DEBUG_LOGGING=0
+#ifndef DWRAP_DEBUG_LOGGING
+#define DWRAP_DEBUG_LOGGING 1
+#endif
+
 enum LogLevel
 {
 	kError,
@@ -43,44 +51,29 @@ enum LogLevel
 	kDebug,
 };
 
-extern LogLevel g_LogLevel;
+extern std::atomic<int> g_LogLevel;
 inline void SetLogLevel(const LogLevel level)
 {
-	g_LogLevel = level;
+	g_LogLevel.store(level, std::memory_order_relaxed);
 }
 
-inline void Log(const LogLevel level, const char* format, ...)
+inline bool IsLogEnabled(const LogLevel level)
 {
-	if (level <= g_LogLevel)
-	{
-		va_list args;
-		va_start(args, format);
-		if (level == kOutput)
-			vfprintf(stdout, format, args);
-		else
-			vfprintf(stderr, format, args);
-	}
+	if (level == kDebug && !DWRAP_DEBUG_LOGGING)
+		return false;
+	return level <= g_LogLevel.load(std::memory_order_relaxed);
 }
 
-inline void LogLine(const LogLevel level, const char* format, ...)
-{
-	if (level <= g_LogLevel)
-	{
-		va_list args;
-		va_start(args, format);
-		if (level == kOutput)
-		{
-			vfprintf(stdout, format, args);
-			fprintf(stdout, "\n");
-		}
-		else
-		{
-			if (level != kOutput)
-				fprintf(stderr, "drwap: ");
-			vfprintf(stderr, format, args);
-			fprintf(stderr, "\n");
-		}
+// Formats into the calling thread's log buffer, use the Log/LogLine macros instead
+void LogWrite(const LogLevel level, const bool newLine, const char* format, ...);
 
-	}
-}
+// Writes out everything buffered so far, from all threads
+void LogFlush();
+
+// While the flusher runs, output is batched per thread and written by a background thread
+void StartLogFlusher();
+void StopLogFlusher();
 
+// The level is checked before any of the arguments are evaluated
+#define Log(level, ...) do { if (IsLogEnabled(level)) LogWrite(level, false, __VA_ARGS__); } while (0)
+#define LogLine(level, ...) do { if (IsLogEnabled(level)) LogWrite(level, true, __VA_ARGS__); } while (0)
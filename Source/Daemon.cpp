@@ -0,0 +1,931 @@
+#include "Daemon.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <set>
+#include <unordered_map>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "DeviceScheduler.h"
+#include "Trace.h"
+
+// Requests and responses are sequences of NUL terminated fields.
+//   Request:  "diff", "contents" or "sizeOnly", left path, right path
+//   Response: per entry its status ('+', '-', 'M' or '='), 'd' or 'f', first differing byte and
+//             relative path, then "end", or "error" and a message
+
+namespace
+{
+	const char* const kRequestDiff = "diff";
+	const char* const kResponseEnd = "end";
+	const char* const kResponseError = "error";
+
+	// Longer fields are not something a well behaved peer sends
+	const size_t kMaxFieldSize = 1024 * 1024;
+
+	// A client that stops sending or reading must not stall the daemon for everyone else
+	const int kClientTimeoutSeconds = 10;
+
+	volatile sig_atomic_t s_stopRequested = 0;
+
+	void OnStopSignal(int)
+	{
+		s_stopRequested = 1;
+	}
+
+	class FieldWriter
+	{
+	public:
+		FieldWriter(const int fd) : m_Fd(fd), m_Failed(false) {}
+
+		void Write(const std::string& field)
+		{
+			m_Buffer.append(field);
+			m_Buffer.push_back('\0');
+			if (m_Buffer.size() >= 64 * 1024)
+				Flush();
+		}
+
+		bool Flush()
+		{
+			for (size_t offset = 0; offset < m_Buffer.size() && !m_Failed; )
+			{
+				const ssize_t written = write(m_Fd, m_Buffer.data() + offset, m_Buffer.size() - offset);
+				if (written < 0 && errno == EINTR)
+					continue;
+				if (written <= 0)
+					m_Failed = true;
+				else
+					offset += written;
+			}
+			m_Buffer.clear();
+			return !m_Failed;
+		}
+
+	private:
+		int m_Fd;
+		std::string m_Buffer;
+		// Once the peer is gone the rest is dropped
+		bool m_Failed;
+	};
+
+	class FieldReader
+	{
+	public:
+		FieldReader(const int fd) : m_Fd(fd), m_Begin(0), m_End(0) {}
+
+		bool Read(not_null<std::string> outField)
+		{
+			outField->clear();
+			for (;;)
+			{
+				const char* end = (const char*)memchr(m_Buffer + m_Begin, '\0', m_End - m_Begin);
+				if (end != nullptr)
+				{
+					outField->append(m_Buffer + m_Begin, end - (m_Buffer + m_Begin));
+					m_Begin = end - m_Buffer + 1;
+					return true;
+				}
+
+				outField->append(m_Buffer + m_Begin, m_End - m_Begin);
+				if (outField->size() > kMaxFieldSize)
+					return false;
+
+				const ssize_t bytesRead = read(m_Fd, m_Buffer, sizeof(m_Buffer));
+				if (bytesRead < 0 && errno == EINTR)
+					continue;
+				if (bytesRead <= 0)
+					return false;
+				m_Begin = 0;
+				m_End = bytesRead;
+			}
+		}
+
+	private:
+		int m_Fd;
+		char m_Buffer[64 * 1024];
+		size_t m_Begin;
+		size_t m_End;
+	};
+
+	bool MakeSocketAddress(const std::string& path, not_null<sockaddr_un> outAddress)
+	{
+		if (path.size() >= sizeof(outAddress->sun_path))
+		{
+			LogLine(kError, "Socket path '%s' is too long.", path.c_str());
+			return false;
+		}
+
+		memset(outAddress, 0, sizeof(sockaddr_un));
+		outAddress->sun_family = AF_UNIX;
+		memcpy(outAddress->sun_path, path.c_str(), path.size() + 1);
+		return true;
+	}
+
+	// -1 when nobody listens on the socket
+	int ConnectToSocket(const sockaddr_un& address)
+	{
+		const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			return -1;
+		if (connect(fd, (const sockaddr*)&address, sizeof(address)) != 0)
+		{
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	// The socket may be in /tmp, where another user can create it first. Neither side talks to a
+	// peer running as someone else.
+	bool IsPeerSameUser(const int fd)
+	{
+#ifdef __linux__
+		ucred credentials;
+		socklen_t size = sizeof(credentials);
+		return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size) == 0 && credentials.uid == getuid();
+#else
+		uid_t uid;
+		gid_t gid;
+		return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+#endif
+	}
+
+	bool GetRealPath(const std::string& path, not_null<std::string> outRealPath)
+	{
+		char buffer[PATH_MAX];
+		if (realpath(path.c_str(), buffer) == nullptr)
+		{
+			LogLine(kError, "Path '%s' is not a file nor a directory.", path.c_str());
+			return false;
+		}
+		*outRealPath = buffer;
+		return true;
+	}
+
+	class WatchedTree;
+
+	// Maps inotify watches back to the directories of the trees they were added for
+	class DirectoryWatcher
+	{
+	public:
+		DirectoryWatcher();
+		~DirectoryWatcher();
+		DirectoryWatcher(const DirectoryWatcher&) = delete;
+		DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+		bool IsValid() const { return m_Fd >= 0; }
+		int GetFd() const { return m_Fd; }
+
+		// False when the directory cannot be watched, its tree is then rescanned for every query
+		bool Watch(const std::string& path, WatchedTree* tree, const std::string& relDir);
+
+		// Marks the directories of pending events dirty, never blocks
+		void ReadEvents(const std::vector<std::unique_ptr<WatchedTree>>& trees);
+
+	private:
+		struct WatchedDir
+		{
+			WatchedTree* tree;
+			std::string relDir;
+		};
+
+		int m_Fd;
+		// Overlapping trees share the watch of a directory they both contain
+		std::unordered_map<int, std::vector<WatchedDir>> m_Watches;
+	};
+
+	// The listing of a directory tree, kept sorted by relative path and up to date by
+	// rescanning only the directories inotify reported changes in
+	class WatchedTree
+	{
+	public:
+		WatchedTree(const std::string& root, const ScanOptions& options, DirectoryWatcher& watcher)
+			: m_Root(root)
+			, m_Options(options)
+			, m_Watcher(watcher)
+			, m_NeedsFullScan(true)
+			, m_Watched(false)
+			, m_SortedValid(false)
+		{
+		}
+
+		WatchedTree(const WatchedTree&) = delete;
+		WatchedTree& operator=(const WatchedTree&) = delete;
+
+		const std::string& GetRoot() const { return m_Root; }
+
+		void MarkDirty(const std::string& relDir) { m_DirtyDirs.insert(relDir); }
+		void MarkAllDirty() { m_NeedsFullScan = true; }
+
+		// Applies the changes since the last call, scanning the whole tree the first time
+		bool Refresh();
+
+		// Sorted like SortFileList would
+		const std::vector<FileInfo*>& GetFiles();
+
+	private:
+		bool Scan();
+		bool RefreshDirectory(const std::string& relDir);
+		void AddSubtree(const std::string& relDir, const int dirLevel);
+		void RemoveSubtree(const std::string relativePath);
+		void Watch(const std::string& relDir);
+
+		const std::string m_Root;
+		const ScanOptions& m_Options;
+		DirectoryWatcher& m_Watcher;
+
+		std::map<std::string, FileInfo> m_Files;
+		// Ordered so parents are refreshed before their subdirectories
+		std::set<std::string> m_DirtyDirs;
+		bool m_NeedsFullScan;
+		bool m_Watched;
+
+		std::vector<FileInfo*> m_Sorted;
+		bool m_SortedValid;
+	};
+
+	// Carries a cached hash over to the new listing of a file unless the file changed. The mtime
+	// alone can be restored after a rewrite, as touch -r, cp -p or tar do, the ctime cannot.
+	void KeepContentHash(const FileInfo& oldFile, not_null<FileInfo> newFile)
+	{
+		if (IsDir(oldFile) || IsDir(*newFile) || !oldFile.hasContentHash)
+			return;
+		if (FileSize(oldFile) != FileSize(*newFile)
+			|| GetModificationTimeNs(oldFile.status) != GetModificationTimeNs(newFile->status)
+			|| GetChangeTimeNs(oldFile.status) != GetChangeTimeNs(newFile->status)
+			|| oldFile.status.st_ino != newFile->status.st_ino
+			|| oldFile.status.st_dev != newFile->status.st_dev)
+			return;
+
+		newFile->contentHash = oldFile.contentHash;
+		newFile->hasContentHash = true;
+	}
+
+#ifdef __linux__
+	const uint32_t kWatchMask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB
+		| IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+	DirectoryWatcher::DirectoryWatcher()
+		: m_Fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+	{
+		if (m_Fd < 0)
+			LogLine(kError, "Could not start watching directories, trees will be rescanned for every query.");
+	}
+
+	DirectoryWatcher::~DirectoryWatcher()
+	{
+		if (m_Fd >= 0)
+			close(m_Fd);
+	}
+
+	bool DirectoryWatcher::Watch(const std::string& path, WatchedTree* tree, const std::string& relDir)
+	{
+		if (m_Fd < 0)
+			return false;
+
+		const int wd = inotify_add_watch(m_Fd, path.c_str(), kWatchMask);
+		if (wd < 0)
+		{
+			// A directory removed since it was listed is picked up from its parent's events
+			return errno == ENOENT || errno == ENOTDIR;
+		}
+
+		std::vector<WatchedDir>& dirs = m_Watches[wd];
+		for (WatchedDir& dir : dirs)
+		{
+			// Same directory under a new name after a move
+			if (dir.tree == tree)
+			{
+				dir.relDir = relDir;
+				return true;
+			}
+		}
+		dirs.push_back(WatchedDir { tree, relDir });
+		return true;
+	}
+
+	void DirectoryWatcher::ReadEvents(const std::vector<std::unique_ptr<WatchedTree>>& trees)
+	{
+		if (m_Fd < 0)
+			return;
+
+		alignas(inotify_event) char buffer[64 * 1024];
+		for (;;)
+		{
+			const ssize_t bytesRead = read(m_Fd, buffer, sizeof(buffer));
+			if (bytesRead <= 0)
+				return;
+
+			for (const char* p = buffer; p < buffer + bytesRead; )
+			{
+				const inotify_event& event = *(const inotify_event*)p;
+				p += sizeof(inotify_event) + event.len;
+
+				if (event.mask & IN_Q_OVERFLOW)
+				{
+					LogLine(kDebug, "Missed directory events, rescanning all trees.");
+					for (const auto& tree : trees)
+						tree->MarkAllDirty();
+					continue;
+				}
+
+				auto it = m_Watches.find(event.wd);
+				if (it == m_Watches.end())
+					continue;
+				if (event.mask & IN_IGNORED)
+				{
+					m_Watches.erase(it);
+					continue;
+				}
+
+				for (const WatchedDir& dir : it->second)
+				{
+					if ((event.mask & (IN_DELETE_SELF | IN_MOVE_SELF)) && dir.relDir.empty())
+						dir.tree->MarkAllDirty();
+					else
+						dir.tree->MarkDirty(dir.relDir);
+				}
+			}
+		}
+	}
+#else
+	DirectoryWatcher::DirectoryWatcher()
+		: m_Fd(-1)
+	{
+	}
+
+	DirectoryWatcher::~DirectoryWatcher()
+	{
+	}
+
+	bool DirectoryWatcher::Watch(const std::string&, WatchedTree*, const std::string&)
+	{
+		return false;
+	}
+
+	void DirectoryWatcher::ReadEvents(const std::vector<std::unique_ptr<WatchedTree>>&)
+	{
+	}
+#endif
+
+	bool WatchedTree::Refresh()
+	{
+		if (m_NeedsFullScan || !m_Watched)
+		{
+			m_DirtyDirs.clear();
+			return Scan();
+		}
+
+		std::set<std::string> dirtyDirs;
+		dirtyDirs.swap(m_DirtyDirs);
+		for (const std::string& relDir : dirtyDirs)
+		{
+			if (!RefreshDirectory(relDir))
+				return false;
+		}
+		return true;
+	}
+
+	const std::vector<FileInfo*>& WatchedTree::GetFiles()
+	{
+		if (!m_SortedValid)
+		{
+			m_Sorted.clear();
+			m_Sorted.reserve(m_Files.size());
+			for (auto& entry : m_Files)
+				m_Sorted.push_back(&entry.second);
+			// The map is in path order, matched paths sort by their keys first
+			if (m_Options.pathMatch != kPathMatchExact)
+				std::sort(m_Sorted.begin(), m_Sorted.end(), [](const FileInfo* a, const FileInfo* b) { return FileInfoSortFunc(*a, *b); });
+			m_SortedValid = true;
+		}
+		return m_Sorted;
+	}
+
+	bool WatchedTree::Scan()
+	{
+		TraceScope trace("ScanTree", m_Root.c_str());
+
+		std::vector<FileInfo> files;
+		DirectoryScanner scanner(m_Options);
+		if (!scanner.Add(m_Root, &files) || !scanner.Wait())
+		{
+			m_NeedsFullScan = true;
+			return false;
+		}
+
+		std::map<std::string, FileInfo> newFiles;
+		for (FileInfo& f : files)
+		{
+			auto old = m_Files.find(f.relativePath);
+			if (old != m_Files.end())
+				KeepContentHash(old->second, &f);
+			std::string path = f.relativePath;
+			newFiles.emplace(std::move(path), std::move(f));
+		}
+		m_Files.swap(newFiles);
+		m_NeedsFullScan = false;
+		m_SortedValid = false;
+
+		const bool wasWatched = m_Watched;
+		m_Watched = true;
+		Watch("");
+		for (const auto& entry : m_Files)
+		{
+			if (IsDir(entry.second))
+				Watch(entry.first);
+		}
+		if (wasWatched && !m_Watched)
+			LogLine(kError, "Could not watch all of '%s', it will be rescanned for every query.", m_Root.c_str());
+
+		LogLine(kDebug, "Scanned '%s', %lu entries.", m_Root.c_str(), (unsigned long)m_Files.size());
+		return true;
+	}
+
+	bool WatchedTree::RefreshDirectory(const std::string& relDir)
+	{
+		int dirLevel = 0;
+		if (!relDir.empty())
+		{
+			// Removed or replaced since, its parent's refresh took care of it
+			auto it = m_Files.find(relDir);
+			if (it == m_Files.end() || !IsDir(it->second))
+				return true;
+			dirLevel = DirLevel(it->second);
+		}
+
+		const std::string dirPath = relDir.empty() ? m_Root : m_Root + "/" + relDir;
+		struct stat status;
+		if (stat(dirPath.c_str(), &status) != 0 || !S_ISDIR(status.st_mode))
+		{
+			if (!relDir.empty())
+				return true;
+			LogLine(kError, "Could not read directory '%s'", dirPath.c_str());
+			m_NeedsFullScan = true;
+			return false;
+		}
+
+		std::vector<FileInfo> entries;
+		if (!ScanDirectory(m_Root, relDir, dirLevel, m_Options, &entries))
+		{
+			m_NeedsFullScan = relDir.empty();
+			return !relDir.empty();
+		}
+
+		std::set<std::string> listedPaths;
+		for (const FileInfo& entry : entries)
+			listedPaths.insert(entry.relativePath);
+
+		// Direct children that are gone, deeper entries belong to other directories' refreshes
+		const std::string prefix = relDir.empty() ? relDir : relDir + "/";
+		std::vector<std::string> removedPaths;
+		for (auto it = m_Files.lower_bound(prefix); it != m_Files.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+		{
+			if (it->first.find('/', prefix.size()) == std::string::npos && listedPaths.count(it->first) == 0)
+				removedPaths.push_back(it->first);
+		}
+		for (const std::string& path : removedPaths)
+			RemoveSubtree(path);
+
+		for (FileInfo& entry : entries)
+		{
+			auto it = m_Files.find(entry.relativePath);
+			if (it != m_Files.end() && IsDir(it->second) == IsDir(entry))
+			{
+				KeepContentHash(it->second, &entry);
+				it->second = std::move(entry);
+				continue;
+			}
+
+			if (it != m_Files.end())
+				RemoveSubtree(it->first);
+
+			const std::string path = entry.relativePath;
+			const bool isDir = IsDir(entry);
+			const int level = DirLevel(entry);
+			m_Files.emplace(path, std::move(entry));
+			if (isDir)
+				AddSubtree(path, level);
+		}
+
+		m_SortedValid = false;
+		return true;
+	}
+
+	void WatchedTree::AddSubtree(const std::string& relDir, const int dirLevel)
+	{
+		// Watched before it is listed so nothing created meanwhile is missed
+		Watch(relDir);
+
+		std::vector<FileInfo> files;
+		if (!ListFilesInDirRecursively(m_Root, relDir, dirLevel, m_Options, &files))
+			return;
+
+		for (FileInfo& f : files)
+		{
+			if (IsDir(f))
+				Watch(f.relativePath);
+			std::string path = f.relativePath;
+			m_Files[std::move(path)] = std::move(f);
+		}
+	}
+
+	void WatchedTree::RemoveSubtree(const std::string relativePath)
+	{
+		auto it = m_Files.find(relativePath);
+		if (it == m_Files.end())
+			return;
+
+		const bool isDir = IsDir(it->second);
+		m_Files.erase(it);
+		if (!isDir)
+			return;
+
+		const std::string prefix = relativePath + "/";
+		auto end = m_Files.lower_bound(prefix);
+		while (end != m_Files.end() && end->first.compare(0, prefix.size(), prefix) == 0)
+			++end;
+		m_Files.erase(m_Files.lower_bound(prefix), end);
+	}
+
+	void WatchedTree::Watch(const std::string& relDir)
+	{
+		const std::string dirPath = relDir.empty() ? m_Root : m_Root + "/" + relDir;
+		if (!m_Watcher.Watch(dirPath, this, relDir))
+			m_Watched = false;
+	}
+
+	// Hashes the file pairs a diff is going to compare that have no cached hash yet, so this and
+	// every later query compares hashes only
+	void HashComparedFiles(const std::vector<FileInfo*>& leftFiles, const std::vector<FileInfo*>& rightFiles, const DiffOptions& options)
+	{
+		std::vector<FileInfo*> unhashedFiles;
+		for (size_t l = 0, r = 0; l < leftFiles.size() && r < rightFiles.size(); )
+		{
+			FileInfo& leftFile = *leftFiles[l];
+			FileInfo& rightFile = *rightFiles[r];
+			if (SameRelativeFile(leftFile, rightFile))
+			{
+				if (!IsDir(leftFile) && FileSize(leftFile) == FileSize(rightFile))
+				{
+					if (!leftFile.hasContentHash)
+						unhashedFiles.push_back(&leftFile);
+					// A tree diffed against itself has one FileInfo for both sides
+					if (!rightFile.hasContentHash && &rightFile != &leftFile)
+						unhashedFiles.push_back(&rightFile);
+				}
+				++l;
+				++r;
+			}
+			else if (FileInfoSortFunc(leftFile, rightFile))
+				++l;
+			else
+				++r;
+		}
+
+		DeviceScheduler scheduler(GetComparePool());
+		for (FileInfo* f : unhashedFiles)
+		{
+			scheduler.Submit(f->status.st_dev, f->status.st_dev, [f, &options]()
+			{
+				uint64_t hash;
+				if (!GetContentHash(*f, &hash, options.compareOptions.ioPolicy))
+					return;
+				f->contentHash = hash;
+				f->hasContentHash = true;
+			});
+		}
+		scheduler.Wait();
+	}
+
+	class Daemon
+	{
+	public:
+		Daemon(const DiffOptions& options)
+			: m_Options(options)
+		{
+		}
+
+		Daemon(const Daemon&) = delete;
+		Daemon& operator=(const Daemon&) = delete;
+
+		// Scans root now instead of on its first query
+		bool AddRoot(const std::string& root)
+		{
+			WatchedTree* tree = GetTree(root);
+			return tree->Refresh();
+		}
+
+		bool Serve(const int listenFd)
+		{
+			while (!s_stopRequested)
+			{
+				pollfd fds[2] = { { listenFd, POLLIN, 0 }, { m_Watcher.GetFd(), POLLIN, 0 } };
+				if (poll(fds, m_Watcher.IsValid() ? 2 : 1, -1) < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					LogLine(kError, "Could not wait for queries.");
+					return false;
+				}
+
+				if (m_Watcher.IsValid() && (fds[1].revents & POLLIN))
+					m_Watcher.ReadEvents(m_Trees);
+
+				if (fds[0].revents & POLLIN)
+				{
+					const int fd = accept(listenFd, nullptr, nullptr);
+					if (fd < 0)
+						continue;
+					if (IsPeerSameUser(fd))
+						ServeClient(fd);
+					else
+						LogLine(kError, "Refused a client running as another user.");
+					close(fd);
+					LogFlush();
+				}
+			}
+			return true;
+		}
+
+	private:
+		WatchedTree* GetTree(const std::string& root)
+		{
+			for (const auto& tree : m_Trees)
+			{
+				if (tree->GetRoot() == root)
+					return tree.get();
+			}
+			LogLine(kDebug, "Watching '%s'.", root.c_str());
+			m_Trees.emplace_back(new WatchedTree(root, m_Options.scanOptions, m_Watcher));
+			return m_Trees.back().get();
+		}
+
+		void ServeClient(const int fd)
+		{
+			timeval timeout = { kClientTimeoutSeconds, 0 };
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+			FieldReader reader(fd);
+			FieldWriter writer(fd);
+			std::string request;
+			std::string mode;
+			std::string leftPath;
+			std::string rightPath;
+			if (!reader.Read(&request) || request != kRequestDiff
+				|| !reader.Read(&mode) || !reader.Read(&leftPath) || !reader.Read(&rightPath))
+			{
+				writer.Write(kResponseError);
+				writer.Write("Malformed request.");
+				writer.Flush();
+				return;
+			}
+
+			TraceScope trace("DaemonQuery", leftPath.c_str());
+			LogLine(kDebug, "Diffing '%s' and '%s'.", leftPath.c_str(), rightPath.c_str());
+
+			DiffOptions options = m_Options;
+			options.compareContents = (mode != "sizeOnly");
+
+			auto writeEntry = [&writer](const DiffEntry& entry)
+			{
+				const FileInfo& f = entry.leftFile ? *entry.leftFile : *entry.rightFile;
+				writer.Write(!entry.leftFile ? "+" : !entry.rightFile ? "-" : entry.differs ? "M" : "=");
+				writer.Write(IsDir(f) ? "d" : "f");
+				writer.Write(std::to_string(entry.firstDiffOffset));
+				writer.Write(f.relativePath);
+			};
+
+			if (Diff(leftPath, rightPath, options, writeEntry))
+			{
+				writer.Write(kResponseEnd);
+			}
+			else
+			{
+				writer.Write(kResponseError);
+				writer.Write("Could not diff '" + leftPath + "' and '" + rightPath + "', see the daemon's log.");
+			}
+			if (!writer.Flush())
+				LogLine(kDebug, "Dropped the rest of the answer to a client that left or stopped reading.");
+		}
+
+		bool Diff(const std::string& leftPath, const std::string& rightPath, const DiffOptions& options, const DiffEntryCallback& entryCallback)
+		{
+			// Events that arrived while the previous query was answered
+			m_Watcher.ReadEvents(m_Trees);
+
+			bool isFile = false;
+			bool leftIsDir = false;
+			bool rightIsDir = false;
+			IsRegularFileOrDirectory(leftPath, &isFile, &leftIsDir);
+			IsRegularFileOrDirectory(rightPath, &isFile, &rightIsDir);
+
+			// Manifests and archives are not kept around, they are cheap to list again
+			if (!leftIsDir || !rightIsDir)
+				return StreamDirectoryDiff(PathSet { leftPath, rightPath }, options, entryCallback);
+
+			WatchedTree* leftTree = GetTree(leftPath);
+			WatchedTree* rightTree = GetTree(rightPath);
+			if (!leftTree->Refresh() || !rightTree->Refresh())
+				return false;
+
+			const std::vector<FileInfo*>& leftFiles = leftTree->GetFiles();
+			const std::vector<FileInfo*>& rightFiles = rightTree->GetFiles();
+			if (options.compareContents)
+				HashComparedFiles(leftFiles, rightFiles, options);
+
+			DiffSortedFiles(std::vector<const FileInfo*>(leftFiles.begin(), leftFiles.end()),
+				std::vector<const FileInfo*>(rightFiles.begin(), rightFiles.end()), options, entryCallback);
+			return true;
+		}
+
+		const DiffOptions& m_Options;
+		DirectoryWatcher m_Watcher;
+		std::vector<std::unique_ptr<WatchedTree>> m_Trees;
+	};
+}
+
+std::string GetDefaultDaemonSocketPath()
+{
+	const char* runtimeDir = getenv("XDG_RUNTIME_DIR");
+	if (runtimeDir != nullptr && runtimeDir[0] != '\0')
+		return std::string(runtimeDir) + "/dwrap.sock";
+	return "/tmp/dwrap-" + std::to_string(getuid()) + ".sock";
+}
+
+bool RunDaemon(const std::string& socketPath, const std::vector<std::string>& roots, const DiffOptions& options)
+{
+	sockaddr_un address;
+	if (!MakeSocketAddress(socketPath, &address))
+		return false;
+
+	// A socket nobody listens on is left over from a daemon that did not exit cleanly
+	const int existingFd = ConnectToSocket(address);
+	if (existingFd >= 0)
+	{
+		close(existingFd);
+		LogLine(kError, "A daemon is already listening on '%s'.", socketPath.c_str());
+		return false;
+	}
+	unlink(socketPath.c_str());
+
+	const int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenFd < 0)
+	{
+		LogLine(kError, "Could not listen on '%s'.", socketPath.c_str());
+		return false;
+	}
+
+	// Only the owner may query, the answers list their files
+	const mode_t oldMask = umask(077);
+	const bool bound = bind(listenFd, (const sockaddr*)&address, sizeof(address)) == 0;
+	umask(oldMask);
+	if (!bound || listen(listenFd, 16) != 0)
+	{
+		LogLine(kError, "Could not listen on '%s'.", socketPath.c_str());
+		close(listenFd);
+		return false;
+	}
+
+	// Without SA_RESTART the signals interrupt poll, which is how the loop notices them
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = OnStopSignal;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+	signal(SIGPIPE, SIG_IGN);
+
+	bool served;
+	{
+		Daemon daemon(options);
+		for (const std::string& root : roots)
+		{
+			std::string realRoot;
+			if (GetRealPath(root, &realRoot) && daemon.AddRoot(realRoot))
+				LogLine(kOutput, "Watching '%s'.", realRoot.c_str());
+		}
+
+		LogLine(kOutput, "Listening on '%s'.", socketPath.c_str());
+		LogFlush();
+		served = daemon.Serve(listenFd);
+	}
+
+	close(listenFd);
+	unlink(socketPath.c_str());
+	return served;
+}
+
+bool QueryDaemon(const std::string& socketPath, const PathSet& paths, const DiffOptions& options, const DiffEntryCallback& entryCallback)
+{
+	const std::string* leftPath = GetPath(paths, kLeft);
+	const std::string* rightPath = GetPath(paths, kRight);
+	if (leftPath == nullptr || rightPath == nullptr || GetPath(paths, kBase) != nullptr)
+	{
+		LogLine(kError, "The daemon only diffs two paths.");
+		return false;
+	}
+
+	// The daemon runs in another directory, and keys its trees by their real path
+	std::string realLeftPath;
+	std::string realRightPath;
+	if (!GetRealPath(*leftPath, &realLeftPath) || !GetRealPath(*rightPath, &realRightPath))
+		return false;
+
+	sockaddr_un address;
+	if (!MakeSocketAddress(socketPath, &address))
+		return false;
+
+	const int fd = ConnectToSocket(address);
+	if (fd < 0)
+	{
+		LogLine(kError, "No daemon is listening on '%s', start one with 'dwrap --daemon'.", socketPath.c_str());
+		return false;
+	}
+	if (!IsPeerSameUser(fd))
+	{
+		LogLine(kError, "The daemon listening on '%s' runs as another user.", socketPath.c_str());
+		close(fd);
+		return false;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	FieldWriter writer(fd);
+	writer.Write(kRequestDiff);
+	writer.Write(options.compareContents ? "contents" : "sizeOnly");
+	writer.Write(realLeftPath);
+	writer.Write(realRightPath);
+
+	FieldReader reader(fd);
+	bool answered = false;
+	bool succeeded = false;
+	if (writer.Flush())
+	{
+		FileInfo leftFile;
+		FileInfo rightFile;
+		std::string status;
+		std::string type;
+		std::string offset;
+		std::string path;
+		while (reader.Read(&status))
+		{
+			if (status == kResponseEnd)
+			{
+				answered = true;
+				succeeded = true;
+				break;
+			}
+			if (status == kResponseError)
+			{
+				std::string message;
+				reader.Read(&message);
+				LogLine(kError, "%s", message.c_str());
+				answered = true;
+				break;
+			}
+			if (!reader.Read(&type) || !reader.Read(&offset) || !reader.Read(&path))
+				break;
+
+			for (FileInfo* f : { &leftFile, &rightFile })
+			{
+				f->relativePath = path;
+				const size_t slash = path.rfind('/');
+				f->name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+				f->isDir = (type == "d");
+				const int depth = GetPathDepth(path.c_str(), path.size());
+				f->level = f->isDir ? depth + 1 : depth;
+				memset(&f->status, 0, sizeof(f->status));
+				f->status.st_mode = f->isDir ? S_IFDIR : S_IFREG;
+			}
+
+			DiffEntry entry { &leftFile, &rightFile, status == "M" || status == "+" || status == "-", strtoll(offset.c_str(), nullptr, 10) };
+			if (status == "+")
+				entry.leftFile = nullptr;
+			else if (status == "-")
+				entry.rightFile = nullptr;
+			entryCallback(entry);
+		}
+	}
+
+	if (!answered)
+		LogLine(kError, "The daemon on '%s' did not answer the query.", socketPath.c_str());
+	close(fd);
+	return succeeded;
+}
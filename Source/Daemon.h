@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "DirectoryDiff.h"
+
+// Daemon mode: keeps the listings and content hashes of the directories it was asked about in
+// memory, refreshes them from inotify events and answers diff queries on a Unix domain socket.
+// File hashes are kept while a file's size and modification time stay the same.
+
+// $XDG_RUNTIME_DIR/dwrap.sock, or a per user socket in /tmp
+std::string GetDefaultDaemonSocketPath();
+
+// Serves queries until SIGINT or SIGTERM. The roots are scanned up front, other directories
+// the first time a query names them. Scan options are the daemon's, not the client's.
+bool RunDaemon(const std::string& socketPath, const std::vector<std::string>& roots, const DiffOptions& options);
+
+// Asks the daemon listening on socketPath for the diff of two sources. The FileInfos of the
+// entries only carry the relative path, name and type.
+bool QueryDaemon(const std::string& socketPath, const PathSet& paths, const DiffOptions& options, const DiffEntryCallback& entryCallback);
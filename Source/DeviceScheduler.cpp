@@ -0,0 +1,151 @@
+#include "DeviceScheduler.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
+
+#include "Common.h"
+
+namespace
+{
+	// Seeking between files costs more than the transfers, so spinning disks get little parallelism
+	const DeviceLimits kRotationalLimits = { true, 2, 32 };
+	const DeviceLimits kSolidStateLimits = { false, 16, 256 };
+	// Network, virtual and pseudo file systems have no block device to ask
+	const DeviceLimits kUnknownDeviceLimits = { false, 8, 128 };
+
+	// Pools grow to run every device at its limit, up to this many threads
+	const unsigned kMaxPoolThreads = 128;
+
+	std::mutex s_limitsMutex;
+	std::unordered_map<dev_t, DeviceLimits> s_limits;
+
+	DeviceLimits ProbeDeviceLimits(const dev_t device)
+	{
+#ifdef __linux__
+		// Partitions have no queue of their own, the disk they are on is one level up
+		const char* const kPatterns[] = { "/sys/dev/block/%u:%u/queue/rotational", "/sys/dev/block/%u:%u/../queue/rotational" };
+		for (const char* pattern : kPatterns)
+		{
+			char path[128];
+			snprintf(path, sizeof(path), pattern, major(device), minor(device));
+			FILE* file = fopen(path, "r");
+			if (file == nullptr)
+				continue;
+
+			const int rotational = fgetc(file);
+			fclose(file);
+			if (rotational == '0' || rotational == '1')
+			{
+				LogLine(kDebug, "Device %u:%u is %s.", major(device), minor(device), (rotational == '1') ? "rotational" : "solid state");
+				return (rotational == '1') ? kRotationalLimits : kSolidStateLimits;
+			}
+		}
+#endif
+		return kUnknownDeviceLimits;
+	}
+}
+
+DeviceLimits GetDeviceLimits(const dev_t device)
+{
+	std::lock_guard<std::mutex> lock(s_limitsMutex);
+	auto it = s_limits.find(device);
+	if (it == s_limits.end())
+		it = s_limits.emplace(device, ProbeDeviceLimits(device)).first;
+	return it->second;
+}
+
+DeviceScheduler::DeviceScheduler(ThreadPool& pool)
+	: m_Pool(pool)
+	, m_Outstanding(0)
+{
+}
+
+DeviceScheduler::~DeviceScheduler()
+{
+	Wait();
+}
+
+DeviceScheduler::DeviceQueue& DeviceScheduler::GetQueue(const dev_t device)
+{
+	auto it = m_Devices.find(device);
+	if (it == m_Devices.end())
+	{
+		DeviceQueue queue;
+		queue.limits = GetDeviceLimits(device);
+		queue.running = 0;
+		it = m_Devices.emplace(device, std::move(queue)).first;
+
+		// Otherwise the pool's threads would cap the total below the sum of the device limits
+		unsigned concurrency = 0;
+		for (const auto& entry : m_Devices)
+			concurrency += entry.second.limits.concurrency;
+		m_Pool.Reserve(std::min(concurrency, kMaxPoolThreads));
+	}
+	return it->second;
+}
+
+void DeviceScheduler::Submit(const dev_t device, const dev_t otherDevice, std::function<void()> task)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	GetQueue(otherDevice);
+	GetQueue(device).waiting.push_back(Task { otherDevice, std::move(task) });
+	++m_Outstanding;
+	Dispatch();
+}
+
+void DeviceScheduler::Dispatch()
+{
+	// Each device only waits on the head of its own queue, the others keep going
+	for (auto& it : m_Devices)
+	{
+		const dev_t device = it.first;
+		DeviceQueue& queue = it.second;
+		while (!queue.waiting.empty() && queue.running < queue.limits.concurrency)
+		{
+			const dev_t otherDevice = queue.waiting.front().otherDevice;
+			DeviceQueue& other = m_Devices.at(otherDevice);
+			if (&other != &queue && other.running >= other.limits.concurrency)
+				break;
+
+			std::function<void()> run = std::move(queue.waiting.front().run);
+			queue.waiting.pop_front();
+			++queue.running;
+			if (&other != &queue)
+				++other.running;
+
+			m_Pool.Submit([this, device, otherDevice, run = std::move(run)]()
+			{
+				run();
+				Finished(device, otherDevice);
+			});
+		}
+	}
+}
+
+void DeviceScheduler::Finished(const dev_t device, const dev_t otherDevice)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	--m_Devices.at(device).running;
+	if (otherDevice != device)
+		--m_Devices.at(otherDevice).running;
+	--m_Outstanding;
+	Dispatch();
+	m_Changed.notify_all();
+}
+
+void DeviceScheduler::WaitForQueueRoom(const dev_t device)
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	DeviceQueue& queue = GetQueue(device);
+	m_Changed.wait(lock, [&queue]() { return queue.waiting.size() < queue.limits.queueDepth; });
+}
+
+void DeviceScheduler::Wait()
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_Changed.wait(lock, [this]() { return m_Outstanding == 0; });
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+#include <sys/types.h>
+
+#include "ThreadPool.h"
+
+struct DeviceLimits
+{
+	bool rotational;
+	// Tasks running on the device at once
+	unsigned concurrency;
+	// Tasks waiting for the device before producers are held back
+	unsigned queueDepth;
+};
+
+// Limits for a device, tuned from its /sys/block rotational flag. Probed once per device.
+DeviceLimits GetDeviceLimits(const dev_t device);
+
+// Runs tasks on a pool with a separate concurrency limit per device, so a slow disk only
+// holds back the work that touches it. The pool grows to the sum of the limits of the devices
+// seen so far, so each added device adds its own parallelism.
+class DeviceScheduler
+{
+public:
+	DeviceScheduler(ThreadPool& pool);
+	~DeviceScheduler();
+	DeviceScheduler(const DeviceScheduler&) = delete;
+	DeviceScheduler& operator=(const DeviceScheduler&) = delete;
+
+	// Starts the task once both devices are below their limit, pass the same device twice for
+	// tasks that only touch one. Never blocks, so tasks can submit more tasks.
+	void Submit(const dev_t device, const dev_t otherDevice, std::function<void()> task);
+
+	// Blocks while the device already has its queue depth of tasks waiting. Not for use from tasks.
+	void WaitForQueueRoom(const dev_t device);
+
+	// Blocks until every submitted task finished
+	void Wait();
+
+private:
+	struct Task
+	{
+		dev_t otherDevice;
+		std::function<void()> run;
+	};
+
+	struct DeviceQueue
+	{
+		DeviceLimits limits;
+		unsigned running;
+		std::deque<Task> waiting;
+	};
+
+	DeviceQueue& GetQueue(const dev_t device);
+	void Dispatch();
+	void Finished(const dev_t device, const dev_t otherDevice);
+
+	ThreadPool& m_Pool;
+	std::mutex m_Mutex;
+	std::condition_variable m_Changed;
+	std::unordered_map<dev_t, DeviceQueue> m_Devices;
+	size_t m_Outstanding;
+};
@@ -0,0 +1,285 @@
+#include "DiffIndex.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <unordered_map>
+
+#include "Hash.h"
+#include "PathMatch.h"
+#include "Trace.h"
+
+namespace
+{
+	const int kBucketBits = 18;
+	const size_t kBucketCount = (size_t)1 << kBucketBits;
+
+	inline uint32_t GetTrigramBucket(const char* text)
+	{
+		const uint32_t trigram = ((uint32_t)(unsigned char)text[0] << 16) | ((uint32_t)(unsigned char)text[1] << 8) | (uint32_t)(unsigned char)text[2];
+		return (trigram * 2654435761u) >> (32 - kBucketBits);
+	}
+
+	inline const FileInfo& GetEntryFile(const DiffEntry& entry)
+	{
+		return entry.leftFile ? *entry.leftFile : *entry.rightFile;
+	}
+
+	// What pairs the entry with its other side, so both sides agree on the parent
+	inline const std::string& GetEntryKey(const DiffEntry& entry)
+	{
+		const FileInfo& f = GetEntryFile(entry);
+		return f.matchKey.empty() ? f.relativePath : f.matchKey;
+	}
+
+	int64_t GetEntrySize(const DiffEntry& entry)
+	{
+		const FileInfo& f = entry.rightFile ? *entry.rightFile : *entry.leftFile;
+		return IsDir(f) ? 0 : FileSize(f);
+	}
+
+	int64_t GetChangedBytes(const DiffEntry& entry)
+	{
+		if (IsDir(GetEntryFile(entry)))
+			return 0;
+		switch (GetDiffStatus(entry))
+		{
+			case kDiffAdded: return FileSize(*entry.rightFile);
+			case kDiffRemoved: return FileSize(*entry.leftFile);
+			case kDiffModified: return (entry.changedBytes >= 0) ? entry.changedBytes : std::max(FileSize(*entry.leftFile), FileSize(*entry.rightFile));
+			default: return 0;
+		}
+	}
+
+	// Rows by descending key, rows with equal keys stay in path order
+	void SortRowsByKey(const std::vector<DiffEntry>& entries, int64_t (*getKey)(const DiffEntry&), not_null<std::vector<uint32_t>> outRows)
+	{
+		std::vector<std::pair<int64_t, uint32_t>> keyed(entries.size());
+		for (size_t i = 0; i < entries.size(); ++i)
+			keyed[i] = std::make_pair(getKey(entries[i]), (uint32_t)i);
+		std::sort(keyed.begin(), keyed.end(), [](const std::pair<int64_t, uint32_t>& a, const std::pair<int64_t, uint32_t>& b)
+		{
+			return (a.first != b.first) ? a.first > b.first : a.second < b.second;
+		});
+
+		outRows->resize(keyed.size());
+		for (size_t i = 0; i < keyed.size(); ++i)
+			(*outRows)[i] = keyed[i].second;
+	}
+
+	inline bool TestBit(const std::vector<uint64_t>& bits, const uint32_t row)
+	{
+		return (bits[row >> 6] >> (row & 63)) & 1;
+	}
+
+	inline void SetBit(std::vector<uint64_t>& bits, const uint32_t row)
+	{
+		bits[row >> 6] |= (uint64_t)1 << (row & 63);
+	}
+}
+
+void ComputeDirectoryRollups(const std::vector<DiffEntry>& sortedEntries, not_null<std::vector<DirectoryRollup>> outRollups)
+{
+	TraceScope trace("DirectoryRollups", nullptr, (int64_t)sortedEntries.size());
+
+	std::unordered_map<uint64_t, uint32_t> directories;
+	for (size_t i = 0; i < sortedEntries.size(); ++i)
+	{
+		if (IsDir(GetEntryFile(sortedEntries[i])))
+		{
+			const std::string& key = GetEntryKey(sortedEntries[i]);
+			directories[HashBytes(key.data(), key.size())] = (uint32_t)i;
+		}
+	}
+
+	// Top level entries and those whose parent is not listed have none
+	std::vector<uint32_t> parents(sortedEntries.size(), UINT32_MAX);
+	for (size_t i = 0; i < sortedEntries.size(); ++i)
+	{
+		const std::string& key = GetEntryKey(sortedEntries[i]);
+		const size_t slash = key.rfind('/');
+		if (slash == std::string::npos)
+			continue;
+		auto found = directories.find(HashBytes(key.data(), slash));
+		if (found != directories.end() && GetEntryKey(sortedEntries[found->second]).compare(0, std::string::npos, key, 0, slash) == 0)
+			parents[i] = found->second;
+	}
+
+	DirectoryRollup empty;
+	memset(&empty, 0, sizeof(empty));
+	outRollups->assign(sortedEntries.size(), empty);
+	for (size_t i = sortedEntries.size(); i-- > 0; )
+	{
+		if (parents[i] == UINT32_MAX)
+			continue;
+		const DirectoryRollup& rollup = (*outRollups)[i];
+		DirectoryRollup& parent = (*outRollups)[parents[i]];
+		for (int status = 0; status < kDiffStatusCount; ++status)
+			parent.counts[status] += rollup.counts[status];
+		++parent.counts[GetDiffStatus(sortedEntries[i])];
+		parent.changedBytes += rollup.changedBytes + GetChangedBytes(sortedEntries[i]);
+	}
+}
+
+DiffIndex::DiffIndex(const std::vector<DiffEntry>& entries)
+	: m_Entries(entries)
+{
+	TraceScope trace("BuildDiffIndex", nullptr, (int64_t)entries.size());
+
+	const size_t wordCount = (entries.size() + 63) / 64;
+	for (int status = 0; status < kDiffStatusCount; ++status)
+	{
+		m_StatusBits[status].assign(wordCount, 0);
+		m_StatusCounts[status] = 0;
+	}
+
+	m_NameOffsets.reserve(entries.size() + 1);
+	for (size_t row = 0; row < entries.size(); ++row)
+	{
+		const DiffStatus status = GetDiffStatus(entries[row]);
+		SetBit(m_StatusBits[status], (uint32_t)row);
+		++m_StatusCounts[status];
+
+		m_NameOffsets.push_back((uint32_t)m_Names.size());
+		m_Names += GetPathMatchKey(GetEntryFile(entries[row]).name, kPathMatchFold);
+		m_Names.push_back('\0');
+	}
+	m_NameOffsets.push_back((uint32_t)m_Names.size());
+
+	SortRowsByKey(entries, &GetEntrySize, &m_BySize);
+	SortRowsByKey(entries, &GetChangedBytes, &m_ByChange);
+
+	// Posting lists in one array, counted first and then filled. Rows are added in order, so
+	// every list comes out sorted, and a trigram repeated within a name is only added once.
+	std::vector<uint32_t> lastRow(kBucketCount, UINT32_MAX);
+	m_BucketStarts.assign(kBucketCount + 1, 0);
+	for (uint32_t row = 0; row < (uint32_t)entries.size(); ++row)
+	{
+		const char* name = GetName(row);
+		const size_t length = m_NameOffsets[row + 1] - m_NameOffsets[row] - 1;
+		for (size_t i = 0; i + 3 <= length; ++i)
+		{
+			const uint32_t bucket = GetTrigramBucket(name + i);
+			if (lastRow[bucket] != row)
+			{
+				lastRow[bucket] = row;
+				++m_BucketStarts[bucket + 1];
+			}
+		}
+	}
+	for (size_t bucket = 0; bucket < kBucketCount; ++bucket)
+		m_BucketStarts[bucket + 1] += m_BucketStarts[bucket];
+
+	std::vector<uint32_t> fill(m_BucketStarts.begin(), m_BucketStarts.end() - 1);
+	std::fill(lastRow.begin(), lastRow.end(), UINT32_MAX);
+	m_BucketRows.resize(m_BucketStarts.back());
+	for (uint32_t row = 0; row < (uint32_t)entries.size(); ++row)
+	{
+		const char* name = GetName(row);
+		const size_t length = m_NameOffsets[row + 1] - m_NameOffsets[row] - 1;
+		for (size_t i = 0; i + 3 <= length; ++i)
+		{
+			const uint32_t bucket = GetTrigramBucket(name + i);
+			if (lastRow[bucket] != row)
+			{
+				lastRow[bucket] = row;
+				m_BucketRows[fill[bucket]++] = row;
+			}
+		}
+	}
+}
+
+bool DiffIndex::FindTrigramRows(const std::string& search, not_null<std::vector<uint32_t>> outRows) const
+{
+	if (search.size() < 3)
+		return false;
+
+	std::vector<uint32_t> buckets;
+	for (size_t i = 0; i + 3 <= search.size(); ++i)
+		buckets.push_back(GetTrigramBucket(search.data() + i));
+	std::sort(buckets.begin(), buckets.end());
+	buckets.erase(std::unique(buckets.begin(), buckets.end()), buckets.end());
+
+	// Shortest list first, every intersection can only shrink it
+	std::sort(buckets.begin(), buckets.end(), [this](const uint32_t a, const uint32_t b)
+	{
+		return m_BucketStarts[a + 1] - m_BucketStarts[a] < m_BucketStarts[b + 1] - m_BucketStarts[b];
+	});
+
+	const uint32_t* rows = m_BucketRows.data();
+	outRows->assign(rows + m_BucketStarts[buckets[0]], rows + m_BucketStarts[buckets[0] + 1]);
+	std::vector<uint32_t> intersection;
+	for (size_t i = 1; i < buckets.size() && !outRows->empty(); ++i)
+	{
+		intersection.clear();
+		std::set_intersection(outRows->begin(), outRows->end(), rows + m_BucketStarts[buckets[i]], rows + m_BucketStarts[buckets[i] + 1], std::back_inserter(intersection));
+		outRows->swap(intersection);
+	}
+	return true;
+}
+
+void DiffIndex::Filter(const DiffFilter& filter, not_null<std::vector<uint32_t>> outRows) const
+{
+	TraceScope trace("FilterDiff", filter.nameSearch.c_str(), (int64_t)m_Entries.size());
+
+	const size_t wordCount = m_StatusBits[0].size();
+	Bitset keep(wordCount, 0);
+	for (int status = 0; status < kDiffStatusCount; ++status)
+	{
+		if ((filter.statuses & (1u << status)) == 0)
+			continue;
+		for (size_t word = 0; word < wordCount; ++word)
+			keep[word] |= m_StatusBits[status][word];
+	}
+
+	const std::string search = GetPathMatchKey(filter.nameSearch, kPathMatchFold);
+	if (!search.empty())
+	{
+		// Posting lists only narrow the rows down, the names still need to hold the search
+		std::vector<uint32_t> candidates;
+		Bitset found(wordCount, 0);
+		if (FindTrigramRows(search, &candidates))
+		{
+			for (const uint32_t row : candidates)
+			{
+				if (TestBit(keep, row) && strstr(GetName(row), search.c_str()))
+					SetBit(found, row);
+			}
+		}
+		else
+		{
+			for (size_t word = 0; word < wordCount; ++word)
+			{
+				for (uint64_t bits = keep[word]; bits != 0; bits &= bits - 1)
+				{
+					const uint32_t row = (uint32_t)(word * 64 + __builtin_ctzll(bits));
+					if (strstr(GetName(row), search.c_str()))
+						SetBit(found, row);
+				}
+			}
+		}
+		keep.swap(found);
+	}
+
+	outRows->clear();
+	if (filter.order == kOrderByPath)
+	{
+		for (size_t word = 0; word < wordCount; ++word)
+		{
+			for (uint64_t bits = keep[word]; bits != 0; bits &= bits - 1)
+				outRows->push_back((uint32_t)(word * 64 + __builtin_ctzll(bits)));
+		}
+	}
+	else
+	{
+		const std::vector<uint32_t>& order = (filter.order == kOrderBySize) ? m_BySize : m_ByChange;
+		for (const uint32_t row : order)
+		{
+			if (TestBit(keep, row))
+				outRows->push_back(row);
+		}
+	}
+
+	if (filter.reversed)
+		std::reverse(outRows->begin(), outRows->end());
+}
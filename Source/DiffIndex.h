@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "DirectoryDiff.h"
+
+enum DiffStatus
+{
+	kDiffAdded,
+	kDiffRemoved,
+	kDiffModified,
+	kDiffIdentical,
+	kDiffStatusCount
+};
+
+inline DiffStatus GetDiffStatus(const DiffEntry& entry)
+{
+	if (entry.leftFile == nullptr)
+		return kDiffAdded;
+	if (entry.rightFile == nullptr)
+		return kDiffRemoved;
+	return entry.differs ? kDiffModified : kDiffIdentical;
+}
+
+enum DiffOrder
+{
+	kOrderByPath,
+	// Largest first
+	kOrderBySize,
+	// Most changed bytes first, as measured by similarity or else the size of the whole file
+	kOrderByChange
+};
+
+struct DiffFilter
+{
+	// One bit, 1 << DiffStatus, for each status to keep
+	unsigned statuses = (1u << kDiffStatusCount) - 1;
+
+	// Kept entries have this in their name, compared case folded. Empty keeps every name.
+	std::string nameSearch;
+
+	DiffOrder order = kOrderByPath;
+	bool reversed = false;
+};
+
+// What a directory holds at any depth below it
+struct DirectoryRollup
+{
+	uint32_t counts[kDiffStatusCount];
+	// Changed bytes of the entries below, as DiffIndex orders them by change
+	int64_t changedBytes;
+
+	bool HasChanges() const { return counts[kDiffAdded] + counts[kDiffRemoved] + counts[kDiffModified] > 0; }
+};
+
+// One rollup per entry of a diff sorted by path, zero for everything but directories. A path
+// sorts after its parent directory, so a single pass from the back adds every entry to its
+// parent after all of its own entries were added to it. Parents are found through a hash of
+// their paths.
+void ComputeDirectoryRollups(const std::vector<DiffEntry>& sortedEntries, not_null<std::vector<DirectoryRollup>> outRollups);
+
+// Answers filters over the entries of a diff without looking at entries that cannot match.
+// Statuses are bitsets, the orders other than by path are permutations sorted up front and names
+// are found through trigram posting lists. Built once, after which the entries must stay in place.
+class DiffIndex
+{
+public:
+	explicit DiffIndex(const std::vector<DiffEntry>& entries);
+
+	DiffIndex(const DiffIndex&) = delete;
+	DiffIndex& operator=(const DiffIndex&) = delete;
+
+	// Positions in the entries of those passing the filter, in the order it asks for
+	void Filter(const DiffFilter& filter, not_null<std::vector<uint32_t>> outRows) const;
+
+	size_t GetStatusCount(const DiffStatus status) const { return m_StatusCounts[status]; }
+
+private:
+	using Bitset = std::vector<uint64_t>;
+
+	// Rows whose name holds every trigram of the folded search, false when it is too short to have any
+	bool FindTrigramRows(const std::string& search, not_null<std::vector<uint32_t>> outRows) const;
+	const char* GetName(const uint32_t row) const { return m_Names.data() + m_NameOffsets[row]; }
+
+	const std::vector<DiffEntry>& m_Entries;
+	Bitset m_StatusBits[kDiffStatusCount];
+	size_t m_StatusCounts[kDiffStatusCount];
+	std::vector<uint32_t> m_BySize;
+	std::vector<uint32_t> m_ByChange;
+
+	// Case folded names, each ending in a NUL byte
+	std::string m_Names;
+	std::vector<uint32_t> m_NameOffsets;
+
+	// Posting lists by trigram hash. Trigrams sharing a bucket share a list, which only costs
+	// the extra names checked against the search.
+	std::vector<uint32_t> m_BucketStarts;
+	std::vector<uint32_t> m_BucketRows;
+};
@@ -0,0 +1,813 @@
+#include "DirectoryDiff.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include "Archive.h"
+#include "DeviceScheduler.h"
+#include "ExternalSort.h"
+#include "Manifest.h"
+#include "Session.h"
+#include "Similarity.h"
+#include "Stats.h"
+
+namespace
+{
+	// A source is either a directory or a manifest or archive file standing in for one.
+	// Directories are only queued on the scanner, their files are listed once it is waited for.
+	bool ListFilesInSource(const std::string& path, const DiffOptions& options, DirectoryScanner& scanner, not_null<std::vector<FileInfo>> outFiles, not_null<bool> outSorted)
+	{
+		if (IsManifestFile(path))
+		{
+			LogLine(kDebug, "Reading '%s' as a manifest.", path.c_str());
+			*outSorted = (options.scanOptions.pathMatch == kPathMatchExact);
+			return ListFilesInManifest(path, options.scanOptions, outFiles);
+		}
+
+		if (IsArchiveFile(path))
+		{
+			LogLine(kDebug, "Reading '%s' as an archive.", path.c_str());
+			*outSorted = false;
+			return ListFilesInArchive(path, options.scanOptions, outFiles);
+		}
+
+		*outSorted = false;
+		return scanner.Add(path, outFiles);
+	}
+
+	bool ScanAndSort(const PathSet& paths, const DiffOptions& options, not_null<std::vector<FileInfo>> outLeftFiles, not_null<std::vector<FileInfo>> outRightFiles)
+	{
+		const std::string* leftPath = GetPath(paths, kLeft);
+		const std::string* rightPath = GetPath(paths, kRight);
+
+		assert(leftPath != nullptr && rightPath != nullptr);
+
+		auto& leftFiles = *outLeftFiles;
+		leftFiles.clear();
+		auto& rightFiles = *outRightFiles;
+		rightFiles.clear();
+		bool leftSorted = false;
+		bool rightSorted = false;
+		{
+			// Both trees are scanned at once, each directory within them on its own device's share
+			ScopedPhase phase(kPhaseScan);
+			DirectoryScanner scanner(options.scanOptions);
+			const bool listed = ListFilesInSource(*leftPath, options, scanner, &leftFiles, &leftSorted)
+				&& ListFilesInSource(*rightPath, options, scanner, &rightFiles, &rightSorted);
+			if (!scanner.Wait() || !listed)
+				return false;
+		}
+		{
+			ScopedPhase phase(kPhaseSort);
+			if (!leftSorted)
+				SortFileList(&leftFiles);
+			if (!rightSorted)
+				SortFileList(&rightFiles);
+		}
+
+		if (IsLogEnabled(kDebug))
+		{
+			LogLine(kDebug, "Left directory:");
+			for (const auto& f : leftFiles)
+				LogLine(kDebug, "    '%s' (%i)", f.relativePath.c_str(), DirLevel(f));
+
+			LogLine(kDebug, "Right directory:");
+			for (const auto& f : rightFiles)
+				LogLine(kDebug, "    '%s' (%i)", f.relativePath.c_str(), DirLevel(f));
+		}
+
+		return true;
+	}
+
+	bool FilesMatch(const FileInfo& leftFile, const FileInfo& rightFile, const DiffOptions& options, not_null<int64_t> outFirstDiffOffset)
+	{
+		*outFirstDiffOffset = -1;
+		if (!options.compareContents)
+			return FileSize(leftFile) == FileSize(rightFile);
+		return FileEquals(leftFile, rightFile, options.compareOptions, outFirstDiffOffset);
+	}
+
+	// Fills in the similarity of a modified pair, picking up where the compare found a difference
+	void MeasureModifiedFile(const DiffOptions& options, not_null<DiffEntry> entry)
+	{
+		if (!options.measureSimilarity || !options.compareContents || !entry->differs || IsDir(*entry->leftFile) || IsSymlink(*entry->leftFile) || IsSymlink(*entry->rightFile))
+			return;
+
+		FileSimilarity similarity;
+		if (!MeasureSimilarity(*entry->leftFile, *entry->rightFile, entry->firstDiffOffset, options.compareOptions, &similarity))
+			return;
+		entry->similarity = similarity.similarity;
+		entry->changedBytes = similarity.changedBytes;
+		LogLine(kDebug, "    '%s' is %.1f%% similar.", entry->leftFile->relativePath.c_str(), 100.0 * similarity.similarity);
+	}
+
+	// Iterates over an already sorted vector of files
+	class FileListCursor
+	{
+	public:
+		// Entries stay in place while the merge runs, so they can be compared in the background
+		static const bool kStableFileInfos = true;
+
+		FileListCursor(const std::vector<FileInfo>& files) : m_Files(files), m_Index(0) {}
+		bool IsValid() const { return m_Index < m_Files.size(); }
+		const FileInfo& Get() const { return m_Files[m_Index]; }
+		void Advance() { ++m_Index; }
+	private:
+		const std::vector<FileInfo>& m_Files;
+		size_t m_Index;
+	};
+
+	// Iterates over an already sorted list of files owned by someone else
+	class FilePointerListCursor
+	{
+	public:
+		static const bool kStableFileInfos = true;
+
+		FilePointerListCursor(const std::vector<const FileInfo*>& files) : m_Files(files), m_Index(0) {}
+		bool IsValid() const { return m_Index < m_Files.size(); }
+		const FileInfo& Get() const { return *m_Files[m_Index]; }
+		void Advance() { ++m_Index; }
+	private:
+		const std::vector<const FileInfo*>& m_Files;
+		size_t m_Index;
+	};
+
+	// Iterates over the records of a mapped manifest without materializing them
+	class ManifestListCursor
+	{
+	public:
+		static const bool kStableFileInfos = false;
+
+		ManifestListCursor(ManifestFile& manifest, const ScanOptions& options) : m_Cursor(manifest, options) { Advance(); }
+		bool IsValid() const { return m_Valid; }
+		const FileInfo& Get() const { return m_Cursor.GetFileInfo(); }
+		void Advance() { m_Valid = m_Cursor.Next(); }
+		bool HasFailed() const { return m_Cursor.HasFailed(); }
+	private:
+		ManifestCursor m_Cursor;
+		bool m_Valid;
+	};
+
+	// Compares file pairs on the compare pool while the merge moves on, and reports the entries
+	// in the order they were added, always from the merging thread
+	class ComparePipeline
+	{
+	public:
+		ComparePipeline(const DiffOptions& options, const DiffEntryCallback& entryCallback)
+			: m_Options(options)
+			, m_EntryCallback(entryCallback)
+			, m_Scheduler(GetComparePool())
+		{
+		}
+
+		~ComparePipeline()
+		{
+			Flush();
+		}
+
+		ComparePipeline(const ComparePipeline&) = delete;
+		ComparePipeline& operator=(const ComparePipeline&) = delete;
+
+		// Whether the pair is worth comparing in the background, everything else is compared inline
+		bool CanCompare(const FileInfo& leftFile, const FileInfo& rightFile) const
+		{
+			return m_Options.compareContents && HasLocalFile(leftFile) && HasLocalFile(rightFile)
+				&& (FileSize(leftFile) == FileSize(rightFile) || m_Options.compareOptions.normalizeText || m_Options.measureSimilarity)
+				&& !(leftFile.hasContentHash && rightFile.hasContentHash);
+		}
+
+		// Both files must stay in place until the entry was reported
+		void AddCompare(const FileInfo& leftFile, const FileInfo& rightFile)
+		{
+			const dev_t leftDevice = leftFile.status.st_dev;
+			const dev_t rightDevice = rightFile.status.st_dev;
+			m_Scheduler.WaitForQueueRoom(leftDevice);
+			m_Scheduler.WaitForQueueRoom(rightDevice);
+
+			Pending* pending;
+			{
+				std::unique_lock<std::mutex> lock(m_Mutex);
+				m_Pending.push_back(Pending { DiffEntry { &leftFile, &rightFile, false }, false });
+				pending = &m_Pending.back();
+			}
+
+			m_Scheduler.Submit(leftDevice, rightDevice, [this, pending]()
+			{
+				DiffEntry entry = pending->entry;
+				entry.differs = !FilesMatch(*entry.leftFile, *entry.rightFile, m_Options, &entry.firstDiffOffset);
+				if (entry.differs)
+					LogLine(kDebug, "    '%s' differs at byte %lld.", entry.leftFile->relativePath.c_str(), (long long)entry.firstDiffOffset);
+				MeasureModifiedFile(m_Options, &entry);
+				if (m_Options.session)
+					m_Options.session->RecordVerdict(entry);
+
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				pending->entry = entry;
+				pending->done = true;
+				m_Completed.notify_all();
+			});
+
+			EmitCompleted(kMaxPending);
+		}
+
+		void Add(const DiffEntry& entry)
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			if (m_Pending.empty())
+			{
+				lock.unlock();
+				m_EntryCallback(entry);
+				return;
+			}
+			m_Pending.push_back(Pending { entry, true });
+			lock.unlock();
+			EmitCompleted(kMaxPending);
+		}
+
+		void Flush()
+		{
+			EmitCompleted(0);
+		}
+
+	private:
+		// Bounds the entries held back behind a slow compare
+		static const size_t kMaxPending = 4096;
+
+		struct Pending
+		{
+			DiffEntry entry;
+			bool done;
+		};
+
+		// Reports finished entries from the front, waiting for compares while more than maxPending are left
+		void EmitCompleted(const size_t maxPending)
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			while (!m_Pending.empty())
+			{
+				if (!m_Pending.front().done)
+				{
+					if (m_Pending.size() <= maxPending)
+						break;
+					m_Completed.wait(lock, [this]() { return m_Pending.front().done; });
+				}
+
+				const DiffEntry entry = m_Pending.front().entry;
+				m_Pending.pop_front();
+
+				lock.unlock();
+				m_EntryCallback(entry);
+				lock.lock();
+			}
+		}
+
+		const DiffOptions& m_Options;
+		const DiffEntryCallback& m_EntryCallback;
+		std::mutex m_Mutex;
+		std::condition_variable m_Completed;
+		std::deque<Pending> m_Pending;
+		// Declared last so it waits for running compares before the queue goes away
+		DeviceScheduler m_Scheduler;
+	};
+
+	// Walks two sorted file lists in lockstep and reports every entry in sorted order
+	template <typename LeftCursor, typename RightCursor>
+	void MergeCursors(LeftCursor& left, RightCursor& right, const DiffOptions& options, const DiffEntryCallback& entryCallback)
+	{
+		ScopedPhase phase(kPhaseCompare);
+		ComparePipeline pipeline(options, entryCallback);
+
+		while (left.IsValid() && right.IsValid())
+		{
+			const FileInfo& leftFile = left.Get();
+			const FileInfo& rightFile = right.Get();
+
+			LogLine(kDebug, "Comparing %s, %s:", leftFile.relativePath.c_str(), rightFile.relativePath.c_str());
+
+			if (SameRelativeFile(leftFile, rightFile))
+			{
+				DiffEntry resumed { nullptr, nullptr, false };
+				if (IsDir(leftFile) && IsDir(rightFile))
+				{
+					LogLine(kDebug, "    Same directory.");
+					pipeline.Add(DiffEntry { &leftFile, &rightFile, false });
+				}
+				else if (options.session && options.session->FindVerdict(leftFile, rightFile, &resumed))
+				{
+					LogLine(kDebug, "    Same file, unchanged since the session %s.", resumed.differs ? "found it modified" : "found it identical");
+					pipeline.Add(resumed);
+				}
+				else if (LeftCursor::kStableFileInfos && RightCursor::kStableFileInfos && pipeline.CanCompare(leftFile, rightFile))
+				{
+					LogLine(kDebug, "    Same file, queued for comparison.");
+					pipeline.AddCompare(leftFile, rightFile);
+				}
+				else
+				{
+					LogLine(kDebug, "    Same file, checking if equal.");
+					int64_t firstDiffOffset = -1;
+					const bool differs = !FilesMatch(leftFile, rightFile, options, &firstDiffOffset);
+					if (differs)
+						LogLine(kDebug, "    File differs at byte %lld.", (long long)firstDiffOffset);
+					else
+						LogLine(kDebug, "    Files identical.");
+					DiffEntry entry { &leftFile, &rightFile, differs, firstDiffOffset };
+					MeasureModifiedFile(options, &entry);
+					if (options.session)
+						options.session->RecordVerdict(entry);
+					pipeline.Add(entry);
+				}
+
+				left.Advance();
+				right.Advance();
+			}
+			else
+			{
+				if (FileInfoSortFunc(leftFile, rightFile))
+				{
+					LogLine(kDebug, "    Sole left file found.");
+					pipeline.Add(DiffEntry { &leftFile, nullptr, true });
+					left.Advance();
+				}
+				else
+				{
+					LogLine(kDebug, "    Sole right file found.");
+					pipeline.Add(DiffEntry { nullptr, &rightFile, true });
+					right.Advance();
+				}
+			}
+		}
+
+		// Fill in rest of left files if any
+		for (; left.IsValid(); left.Advance())
+			pipeline.Add(DiffEntry { &left.Get(), nullptr, true });
+
+		// Fill in rest of right files if any
+		for (; right.IsValid(); right.Advance())
+			pipeline.Add(DiffEntry { nullptr, &right.Get(), true });
+
+		pipeline.Flush();
+	}
+
+	void MergeFileLists(const std::vector<FileInfo>& leftFiles, const std::vector<FileInfo>& rightFiles, const DiffOptions& options, const DiffEntryCallback& entryCallback)
+	{
+		FileListCursor left(leftFiles);
+		FileListCursor right(rightFiles);
+		MergeCursors(left, right, options, entryCallback);
+	}
+
+	// Two manifests are merged straight from their mappings, no file data is read
+	bool MergeManifests(const std::string& leftPath, const std::string& rightPath, const DiffOptions& options, const DiffEntryCallback& entryCallback)
+	{
+		ManifestFile leftManifest;
+		ManifestFile rightManifest;
+		{
+			ScopedPhase phase(kPhaseScan);
+			if (!leftManifest.Open(leftPath) || !rightManifest.Open(rightPath))
+				return false;
+		}
+
+		ManifestListCursor left(leftManifest, options.scanOptions);
+		ManifestListCursor right(rightManifest, options.scanOptions);
+		MergeCursors(left, right, options, entryCallback);
+		return !left.HasFailed() && !right.HasFailed();
+	}
+
+	// One side of a bounded-memory diff. Directories go through an external sort, manifests are
+	// read from their mapping when paths match exactly and archives, whose listing is held in
+	// memory anyway, are sorted in place.
+	class SpilledSource
+	{
+	public:
+		static const bool kStableFileInfos = false;
+
+		SpilledSource()
+			: m_Index(0)
+		{
+		}
+
+		SpilledSource(const SpilledSource&) = delete;
+		SpilledSource& operator=(const SpilledSource&) = delete;
+
+		bool Open(const std::string& path, const DiffOptions& options)
+		{
+			if (IsManifestFile(path) && options.scanOptions.pathMatch == kPathMatchExact)
+			{
+				m_Manifest.reset(new ManifestFile());
+				if (!m_Manifest->Open(path))
+					return false;
+				m_ManifestCursor.reset(new ManifestListCursor(*m_Manifest, options.scanOptions));
+				return true;
+			}
+
+			// Manifests not read in path order are listed like archives
+			if (IsManifestFile(path) || IsArchiveFile(path))
+			{
+				const bool listed = IsManifestFile(path) ? ListFilesInManifest(path, options.scanOptions, &m_Files) : ListFilesInArchive(path, options.scanOptions, &m_Files);
+				if (!listed)
+					return false;
+				ScopedPhase phase(kPhaseSort);
+				SortFileList(&m_Files);
+				return true;
+			}
+
+			m_Sorter.reset(new ExternalFileSorter(path, options.maxMemory));
+			if (!ListFilesInDirExternally(path, options.scanOptions, m_Sorter.get()))
+				return false;
+			if (!m_Sorter->Finish())
+				return false;
+			LogLine(kDebug, "Sorted '%s' in %lu runs.", path.c_str(), (unsigned long)m_Sorter->GetRunCount());
+			return true;
+		}
+
+		bool IsValid() const
+		{
+			if (m_Sorter)
+				return m_Sorter->IsValid();
+			if (m_ManifestCursor)
+				return m_ManifestCursor->IsValid();
+			return m_Index < m_Files.size();
+		}
+
+		const FileInfo& Get() const
+		{
+			if (m_Sorter)
+				return m_Sorter->Get();
+			if (m_ManifestCursor)
+				return m_ManifestCursor->Get();
+			return m_Files[m_Index];
+		}
+
+		void Advance()
+		{
+			if (m_Sorter)
+				m_Sorter->Advance();
+			else if (m_ManifestCursor)
+				m_ManifestCursor->Advance();
+			else
+				++m_Index;
+		}
+
+		bool HasFailed() const { return (m_Sorter && m_Sorter->HasFailed()) || (m_ManifestCursor && m_ManifestCursor->HasFailed()); }
+
+	private:
+		std::unique_ptr<ExternalFileSorter> m_Sorter;
+		std::unique_ptr<ManifestFile> m_Manifest;
+		std::unique_ptr<ManifestListCursor> m_ManifestCursor;
+		std::vector<FileInfo> m_Files;
+		size_t m_Index;
+	};
+
+	bool StreamSpilledDiff(const std::string& leftPath, const std::string& rightPath, const DiffOptions& options, const DiffEntryCallback& entryCallback)
+	{
+		SpilledSource left;
+		SpilledSource right;
+		{
+			ScopedPhase phase(kPhaseScan);
+			if (!left.Open(leftPath, options) || !right.Open(rightPath, options))
+				return false;
+		}
+
+		MergeCursors(left, right, options, entryCallback);
+		return !left.HasFailed() && !right.HasFailed();
+	}
+
+	// Walks both trees directory by directory in parallel and gives up at the first difference
+	class QuickComparer
+	{
+	public:
+		QuickComparer(const DiffOptions& options)
+			: m_Options(options)
+			, m_CompareOptions(options.compareOptions)
+			, m_LeftVisited(options.scanOptions)
+			, m_RightVisited(options.scanOptions)
+			, m_Cancelled(false)
+			, m_Failed(false)
+		{
+			m_CompareOptions.cancel = &m_Cancelled;
+		}
+
+		QuickComparer(const QuickComparer&) = delete;
+		QuickComparer& operator=(const QuickComparer&) = delete;
+
+		bool CompareDirectories(const std::string& leftRoot, const std::string& rightRoot, not_null<bool> outIdentical, not_null<std::string> outDifference)
+		{
+			struct stat leftStatus;
+			struct stat rightStatus;
+			CountStat(kCounterStat, 2);
+			const bool leftFound = stat(leftRoot.c_str(), &leftStatus) == 0;
+			const bool rightFound = stat(rightRoot.c_str(), &rightStatus) == 0;
+			if (!leftFound || !rightFound)
+			{
+				LogLine(kError, "Could not read directory '%s'", (leftFound ? rightRoot : leftRoot).c_str());
+				return false;
+			}
+
+			m_LeftRoot = leftRoot;
+			m_RightRoot = rightRoot;
+			{
+				ScopedPhase phase(kPhaseScan);
+				DeviceScheduler scheduler(GetScanPool());
+				m_Scheduler = &scheduler;
+				m_LeftVisited.Enter(leftStatus);
+				m_RightVisited.Enter(rightStatus);
+				scheduler.Submit(leftStatus.st_dev, rightStatus.st_dev, [this]() { WalkDirectory(std::string(), std::string(), 0); });
+				scheduler.Wait();
+
+				// Directories reached through symlinks go last and in path order, like a full scan enters them
+				while (!m_LinkedDirs.empty() && !m_Cancelled)
+				{
+					std::vector<FilePair> linkedDirs;
+					linkedDirs.swap(m_LinkedDirs);
+					std::sort(linkedDirs.begin(), linkedDirs.end(), [](const FilePair& a, const FilePair& b) { return FileInfoSortFunc(*a.first, *b.first); });
+
+					std::vector<FilePair> enteredDirs;
+					for (const FilePair& dirs : linkedDirs)
+					{
+						if (EnterDirectory(*dirs.first, *dirs.second))
+							enteredDirs.push_back(dirs);
+					}
+					for (const FilePair& dirs : enteredDirs)
+						WalkLater(*dirs.first, *dirs.second);
+					scheduler.Wait();
+				}
+				m_Scheduler = nullptr;
+			}
+			return Finish(outIdentical, outDifference);
+		}
+
+		// Both lists sorted
+		bool CompareLists(const std::vector<FileInfo>& leftFiles, const std::vector<FileInfo>& rightFiles, not_null<bool> outIdentical, not_null<std::string> outDifference)
+		{
+			if (leftFiles.size() != rightFiles.size())
+				FoundDifference("Different number of entries", std::string());
+
+			for (size_t i = 0; i < leftFiles.size() && i < rightFiles.size() && !m_Cancelled; ++i)
+				CompareEntries(leftFiles[i], rightFiles[i]);
+
+			return Finish(outIdentical, outDifference);
+		}
+
+	private:
+		void FoundDifference(const char* what, const std::string& path)
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			if (m_Cancelled.exchange(true))
+				return;
+			m_Difference = path.empty() ? what : std::string(what) + " '" + path + "'";
+			LogLine(kDebug, "%s, stopping.", m_Difference.c_str());
+		}
+
+		// Structural checks only, equal files are queued for their contents to be compared later
+		void CompareEntries(const FileInfo& leftFile, const FileInfo& rightFile)
+		{
+			if (!SameRelativeFile(leftFile, rightFile))
+				FoundDifference("Only on one side:", FileInfoSortFunc(leftFile, rightFile) ? leftFile.relativePath : rightFile.relativePath);
+			else if (!IsDir(leftFile) && FileSize(leftFile) != FileSize(rightFile) && !m_CompareOptions.normalizeText)
+				FoundDifference("Size differs:", leftFile.relativePath);
+			else if (!IsDir(leftFile) && m_Options.compareContents)
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				m_ContentPairs.emplace_back(&leftFile, &rightFile);
+			}
+		}
+
+		// The sides are walked by their own paths, names matched by key may be spelled differently
+		void WalkDirectory(const std::string& leftRelDir, const std::string& rightRelDir, const int dirLevel)
+		{
+			if (m_Cancelled)
+				return;
+
+			std::unique_ptr<std::vector<FileInfo>> leftEntries(new std::vector<FileInfo>());
+			std::unique_ptr<std::vector<FileInfo>> rightEntries(new std::vector<FileInfo>());
+			if (!ScanDirectory(m_LeftRoot, leftRelDir, dirLevel, m_Options.scanOptions, leftEntries.get())
+				|| !ScanDirectory(m_RightRoot, rightRelDir, dirLevel, m_Options.scanOptions, rightEntries.get()))
+			{
+				m_Failed = true;
+				m_Cancelled = true;
+				return;
+			}
+
+			if (leftEntries->size() != rightEntries->size())
+			{
+				FoundDifference("Different number of entries in", leftRelDir.empty() ? std::string(".") : leftRelDir);
+				return;
+			}
+
+			SortFileList(leftEntries.get());
+			SortFileList(rightEntries.get());
+			std::vector<FilePair> linkedDirs;
+			for (size_t i = 0; i < leftEntries->size() && !m_Cancelled; ++i)
+			{
+				const FileInfo& leftFile = (*leftEntries)[i];
+				const FileInfo& rightFile = (*rightEntries)[i];
+				CompareEntries(leftFile, rightFile);
+				if (!IsDir(leftFile) || !IsDir(rightFile) || !SameRelativeFile(leftFile, rightFile))
+					continue;
+
+				if (leftFile.throughLink || rightFile.throughLink)
+					linkedDirs.emplace_back(&leftFile, &rightFile);
+				else if (EnterDirectory(leftFile, rightFile))
+					WalkLater(leftFile, rightFile);
+			}
+
+			// Kept alive for the content compares and linked directories that point into them
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Listings.push_back(std::move(leftEntries));
+			m_Listings.push_back(std::move(rightEntries));
+			m_LinkedDirs.insert(m_LinkedDirs.end(), linkedDirs.begin(), linkedDirs.end());
+		}
+
+		// A directory is listed on both sides or on neither, when it was entered before
+		bool EnterDirectory(const FileInfo& leftDir, const FileInfo& rightDir)
+		{
+			const bool enterLeft = m_LeftVisited.Enter(leftDir);
+			const bool enterRight = m_RightVisited.Enter(rightDir);
+			if (enterLeft != enterRight)
+				FoundDifference("Different number of entries in", leftDir.relativePath);
+			return enterLeft && enterRight;
+		}
+
+		void WalkLater(const FileInfo& leftDir, const FileInfo& rightDir)
+		{
+			m_Scheduler->Submit(leftDir.status.st_dev, rightDir.status.st_dev, [this, leftRelDir = leftDir.relativePath, rightRelDir = rightDir.relativePath, level = DirLevel(leftDir)]()
+			{
+				WalkDirectory(leftRelDir, rightRelDir, level);
+			});
+		}
+
+		bool CompareContents()
+		{
+			ScopedPhase phase(kPhaseCompare);
+
+			// Small files first, they are the quickest way to find a difference
+			std::sort(m_ContentPairs.begin(), m_ContentPairs.end(), [](const FilePair& a, const FilePair& b)
+			{
+				return FileSize(*a.first) < FileSize(*b.first);
+			});
+
+			DeviceScheduler scheduler(GetComparePool());
+			for (const FilePair& pair : m_ContentPairs)
+			{
+				if (m_Cancelled)
+					break;
+
+				const dev_t leftDevice = pair.first->status.st_dev;
+				const dev_t rightDevice = pair.second->status.st_dev;
+				scheduler.WaitForQueueRoom(leftDevice);
+				scheduler.WaitForQueueRoom(rightDevice);
+				scheduler.Submit(leftDevice, rightDevice, [this, pair]()
+				{
+					if (m_Cancelled)
+						return;
+					int64_t firstDiffOffset;
+					if (!FileEquals(*pair.first, *pair.second, m_CompareOptions, &firstDiffOffset))
+						FoundDifference("Content differs:", pair.first->relativePath);
+				});
+			}
+			scheduler.Wait();
+			return true;
+		}
+
+		bool Finish(not_null<bool> outIdentical, not_null<std::string> outDifference)
+		{
+			if (!m_Cancelled)
+				CompareContents();
+			if (m_Failed)
+				return false;
+
+			*outIdentical = !m_Cancelled;
+			*outDifference = m_Difference;
+			return true;
+		}
+
+		using FilePair = std::pair<const FileInfo*, const FileInfo*>;
+
+		const DiffOptions& m_Options;
+		CompareOptions m_CompareOptions;
+		std::string m_LeftRoot;
+		std::string m_RightRoot;
+		DeviceScheduler* m_Scheduler = nullptr;
+		VisitedDirectories m_LeftVisited;
+		VisitedDirectories m_RightVisited;
+
+		// Set at the first difference, or when a directory cannot be read
+		std::atomic<bool> m_Cancelled;
+		std::atomic<bool> m_Failed;
+
+		std::mutex m_Mutex;
+		std::string m_Difference;
+		std::vector<FilePair> m_ContentPairs;
+		std::vector<FilePair> m_LinkedDirs;
+		std::vector<std::unique_ptr<std::vector<FileInfo>>> m_Listings;
+	};
+
+	DiffType GetDiffType(const PathSet& paths)
+	{
+		DiffType diffType = GetPath(paths, kBase) != nullptr ? k3Way : k2Way;
+		LogLine(kDebug, "Diffing as %s...", (diffType == k2Way) ? "2way" : "3way");
+		return diffType;
+	}
+}
+
+bool StreamDirectoryDiff(const PathSet& paths, const DiffOptions& options, const DiffEntryCallback& entryCallback)
+{
+	if (GetDiffType(paths) != k2Way)
+	{
+		LogLine(kError, "3-way directory diffs are not supported.");
+		return false;
+	}
+
+	const std::string& leftPath = *GetPath(paths, kLeft);
+	const std::string& rightPath = *GetPath(paths, kRight);
+	// Manifests are in path order, merging them by match key needs them sorted again
+	const bool exactPaths = (options.scanOptions.pathMatch == kPathMatchExact);
+	if (exactPaths && IsManifestFile(leftPath) && IsManifestFile(rightPath))
+	{
+		LogLine(kDebug, "Merging manifests '%s' and '%s'.", leftPath.c_str(), rightPath.c_str());
+		return MergeManifests(leftPath, rightPath, options, entryCallback);
+	}
+
+	if (options.maxMemory > 0)
+	{
+		LogLine(kDebug, "Sorting listings on disk, in runs of %lld bytes.", (long long)options.maxMemory);
+		return StreamSpilledDiff(leftPath, rightPath, options, entryCallback);
+	}
+
+	std::vector<FileInfo> leftFiles;
+	std::vector<FileInfo> rightFiles;
+	if (!ScanAndSort(paths, options, &leftFiles, &rightFiles))
+		return false;
+
+	MergeFileLists(leftFiles, rightFiles, options, entryCallback);
+	return true;
+}
+
+bool GenerateDirectoryDiffState(const PathSet& paths, const DiffOptions& options, not_null<DirectoryDiffState> outDirDiffState)
+{
+	DiffType diffType = GetDiffType(paths);
+	outDirDiffState->diffType = diffType;
+	outDirDiffState->hasMergeOutput = GetPath(paths, kMerge) != nullptr;
+
+	auto& entries = outDirDiffState->sortedEntries;
+	entries.clear();
+
+	if (diffType != k2Way)
+	{
+		LogLine(kError, "3-way directory diffs are not supported.");
+		return false;
+	}
+
+	if (!ScanAndSort(paths, options, &outDirDiffState->leftFiles, &outDirDiffState->rightFiles))
+		return false;
+
+	MergeFileLists(outDirDiffState->leftFiles, outDirDiffState->rightFiles, options,
+		[&entries](const DiffEntry& entry) { entries.push_back(entry); });
+
+	return true;
+}
+
+bool GenerateDirectoryDiffState(const PathSet& paths, not_null<DirectoryDiffState> outDirDiffState)
+{
+	return GenerateDirectoryDiffState(paths, DiffOptions(), outDirDiffState);
+}
+
+void DiffSortedFiles(const std::vector<const FileInfo*>& leftFiles, const std::vector<const FileInfo*>& rightFiles, const DiffOptions& options, const DiffEntryCallback& entryCallback)
+{
+	FilePointerListCursor left(leftFiles);
+	FilePointerListCursor right(rightFiles);
+	MergeCursors(left, right, options, entryCallback);
+}
+
+bool QuickCompare(const PathSet& paths, const DiffOptions& options, not_null<bool> outIdentical, not_null<std::string> outDifference)
+{
+	if (GetDiffType(paths) != k2Way)
+	{
+		LogLine(kError, "3-way directory diffs are not supported.");
+		return false;
+	}
+
+	const std::string& leftPath = *GetPath(paths, kLeft);
+	const std::string& rightPath = *GetPath(paths, kRight);
+
+	bool isFile = false;
+	bool leftIsDir = false;
+	bool rightIsDir = false;
+	IsRegularFileOrDirectory(leftPath, &isFile, &leftIsDir);
+	IsRegularFileOrDirectory(rightPath, &isFile, &rightIsDir);
+
+	QuickComparer comparer(options);
+	if (leftIsDir && rightIsDir)
+		return comparer.CompareDirectories(leftPath, rightPath, outIdentical, outDifference);
+
+	// Manifests and archives can only be listed whole
+	std::vector<FileInfo> leftFiles;
+	std::vector<FileInfo> rightFiles;
+	if (!ScanAndSort(paths, options, &leftFiles, &rightFiles))
+		return false;
+	return comparer.CompareLists(leftFiles, rightFiles, outIdentical, outDifference);
+}
@@ -1,20 +1,56 @@
 #pragma once
 
+#include <functional>
+
 #include "FileUtils.h"
 
+// Bumped whenever DiffEntry, DiffOptions or the functions below change incompatibly
+#define DWRAP_DIFF_API_VERSION 8
+
 struct DiffEntry
 {
 	const FileInfo* leftFile;
 	const FileInfo* rightFile;
 	bool differs;
+
+	// Offset of the first differing byte of a modified file when it is known, -1 otherwise
+	int64_t firstDiffOffset = -1;
+
+	// Share of a modified file found in the other one and the bytes not found there, when
+	// DiffOptions::measureSimilarity is set and both files are local. -1 otherwise.
+	double similarity = -1;
+	int64_t changedBytes = -1;
 };
 
+class DiffSession;
+
 enum DiffType
 {
 	k2Way,
 	k3Way
 };
 
+struct DiffOptions
+{
+	ScanOptions scanOptions;
+	CompareOptions compareOptions;
+
+	// When false, files of equal size are reported as identical without reading them
+	bool compareContents = true;
+
+	// When not 0, StreamDirectoryDiff sorts directory listings in runs of about this many bytes
+	// spilled to temporary files instead of holding them in memory. This bounds the entries held,
+	// the scan still keeps some state per directory, see ListFilesInDirExternally.
+	int64_t maxMemory = 0;
+
+	// Modified files are cut into content-defined chunks to measure how much of them changed
+	bool measureSimilarity = false;
+
+	// When set, pairs of local files unchanged since the session recorded them are not compared
+	// again, and the verdicts of those that are compared are recorded in it
+	DiffSession* session = nullptr;
+};
+
 struct DirectoryDiffState
 {
 	std::vector<FileInfo> leftFiles;
@@ -24,122 +60,25 @@ struct DirectoryDiffState
 	bool hasMergeOutput;
 };
 
-void GenerateDirectoryDiffState(const PathSet& paths, not_null<DirectoryDiffState> outDirDiffState)
-{
-	DiffType diffType = GetPath(paths, kBase) != nullptr ? k3Way : k2Way;
-
-	LogLine(kDebug, "Diffing as %s...", (diffType == k2Way) ? "2way" : "3way");
-
-	if (diffType == k2Way)
-	{
-		const std::string* leftPath = GetPath(paths, kLeft);
-		const std::string* rightPath = GetPath(paths, kRight);
-
-		assert(leftPath != nullptr && rightPath != nullptr);
-
-		auto& leftFiles = outDirDiffState->leftFiles;
-		leftFiles.clear();
-		auto& rightFiles = outDirDiffState->rightFiles;
-		rightFiles.clear();
-		ListFilesInDirRecursively(*leftPath, "", 0, &leftFiles);
-		ListFilesInDirRecursively(*rightPath, "", 0, &rightFiles);
-		SortFileList(&leftFiles);
-		SortFileList(&rightFiles);
-
-		LogLine(kDebug, "Left directory:");
-		for (const auto& f : leftFiles)
-			LogLine(kDebug, "    '%s' (%i)", f.relativePath.c_str(), DirLevel(f));
-
-		LogLine(kDebug, "Right directory:");
-		for (const auto& f : rightFiles)
-			LogLine(kDebug, "    '%s' (%i)", f.relativePath.c_str(), DirLevel(f));	
-
-
-		outDirDiffState->diffType = k2Way;
-		auto& entries = outDirDiffState->sortedEntries;
-		entries.clear();
-
-		int leftStepper = 0;
-		const int leftCount = leftFiles.size();
-		int rightStepper = 0;
-		const int rightCount = rightFiles.size();
-		while (leftStepper < leftCount && rightStepper < rightCount)
-		{
-			const FileInfo& leftFile = leftFiles[leftStepper];
-			const FileInfo& rightFile = rightFiles[rightStepper];
-
-			LogLine(kDebug, "Comparing %s, %s:", leftFile.relativePath.c_str(), rightFile.relativePath.c_str());
-
-			if (SameRelativeFile(leftFile, rightFile))
-			{
-				bool differs;
-				if (IsDir(leftFile) && IsDir(rightFile))
-				{
-					LogLine(kDebug, "    Same directory.");
-					differs = false;
-				}
-				else
-				{
-					LogLine(kDebug, "    Same file, checking if equal.");
-					differs = !FileEquals(leftFile, rightFile);
-					if (differs)
-						LogLine(kDebug, "    File differs.");
-					else
-						LogLine(kDebug, "    Files identical.");
-				}
-
-				entries.push_back(DiffEntry { &leftFile, &rightFile, differs});
-
-				++leftStepper;
-				++rightStepper;
-			}
-			else
-			{
-				if (FileInfoSortFunc(leftFile, rightFile))
-				{
-					LogLine(kDebug, "    Sole left file found.");
-					entries.push_back(DiffEntry { &leftFile, nullptr, true });
-					++leftStepper;
-				}
-				else
-				{
-					LogLine(kDebug, "    Sole right file found.");
-					entries.push_back(DiffEntry { nullptr, &rightFile, true});
-					++rightStepper;
-				}
-			}
-		}
-
-		// Fill in rest of left files if any
-		while (leftStepper < leftCount)
-			entries.push_back(DiffEntry { &leftFiles[leftStepper++], nullptr });
-
-
-		// Fill in rest of right files if any
-		while (rightStepper < rightCount)
-			entries.push_back(DiffEntry { nullptr, &rightFiles[rightStepper++] });
-	}
-	else
-	{
-
-	}
-}
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+// Called once per entry in sorted order. The entry and the FileInfos it points to are only
+// valid for the duration of the call.
+using DiffEntryCallback = std::function<void(const DiffEntry&)>;
 
+// Each path is a directory, a manifest written by SaveManifest or a tar or zip archive. Files
+// are compared by content hash when one side only exists in a manifest or archive.
 
+// Scans and compares the directories in paths without keeping the result around. Two manifests
+// are merged record by record straight from their mappings.
+bool StreamDirectoryDiff(const PathSet& paths, const DiffOptions& options, const DiffEntryCallback& entryCallback);
 
+bool GenerateDirectoryDiffState(const PathSet& paths, const DiffOptions& options, not_null<DirectoryDiffState> outDirDiffState);
+bool GenerateDirectoryDiffState(const PathSet& paths, not_null<DirectoryDiffState> outDirDiffState);
 
+// Merges two listings that are already sorted, for callers that keep their own. The FileInfos
+// must stay in place until the call returns.
+void DiffSortedFiles(const std::vector<const FileInfo*>& leftFiles, const std::vector<const FileInfo*>& rightFiles, const DiffOptions& options, const DiffEntryCallback& entryCallback);
 
+// Only answers whether the sources are identical, stopping every scan and compare at the first
+// difference found. Names, types and sizes of the whole tree are checked before any content is
+// read. outDifference describes the difference that stopped the compare.
+bool QuickCompare(const PathSet& paths, const DiffOptions& options, not_null<bool> outIdentical, not_null<std::string> outDifference);
@@ -0,0 +1,350 @@
+#include "ExternalSort.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "Stats.h"
+#include "Trace.h"
+
+namespace
+{
+	// Runs merged at once, more are first merged in groups of this many
+	const size_t kMaxMergeFanIn = 64;
+	// Every run holds a file open, tiny budgets would otherwise run out of descriptors
+	const size_t kMaxOpenRuns = 2 * kMaxMergeFanIn;
+	const size_t kRunBufferSize = 256 * 1024;
+
+	// Followed by the path, then the path match key
+	struct RunRecordHeader
+	{
+		uint32_t pathLength;
+		uint32_t keyLength;
+		uint32_t isDir;
+		uint64_t matchHash;
+		struct stat status;
+	};
+
+	// What an entry costs while it waits in the buffer
+	int64_t GetBufferedSize(const FileInfo& f)
+	{
+		return (int64_t)(sizeof(FileInfo) + f.relativePath.capacity() + f.matchKey.capacity());
+	}
+}
+
+// A sorted run in an unlinked temporary file, written once and then read front to back
+class FileInfoRun
+{
+public:
+	FileInfoRun()
+		: m_File(nullptr)
+		, m_Valid(false)
+	{
+	}
+
+	~FileInfoRun()
+	{
+		if (m_File)
+			fclose(m_File);
+	}
+
+	FileInfoRun(const FileInfoRun&) = delete;
+	FileInfoRun& operator=(const FileInfoRun&) = delete;
+
+	bool Create()
+	{
+		const char* tempDir = getenv("TMPDIR");
+		std::string tempPath = std::string((tempDir && tempDir[0]) ? tempDir : "/tmp") + "/dwrap-run-XXXXXX";
+		const int fd = mkstemp(&tempPath[0]);
+		if (fd < 0)
+		{
+			LogLine(kError, "Could not create a temporary file in '%s'", (tempDir && tempDir[0]) ? tempDir : "/tmp");
+			return false;
+		}
+		unlink(tempPath.c_str());
+
+		m_File = fdopen(fd, "w+b");
+		if (m_File == nullptr)
+		{
+			close(fd);
+			return false;
+		}
+		setvbuf(m_File, nullptr, _IOFBF, kRunBufferSize);
+		return true;
+	}
+
+	bool Write(const FileInfo& f)
+	{
+		RunRecordHeader header;
+		memset(&header, 0, sizeof(header));
+		header.pathLength = (uint32_t)f.relativePath.size();
+		header.keyLength = (uint32_t)f.matchKey.size();
+		header.isDir = IsDir(f) ? 1 : 0;
+		header.matchHash = f.matchHash;
+		header.status = f.status;
+		return fwrite(&header, sizeof(header), 1, m_File) == 1
+			&& fwrite(f.relativePath.data(), 1, f.relativePath.size(), m_File) == f.relativePath.size()
+			&& fwrite(f.matchKey.data(), 1, f.matchKey.size(), m_File) == f.matchKey.size();
+	}
+
+	// Switches from writing to reading and loads the first entry
+	bool StartReading(const std::string& baseDir)
+	{
+		m_BaseDir = baseDir;
+		if (fflush(m_File) != 0 || fseek(m_File, 0, SEEK_SET) != 0)
+			return false;
+		return Next();
+	}
+
+	// False at the end of the run or when it could not be read, the latter also sets HasFailed
+	bool Next()
+	{
+		RunRecordHeader header;
+		m_Valid = false;
+		if (fread(&header, sizeof(header), 1, m_File) != 1)
+			return false;
+
+		FileInfo& f = m_Current;
+		f.relativePath.resize(header.pathLength);
+		if (header.pathLength > 0 && fread(&f.relativePath[0], 1, header.pathLength, m_File) != header.pathLength)
+			return false;
+		f.matchKey.resize(header.keyLength);
+		if (header.keyLength > 0 && fread(&f.matchKey[0], 1, header.keyLength, m_File) != header.keyLength)
+			return false;
+		f.matchHash = header.matchHash;
+
+		const size_t slash = f.relativePath.rfind('/');
+		f.name = (slash == std::string::npos) ? f.relativePath : f.relativePath.substr(slash + 1);
+		f.absolutePath = m_BaseDir + "/" + f.relativePath;
+		f.isDir = header.isDir != 0;
+		const int depth = GetPathDepth(f.relativePath.data(), f.relativePath.size());
+		f.level = f.isDir ? depth + 1 : depth;
+		f.status = header.status;
+		m_Valid = true;
+		return true;
+	}
+
+	bool HasFailed() const { return ferror(m_File) != 0; }
+	bool IsValid() const { return m_Valid; }
+	const FileInfo& Get() const { return m_Current; }
+
+private:
+	FILE* m_File;
+	std::string m_BaseDir;
+	FileInfo m_Current;
+	bool m_Valid;
+};
+
+ExternalFileSorter::ExternalFileSorter(const std::string& baseDir, const int64_t memoryBudget)
+	: m_BaseDir(baseDir)
+	, m_MemoryBudget(memoryBudget)
+	, m_BufferBytes(0)
+	, m_Failed(false)
+{
+}
+
+ExternalFileSorter::~ExternalFileSorter()
+{
+}
+
+bool ExternalFileSorter::Add(const FileInfo& f)
+{
+	FileInfo entry;
+	entry.relativePath = f.relativePath;
+	entry.isDir = f.isDir;
+	entry.level = f.level;
+	entry.status = f.status;
+	entry.matchKey = f.matchKey;
+	entry.matchHash = f.matchHash;
+	m_BufferBytes += GetBufferedSize(entry);
+	m_Buffer.push_back(std::move(entry));
+
+	if (m_BufferBytes >= m_MemoryBudget)
+		return SpillBuffer();
+	return true;
+}
+
+bool ExternalFileSorter::SpillBuffer()
+{
+	if (m_Buffer.empty())
+		return true;
+
+	TraceScope trace("SpillRun", m_BaseDir.c_str(), (int64_t)m_Buffer.size());
+	{
+		ScopedPhase phase(kPhaseSort);
+		SortFileList(&m_Buffer);
+	}
+
+	std::unique_ptr<FileInfoRun> run(new FileInfoRun());
+	bool written = run->Create();
+	for (size_t i = 0; written && i < m_Buffer.size(); ++i)
+		written = run->Write(m_Buffer[i]);
+	if (!written)
+	{
+		LogLine(kError, "Could not write a sorted run of '%s' to disk", m_BaseDir.c_str());
+		m_Failed = true;
+		return false;
+	}
+
+	LogLine(kDebug, "Spilled %lu entries of '%s' to run %lu.", (unsigned long)m_Buffer.size(), m_BaseDir.c_str(), (unsigned long)m_Runs.size());
+	m_Runs.push_back(std::move(run));
+
+	// Swapped out so the memory is actually returned
+	std::vector<FileInfo>().swap(m_Buffer);
+	m_BufferBytes = 0;
+
+	if (m_Runs.size() >= kMaxOpenRuns && !MergeRuns(0, kMaxMergeFanIn))
+	{
+		LogLine(kError, "Could not merge the sorted runs of '%s'", m_BaseDir.c_str());
+		m_Failed = true;
+		return false;
+	}
+	return true;
+}
+
+bool ExternalFileSorter::MergeRuns(const size_t first, const size_t count)
+{
+	TraceScope trace("MergeRuns", m_BaseDir.c_str(), (int64_t)count);
+
+	std::vector<std::unique_ptr<FileInfoRun>> inputs;
+	for (size_t i = first; i < first + count; ++i)
+		inputs.push_back(std::move(m_Runs[i]));
+	m_Runs.erase(m_Runs.begin() + first, m_Runs.begin() + first + count);
+
+	std::unique_ptr<FileInfoRun> output(new FileInfoRun());
+	if (!output->Create())
+		return false;
+
+	for (auto& input : inputs)
+	{
+		if (!input->StartReading(m_BaseDir) && input->HasFailed())
+			return false;
+	}
+
+	for (;;)
+	{
+		FileInfoRun* smallest = nullptr;
+		for (auto& input : inputs)
+		{
+			if (input->IsValid() && (smallest == nullptr || FileInfoSortFunc(input->Get(), smallest->Get())))
+				smallest = input.get();
+		}
+		if (smallest == nullptr)
+			break;
+		if (!output->Write(smallest->Get()))
+			return false;
+		if (!smallest->Next() && smallest->HasFailed())
+			return false;
+	}
+
+	m_Runs.push_back(std::move(output));
+	return true;
+}
+
+bool ExternalFileSorter::Finish()
+{
+	if (!SpillBuffer())
+		return false;
+
+	// Bounds the open files and read buffers of the final merge
+	while (m_Runs.size() > kMaxMergeFanIn)
+	{
+		if (!MergeRuns(0, kMaxMergeFanIn))
+		{
+			LogLine(kError, "Could not merge the sorted runs of '%s'", m_BaseDir.c_str());
+			m_Failed = true;
+			return false;
+		}
+	}
+
+	m_Heap.clear();
+	for (size_t i = 0; i < m_Runs.size(); ++i)
+	{
+		if (m_Runs[i]->StartReading(m_BaseDir))
+			m_Heap.push_back(i);
+		else if (m_Runs[i]->HasFailed())
+			m_Failed = true;
+	}
+
+	auto greater = [this](const size_t a, const size_t b) { return FileInfoSortFunc(m_Runs[b]->Get(), m_Runs[a]->Get()); };
+	std::make_heap(m_Heap.begin(), m_Heap.end(), greater);
+	return !m_Failed;
+}
+
+const FileInfo& ExternalFileSorter::Get() const
+{
+	return m_Runs[m_Heap.front()]->Get();
+}
+
+void ExternalFileSorter::Advance()
+{
+	auto greater = [this](const size_t a, const size_t b) { return FileInfoSortFunc(m_Runs[b]->Get(), m_Runs[a]->Get()); };
+	std::pop_heap(m_Heap.begin(), m_Heap.end(), greater);
+
+	FileInfoRun& run = *m_Runs[m_Heap.back()];
+	if (run.Next())
+	{
+		std::push_heap(m_Heap.begin(), m_Heap.end(), greater);
+	}
+	else
+	{
+		if (run.HasFailed())
+		{
+			LogLine(kError, "Could not read a sorted run of '%s' back", m_BaseDir.c_str());
+			m_Failed = true;
+		}
+		m_Heap.pop_back();
+	}
+}
+
+bool ListFilesInDirExternally(const std::string& baseDir, const ScanOptions& options, not_null<ExternalFileSorter> sorter)
+{
+	struct PendingDir
+	{
+		std::string relDir;
+		int level;
+	};
+
+	VisitedDirectories visited(options);
+	visited.EnterRoot(baseDir);
+
+	// Depth first, so only the directories still to visit are held. That is still every unvisited
+	// subdirectory along the current path, which is not bounded by the memory budget.
+	std::vector<PendingDir> pendingDirs;
+	pendingDirs.push_back(PendingDir { std::string(), 0 });
+
+	// Directories reached through symlinks are entered once the rest was scanned
+	std::vector<FileInfo> linkedDirs;
+	std::vector<FileInfo> enteredDirs;
+
+	std::vector<FileInfo> entries;
+	while (!pendingDirs.empty())
+	{
+		const PendingDir dir = std::move(pendingDirs.back());
+		pendingDirs.pop_back();
+
+		entries.clear();
+		if (!ScanDirectory(baseDir, dir.relDir, dir.level, options, &entries))
+			return false;
+
+		for (const FileInfo& f : entries)
+		{
+			if (!sorter->Add(f))
+				return false;
+			if (IsDir(f) && f.throughLink)
+				linkedDirs.push_back(f);
+			else if (IsDir(f) && visited.Enter(f))
+				pendingDirs.push_back(PendingDir { f.relativePath, DirLevel(f) });
+		}
+
+		if (pendingDirs.empty() && !linkedDirs.empty())
+		{
+			visited.EnterLinked(&linkedDirs, &enteredDirs);
+			for (const FileInfo& linkedDir : enteredDirs)
+				pendingDirs.push_back(PendingDir { linkedDir.relativePath, DirLevel(linkedDir) });
+		}
+	}
+	return true;
+}
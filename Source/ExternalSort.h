@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "FileUtils.h"
+
+// Bounded-memory sorting of scan results. Entries are collected up to a memory budget, sorted and
+// spilled as runs to temporary files, which are then merged back in sorted order. The files are
+// unlinked as soon as they are created, so nothing is left behind whatever happens.
+
+class FileInfoRun;
+
+class ExternalFileSorter
+{
+public:
+	// Entries are listed relative to baseDir, their absolute paths are rebuilt from it when read back
+	ExternalFileSorter(const std::string& baseDir, const int64_t memoryBudget);
+	~ExternalFileSorter();
+	ExternalFileSorter(const ExternalFileSorter&) = delete;
+	ExternalFileSorter& operator=(const ExternalFileSorter&) = delete;
+
+	// Only the relative path, type and status of the entry are kept
+	bool Add(const FileInfo& f);
+
+	// Spills what is left and prepares reading the entries back in sorted order
+	bool Finish();
+
+	// Cursor over the sorted entries once Finish returned
+	bool IsValid() const { return !m_Heap.empty(); }
+	const FileInfo& Get() const;
+	void Advance();
+
+	// A run could not be written or read back
+	bool HasFailed() const { return m_Failed; }
+
+	size_t GetRunCount() const { return m_Runs.size(); }
+
+private:
+	bool SpillBuffer();
+	bool MergeRuns(const size_t first, const size_t count);
+
+	const std::string m_BaseDir;
+	const int64_t m_MemoryBudget;
+
+	std::vector<FileInfo> m_Buffer;
+	int64_t m_BufferBytes;
+
+	std::vector<std::unique_ptr<FileInfoRun>> m_Runs;
+	// Indices of the runs still to read, ordered as a min-heap on their current entry
+	std::vector<size_t> m_Heap;
+	bool m_Failed;
+};
+
+// Scans baseDir one directory at a time into the sorter, without holding its files in memory.
+// What it does hold grows with the number of directories, not files: the directories still to
+// be visited, which are the unvisited subdirectories of every directory on the current path, and
+// when symlinks are followed, the device and inode of every directory entered so far along with
+// the directories reached through a link.
+bool ListFilesInDirExternally(const std::string& baseDir, const ScanOptions& options, not_null<ExternalFileSorter> sorter);
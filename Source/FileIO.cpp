@@ -0,0 +1,263 @@
+#include "FileIO.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Common.h"
+#include "Stats.h"
+
+namespace
+{
+	// O_DIRECT transfers must be aligned to the logical block size, 4KB covers all common devices
+	const size_t kDirectAlignment = 4096;
+
+	std::mutex s_bufferPoolMutex;
+	std::vector<char*> s_bufferPool;
+
+	bool IsAligned(const uint64_t value)
+	{
+		return (value % kDirectAlignment) == 0;
+	}
+
+	ssize_t ReadFully(const int fd, char* buffer, const size_t size, const int64_t offset)
+	{
+		size_t total = 0;
+		while (total < size)
+		{
+			const ssize_t bytesRead = pread(fd, buffer + total, size - total, (off_t)(offset + total));
+			if (bytesRead < 0 && errno == EINTR)
+				continue;
+			if (bytesRead < 0)
+				return -1;
+			if (bytesRead == 0)
+				break;
+			total += bytesRead;
+		}
+		return (ssize_t)total;
+	}
+
+	void Advise(const int fd, const int64_t offset, const int64_t length, const int advice)
+	{
+#ifdef POSIX_FADV_NORMAL
+		posix_fadvise(fd, (off_t)offset, (off_t)length, advice);
+#else
+		(void)fd; (void)offset; (void)length; (void)advice;
+#endif
+	}
+}
+
+// Systems without posix_fadvise get no-op advice values
+#ifndef POSIX_FADV_NORMAL
+#define POSIX_FADV_SEQUENTIAL 0
+#define POSIX_FADV_WILLNEED 0
+#define POSIX_FADV_DONTNEED 0
+#endif
+
+bool ParseIoPolicy(const std::string& name, not_null<IoPolicy> outPolicy)
+{
+	if (name == "cached")
+		*outPolicy = kIoCached;
+	else if (name == "dropBehind")
+		*outPolicy = kIoDropBehind;
+	else if (name == "direct")
+		*outPolicy = kIoDirect;
+	else
+		return false;
+	return true;
+}
+
+IoBuffer::IoBuffer()
+	: m_Data(nullptr)
+{
+	{
+		std::lock_guard<std::mutex> lock(s_bufferPoolMutex);
+		if (!s_bufferPool.empty())
+		{
+			m_Data = s_bufferPool.back();
+			s_bufferPool.pop_back();
+		}
+	}
+
+	if (m_Data == nullptr)
+	{
+		void* data = nullptr;
+		if (posix_memalign(&data, kDirectAlignment, kSize) != 0)
+			throw std::bad_alloc();
+		m_Data = (char*)data;
+	}
+}
+
+IoBuffer::~IoBuffer()
+{
+	std::lock_guard<std::mutex> lock(s_bufferPoolMutex);
+	s_bufferPool.push_back(m_Data);
+}
+
+InputFile::InputFile()
+	: m_Fd(-1)
+	, m_BufferedFd(-1)
+	, m_Policy(kIoCached)
+{
+}
+
+InputFile::~InputFile()
+{
+	Close();
+}
+
+bool InputFile::Open(const std::string& path, const IoPolicy policy)
+{
+	Close();
+	m_Policy = policy;
+
+	CountStat(kCounterOpen);
+	m_Fd = open(path.c_str(), O_RDONLY);
+	if (m_Fd < 0)
+		return false;
+
+	if (policy != kIoDirect)
+	{
+		Advise(m_Fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		return true;
+	}
+
+	// The buffered descriptor is kept for unaligned reads, the direct one replaces it where supported
+	m_BufferedFd = m_Fd;
+#if defined(O_DIRECT)
+	CountStat(kCounterOpen);
+	const int directFd = open(path.c_str(), O_RDONLY | O_DIRECT);
+	if (directFd >= 0)
+		m_Fd = directFd;
+	else
+		LogLine(kDebug, "O_DIRECT not supported for '%s', reading it through the page cache.", path.c_str());
+#elif defined(F_NOCACHE)
+	CountStat(kCounterOpen);
+	const int directFd = open(path.c_str(), O_RDONLY);
+	if (directFd >= 0)
+	{
+		fcntl(directFd, F_NOCACHE, 1);
+		m_Fd = directFd;
+	}
+#endif
+	if (m_Fd == m_BufferedFd)
+		m_BufferedFd = -1;
+	return true;
+}
+
+void InputFile::Close()
+{
+	if (m_Fd >= 0)
+		close(m_Fd);
+	if (m_BufferedFd >= 0)
+		close(m_BufferedFd);
+	m_Fd = -1;
+	m_BufferedFd = -1;
+}
+
+ssize_t InputFile::ReadAt(char* buffer, const size_t size, const int64_t offset)
+{
+	CountStat(kCounterRead);
+
+	ssize_t bytesRead;
+	if (m_Policy == kIoDirect && m_BufferedFd >= 0)
+	{
+		if (IsAligned(offset) && IsAligned((uintptr_t)buffer))
+		{
+			// Reading past the end is fine, the size only has to be rounded up to the alignment.
+			// The caller's buffer must have room for that, IoBuffers do.
+			const size_t alignedSize = (size + kDirectAlignment - 1) & ~(kDirectAlignment - 1);
+			bytesRead = ReadFully(m_Fd, buffer, alignedSize, offset);
+			if (bytesRead > (ssize_t)size)
+				bytesRead = size;
+		}
+		else
+		{
+			bytesRead = ReadFully(m_BufferedFd, buffer, size, offset);
+			if (bytesRead > 0)
+				Advise(m_BufferedFd, offset, bytesRead, POSIX_FADV_DONTNEED);
+		}
+	}
+	else
+	{
+		// Start reading the next block while this one is compared
+		if (m_Policy != kIoDirect)
+			Advise(m_Fd, offset + size, size, POSIX_FADV_WILLNEED);
+
+		bytesRead = ReadFully(m_Fd, buffer, size, offset);
+
+		if (m_Policy != kIoCached && bytesRead > 0)
+			Advise(m_Fd, offset, bytesRead, POSIX_FADV_DONTNEED);
+	}
+
+	if (bytesRead > 0)
+		CountStat(kCounterBytesRead, bytesRead);
+	return bytesRead;
+}
+
+MappedFile::MappedFile()
+	: m_Data(nullptr)
+	, m_Size(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const std::string& path)
+{
+	Close();
+
+	CountStat(kCounterOpen);
+	const int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		LogLine(kError, "Could not open file '%s'", path.c_str());
+		return false;
+	}
+
+	struct stat status;
+	CountStat(kCounterStat);
+	if (fstat(fd, &status) != 0)
+	{
+		LogLine(kError, "Could not read file '%s'", path.c_str());
+		close(fd);
+		return false;
+	}
+
+	// Empty files cannot be mapped, and need not be
+	if (status.st_size == 0)
+	{
+		close(fd);
+		return true;
+	}
+
+	void* mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+	{
+		LogLine(kError, "Could not map file '%s'", path.c_str());
+		return false;
+	}
+
+	m_Data = (const char*)mapping;
+	m_Size = status.st_size;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_Data)
+		munmap((void*)m_Data, m_Size);
+	m_Data = nullptr;
+	m_Size = 0;
+}
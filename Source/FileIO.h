@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <sys/types.h>
+
+#include "Common.h"
+
+// How the compare engine reads file contents
+enum IoPolicy
+{
+	// Sequential readahead, read pages stay in the page cache
+	kIoCached,
+	// Also drops pages behind the read cursor, so a compare does not evict other processes' data
+	kIoDropBehind,
+	// Bypasses the page cache with O_DIRECT
+	kIoDirect
+};
+
+bool ParseIoPolicy(const std::string& name, not_null<IoPolicy> outPolicy);
+
+// A buffer aligned for O_DIRECT, taken from and returned to a shared pool
+class IoBuffer
+{
+public:
+	static const size_t kSize = 1024 * 1024;
+
+	IoBuffer();
+	~IoBuffer();
+	IoBuffer(const IoBuffer&) = delete;
+	IoBuffer& operator=(const IoBuffer&) = delete;
+
+	char* GetData() const { return m_Data; }
+
+private:
+	char* m_Data;
+};
+
+// A file opened for reading according to an IoPolicy. Reads may come from several threads.
+class InputFile
+{
+public:
+	InputFile();
+	~InputFile();
+	InputFile(const InputFile&) = delete;
+	InputFile& operator=(const InputFile&) = delete;
+
+	bool Open(const std::string& path, const IoPolicy policy);
+	void Close();
+
+	int GetFd() const { return m_Fd; }
+
+	// Reads until size bytes were read or the end of the file is reached, -1 on errors
+	ssize_t ReadAt(char* buffer, const size_t size, const int64_t offset);
+
+private:
+	int m_Fd;
+	// O_DIRECT needs aligned offsets and sizes, unaligned reads go through this one instead
+	int m_BufferedFd;
+	IoPolicy m_Policy;
+};
+
+// A whole file mapped read only, for readers that jump around in it. Pages are only read once
+// they are touched.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const std::string& path);
+	void Close();
+
+	const char* GetData() const { return m_Data; }
+	size_t GetSize() const { return m_Size; }
+
+private:
+	const char* m_Data;
+	size_t m_Size;
+};
@@ -0,0 +1,866 @@
+#include "FileUtils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include "Archive.h"
+#include "DeviceScheduler.h"
+#include "FileIO.h"
+#include "Hash.h"
+#include "PathFilter.h"
+#include "PathSort.h"
+#include "Stats.h"
+#include "TextCompare.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+namespace
+{
+	// Large files are split into ranges of this size, compared concurrently
+	const int64_t kLargeFileRangeSize = 8 * 1024 * 1024;
+	const size_t kLargeFileReadSize = IoBuffer::kSize;
+
+	// A part of the compared files and whether each file has data there or a hole
+	struct CompareSegment
+	{
+		int64_t start;
+		int64_t end;
+		bool data1;
+		bool data2;
+	};
+
+	struct DataRegion
+	{
+		int64_t start;
+		int64_t end;
+	};
+
+	// Index of the first byte that differs, or -1
+	int64_t FindFirstDifference(const char* data1, const char* data2, const size_t size)
+	{
+		if (memcmp(data1, data2, size) == 0)
+			return -1;
+		for (size_t i = 0; i < size; ++i)
+		{
+			if (data1[i] != data2[i])
+				return (int64_t)i;
+		}
+		return -1;
+	}
+
+	// Index of the first byte that is not zero, or -1
+	int64_t FindFirstNonZero(const char* data, const size_t size)
+	{
+		static const char kZeros[4096] = {};
+		for (size_t offset = 0; offset < size; offset += sizeof(kZeros))
+		{
+			const size_t length = std::min(size - offset, sizeof(kZeros));
+			if (memcmp(data + offset, kZeros, length) == 0)
+				continue;
+			for (size_t i = offset; i < offset + length; ++i)
+			{
+				if (data[i] != 0)
+					return (int64_t)i;
+			}
+		}
+		return -1;
+	}
+
+	// Fewer allocated blocks than the size needs means the file has holes
+	bool IsSparse(const FileInfo& f)
+	{
+		return (int64_t)f.status.st_blocks * 512 < (int64_t)f.status.st_size;
+	}
+
+	// Maps out the data regions of a file, everything in between reads as zeros
+	void GetDataRegions(const int fd, const int64_t size, not_null<std::vector<DataRegion>> outRegions)
+	{
+		outRegions->clear();
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+		for (int64_t offset = 0; offset < size;)
+		{
+			const off_t data = lseek(fd, (off_t)offset, SEEK_DATA);
+			if (data < 0)
+			{
+				// ENXIO means only a hole is left, anything else that the file system cannot tell
+				if (errno != ENXIO)
+				{
+					outRegions->clear();
+					outRegions->push_back(DataRegion { 0, size });
+				}
+				return;
+			}
+
+			off_t hole = lseek(fd, data, SEEK_HOLE);
+			if (hole < 0 || hole > size)
+				hole = size;
+			if (data >= hole)
+				return;
+
+			outRegions->push_back(DataRegion { data, hole });
+			offset = hole;
+		}
+#else
+		outRegions->push_back(DataRegion { 0, size });
+#endif
+	}
+
+	// Splits [0, size) into segments by where each file has data, dropping holes both files share
+	void GetCompareSegments(const std::vector<DataRegion>& regions1, const std::vector<DataRegion>& regions2, const int64_t size, not_null<std::vector<CompareSegment>> outSegments)
+	{
+		std::vector<int64_t> bounds = { 0, size };
+		for (const auto* regions : { &regions1, &regions2 })
+		{
+			for (const DataRegion& region : *regions)
+			{
+				bounds.push_back(region.start);
+				bounds.push_back(region.end);
+			}
+		}
+		std::sort(bounds.begin(), bounds.end());
+		bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+		size_t index1 = 0;
+		size_t index2 = 0;
+		for (size_t i = 0; i + 1 < bounds.size(); ++i)
+		{
+			const int64_t start = bounds[i];
+			const int64_t end = bounds[i + 1];
+			while (index1 < regions1.size() && regions1[index1].end <= start)
+				++index1;
+			while (index2 < regions2.size() && regions2[index2].end <= start)
+				++index2;
+
+			const bool data1 = index1 < regions1.size() && regions1[index1].start <= start;
+			const bool data2 = index2 < regions2.size() && regions2[index2].start <= start;
+			if (!data1 && !data2)
+				continue;
+
+			CompareSegment* last = outSegments->empty() ? nullptr : &outSegments->back();
+			if (last && last->end == start && last->data1 == data1 && last->data2 == data2)
+				last->end = end;
+			else
+				outSegments->push_back(CompareSegment { start, end, data1, data2 });
+		}
+	}
+
+	// Compares a segment, returns the offset of the first difference or -1. Stops early once
+	// the segment can no longer hold the first difference.
+	int64_t CompareSegmentRange(InputFile& file1, InputFile& file2, const FileInfo& f1, const FileInfo& f2, const CompareSegment& segment, const std::atomic<int64_t>& firstDiff, const std::atomic<bool>* cancel)
+	{
+		IoBuffer buf1;
+		IoBuffer buf2;
+
+		for (int64_t offset = segment.start; offset < segment.end; offset += kLargeFileReadSize)
+		{
+			if (firstDiff.load(std::memory_order_relaxed) < offset)
+				return -1;
+			if (cancel && cancel->load(std::memory_order_relaxed))
+				return offset;
+
+			const size_t toRead = (size_t)std::min<int64_t>(kLargeFileReadSize, segment.end - offset);
+			const ssize_t bytesRead1 = segment.data1 ? file1.ReadAt(buf1.GetData(), toRead, offset) : 0;
+			const ssize_t bytesRead2 = segment.data2 ? file2.ReadAt(buf2.GetData(), toRead, offset) : 0;
+			if (bytesRead1 < 0 || bytesRead2 < 0)
+			{
+				LogLine(kError, "Could not read file '%s'", (bytesRead1 < 0 ? f1 : f2).absolutePath.c_str());
+				return offset;
+			}
+
+			// A short read means one of the files was changed while comparing
+			int64_t index;
+			if (segment.data1 && segment.data2)
+			{
+				const size_t common = (size_t)std::min(bytesRead1, bytesRead2);
+				index = FindFirstDifference(buf1.GetData(), buf2.GetData(), common);
+				if (index < 0 && common < toRead)
+					index = common;
+			}
+			else
+			{
+				// Data against a hole only matches where the data is zero
+				const ssize_t bytesRead = segment.data1 ? bytesRead1 : bytesRead2;
+				index = FindFirstNonZero(segment.data1 ? buf1.GetData() : buf2.GetData(), bytesRead);
+				if (index < 0 && (size_t)bytesRead < toRead)
+					index = bytesRead;
+			}
+
+			if (index >= 0)
+				return offset + index;
+		}
+		return -1;
+	}
+
+	// Compares only where either file has data, in parallel ranges for large files
+	bool CompareFileRegions(const FileInfo& f1, const FileInfo& f2, const bool parallel, const CompareOptions& options, not_null<int64_t> outFirstDiffOffset)
+	{
+		InputFile file1;
+		InputFile file2;
+		if (!file1.Open(f1.absolutePath, options.ioPolicy) || !file2.Open(f2.absolutePath, options.ioPolicy))
+		{
+			LogLine(kError, "Could not read file '%s'", (file1.GetFd() < 0 ? f1 : f2).absolutePath.c_str());
+			return false;
+		}
+
+		const int64_t size = FileSize(f1);
+		std::vector<CompareSegment> segments;
+		if (IsSparse(f1) || IsSparse(f2))
+		{
+			std::vector<DataRegion> regions1;
+			std::vector<DataRegion> regions2;
+			GetDataRegions(file1.GetFd(), size, &regions1);
+			GetDataRegions(file2.GetFd(), size, &regions2);
+			GetCompareSegments(regions1, regions2, size, &segments);
+		}
+		else if (size > 0)
+		{
+			segments.push_back(CompareSegment { 0, size, true, true });
+		}
+
+		// Ranges are cut from the segments so no range mixes data and holes
+		std::vector<CompareSegment> ranges;
+		for (const CompareSegment& segment : segments)
+		{
+			for (int64_t start = segment.start; start < segment.end; start += kLargeFileRangeSize)
+				ranges.push_back(CompareSegment { start, std::min(segment.end, start + kLargeFileRangeSize), segment.data1, segment.data2 });
+		}
+
+		// Lowest differing offset found so far, ranges starting after it are skipped
+		std::atomic<int64_t> firstDiff(INT64_MAX);
+		auto compareRange = [&](const size_t index)
+		{
+			const CompareSegment& range = ranges[index];
+			if (firstDiff.load(std::memory_order_relaxed) < range.start)
+				return;
+
+			TraceScope trace("CompareRange", f1.relativePath.c_str(), range.end - range.start);
+			const int64_t offset = CompareSegmentRange(file1, file2, f1, f2, range, firstDiff, options.cancel);
+			if (offset < 0)
+				return;
+
+			int64_t current = firstDiff.load();
+			while (offset < current && !firstDiff.compare_exchange_weak(current, offset))
+			{
+			}
+		};
+
+		if (parallel)
+		{
+			// More ranges at once than the slower device sustains would only add seeks
+			const unsigned concurrency = std::min(GetDeviceLimits(f1.status.st_dev).concurrency, GetDeviceLimits(f2.status.st_dev).concurrency);
+			GetComparePool().ParallelFor(ranges.size(), compareRange, concurrency);
+		}
+		else
+		{
+			for (size_t i = 0; i < ranges.size(); ++i)
+				compareRange(i);
+		}
+
+		const int64_t offset = firstDiff.load();
+		if (offset == INT64_MAX)
+			return true;
+
+		*outFirstDiffOffset = offset;
+		return false;
+	}
+}
+
+const std::string* GetPath(const PathSet& pathSet, PathId id)
+{
+	const int size = pathSet.size();
+	if (size <= 0)
+		return nullptr;
+
+	switch (id)
+	{
+		case kBase:
+		{
+			return (size > 2) ? &pathSet[0] : nullptr;
+			break;
+		}
+		case kLeft:
+		{
+			return (size <= 2) ? &pathSet[0] : ((size > 2) ? &pathSet[1] : nullptr);
+			break;
+		}
+		case kRight:
+		{
+			return (size <= 2) ? &pathSet[1] : ((size > 2) ? &pathSet[2] : nullptr);
+			break;
+		}
+		case kMerge:
+		{
+			return (size > 3) ? &pathSet[3] : nullptr;
+			break;
+		}		
+	}
+
+	return nullptr;
+}
+
+void IsRegularFileOrDirectory(const std::string& path, not_null<bool> outIsRegFile, not_null<bool> outIsDirectory)
+{
+    struct stat pathStat;
+    CountStat(kCounterStat);
+    stat(path.c_str(), &pathStat);
+    *outIsRegFile = S_ISREG(pathStat.st_mode);
+	*outIsDirectory = S_ISDIR(pathStat.st_mode);
+}
+
+
+bool ListFilesInDirRecursively(const std::string& baseDir, const std::string& relDir, const int dirLevel, not_null<std::vector<FileInfo>> outFiles)
+{
+	return ListFilesInDirRecursively(baseDir, relDir, dirLevel, ScanOptions(), outFiles);
+}
+
+bool ScanDirectory(const std::string& baseDir, const std::string& relDir, const int dirLevel, const ScanOptions& options, not_null<std::vector<FileInfo>> outFiles)
+{
+	const std::string dirPath = baseDir + "/" + relDir;
+	TraceScope trace("ScanDir", dirPath.c_str());
+
+	CountStat(kCounterOpen);
+	DIR* dir;
+	if ((dir = opendir(dirPath.c_str())) != nullptr) 
+	{
+		struct dirent* entry;
+		while ((entry = readdir(dir)) != nullptr)
+		{
+			if (strcmp(entry->d_name, ".") == 0)
+				continue;
+			else if (strcmp(entry->d_name, "..") == 0)
+				continue;
+
+		    FileInfo fileInfo;
+		    fileInfo.name = entry->d_name;
+		    fileInfo.relativePath = relDir.empty() ?  entry->d_name : relDir + "/" + entry->d_name;
+
+		    // Filter on the directory entry type when the file system provides it, saving the stat
+		    bool filtered = false;
+		    if (options.filter)
+		    {
+#ifdef DT_DIR
+		    	if (entry->d_type == DT_DIR || entry->d_type == DT_REG)
+		    	{
+		    		if (options.filter->IsExcluded(fileInfo.relativePath, fileInfo.name, entry->d_type == DT_DIR))
+		    		{
+		    			CountStat(kCounterEntriesExcluded);
+		    			continue;
+		    		}
+		    		filtered = true;
+		    	}
+#endif
+		    }
+
+		    fileInfo.absolutePath = dirPath + "/" + entry->d_name;
+		    struct stat status;
+		    CountStat(kCounterStat);
+		    CountStat(kCounterEntriesScanned);
+		    if (lstat(fileInfo.absolutePath.c_str(), &status) != 0)
+		    {
+				LogLine(kDebug, "Skipping file '%s', it is gone", entry->d_name);
+		    	continue;
+		    }
+
+		    if (S_ISLNK(status.st_mode))
+		    {
+		    	if (options.symlinks == kSymlinkSkip)
+		    	{
+					LogLine(kDebug, "Skipping symlink '%s'", entry->d_name);
+		    		continue;
+		    	}
+
+		    	// A link that leads nowhere is listed as the link itself
+		    	struct stat targetStatus;
+		    	if (options.symlinks == kSymlinkFollow)
+		    	{
+		    		CountStat(kCounterStat);
+		    		if (stat(fileInfo.absolutePath.c_str(), &targetStatus) == 0)
+		    		{
+		    			status = targetStatus;
+		    			fileInfo.throughLink = true;
+		    		}
+		    	}
+		    }
+		   	fileInfo.status = status;
+
+		    if (options.filter && !filtered && options.filter->IsExcluded(fileInfo.relativePath, fileInfo.name, S_ISDIR(status.st_mode)))
+		    {
+		    	CountStat(kCounterEntriesExcluded);
+		    	continue;
+		    }
+
+		    SetPathMatchKey(options, &fileInfo);
+		    if (S_ISDIR(status.st_mode))
+		    {
+		    	fileInfo.isDir = true;
+		    	fileInfo.level = dirLevel + 1;
+		    	outFiles->push_back(fileInfo);
+		    }
+		    else if (S_ISREG(status.st_mode) || S_ISLNK(status.st_mode))
+		    {
+		    	fileInfo.isDir = false;
+		    	fileInfo.level = dirLevel;
+		    	outFiles->push_back(fileInfo);	
+		    }
+		    else
+		    {
+				LogLine(kDebug, "Skipping file '%s'", entry->d_name);
+		    }
+		}
+		closedir(dir);
+	}
+	else
+	{
+		LogLine(kError, "Could not read directory '%s'", dirPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+VisitedDirectories::VisitedDirectories(const ScanOptions& options)
+	: m_Tracking(options.symlinks == kSymlinkFollow)
+{
+}
+
+bool VisitedDirectories::Enter(const struct stat& status)
+{
+	if (!m_Tracking)
+		return true;
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Entered.emplace(status.st_dev, status.st_ino).second;
+}
+
+bool VisitedDirectories::Enter(const FileInfo& dir)
+{
+	if (Enter(dir.status))
+		return true;
+
+	LogLine(kDebug, "Not entering '%s', the directory was listed already", dir.relativePath.c_str());
+	return false;
+}
+
+void VisitedDirectories::EnterRoot(const std::string& path)
+{
+	if (!m_Tracking)
+		return;
+
+	struct stat status;
+	CountStat(kCounterStat);
+	if (stat(path.c_str(), &status) == 0)
+		Enter(status);
+}
+
+void VisitedDirectories::EnterLinked(not_null<std::vector<FileInfo>> linkedDirs, not_null<std::vector<FileInfo>> outEntered)
+{
+	SortFileList(linkedDirs);
+	outEntered->clear();
+	for (FileInfo& dir : *linkedDirs)
+	{
+		if (Enter(dir))
+			outEntered->push_back(std::move(dir));
+	}
+	linkedDirs->clear();
+}
+
+namespace
+{
+	// Directories reached through a symlink are only collected, for the caller to enter last
+	bool ListFilesRecursively(const std::string& baseDir, const std::string& relDir, const int dirLevel, const ScanOptions& options, VisitedDirectories& visited, not_null<std::vector<FileInfo>> linkedDirs, not_null<std::vector<FileInfo>> outFiles)
+	{
+		std::vector<FileInfo> files;
+		if (!ScanDirectory(baseDir, relDir, dirLevel, options, &files))
+			return false;
+
+		for (FileInfo& fileInfo : files)
+		{
+			const bool isDir = IsDir(fileInfo);
+			outFiles->push_back(std::move(fileInfo));
+			if (!isDir)
+				continue;
+
+			const FileInfo& dir = outFiles->back();
+			if (dir.throughLink)
+				linkedDirs->push_back(dir);
+			else if (visited.Enter(dir) && !ListFilesRecursively(baseDir, std::string(dir.relativePath), dirLevel + 1, options, visited, linkedDirs, outFiles))
+				return false;
+		}
+
+		return true;
+	}
+}
+
+bool ListFilesInDirRecursively(const std::string& baseDir, const std::string& relDir, const int dirLevel, const ScanOptions& options, not_null<std::vector<FileInfo>> outFiles)
+{
+	VisitedDirectories visited(options);
+	visited.EnterRoot(relDir.empty() ? baseDir : baseDir + "/" + relDir);
+
+	std::vector<FileInfo> linkedDirs;
+	std::vector<FileInfo> dirs;
+	if (!ListFilesRecursively(baseDir, relDir, dirLevel, options, visited, &linkedDirs, outFiles))
+		return false;
+
+	while (!linkedDirs.empty())
+	{
+		visited.EnterLinked(&linkedDirs, &dirs);
+		for (const FileInfo& dir : dirs)
+		{
+			if (!ListFilesRecursively(baseDir, dir.relativePath, DirLevel(dir), options, visited, &linkedDirs, outFiles))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+struct DirectoryScanner::RootScan
+{
+	RootScan(const ScanOptions& options) : visited(options) {}
+
+	std::string baseDir;
+	VisitedDirectories visited;
+	std::mutex mutex;
+	std::vector<FileInfo>* files;
+	std::vector<FileInfo> linkedDirs;
+};
+
+DirectoryScanner::DirectoryScanner(const ScanOptions& options)
+	: m_Options(options)
+	, m_Scheduler(new DeviceScheduler(GetScanPool()))
+	, m_Failed(false)
+{
+}
+
+DirectoryScanner::~DirectoryScanner()
+{
+	m_Scheduler->Wait();
+}
+
+bool DirectoryScanner::Add(const std::string& baseDir, not_null<std::vector<FileInfo>> outFiles)
+{
+	struct stat status;
+	CountStat(kCounterStat);
+	if (stat(baseDir.c_str(), &status) != 0)
+	{
+		LogLine(kError, "Could not read directory '%s'", baseDir.c_str());
+		return false;
+	}
+
+	m_Roots.emplace_back(new RootScan(m_Options));
+	RootScan* root = m_Roots.back().get();
+	root->baseDir = baseDir;
+	root->files = outFiles;
+	root->visited.Enter(status);
+
+	m_Scheduler->Submit(status.st_dev, status.st_dev, [this, root]() { ScanTask(*root, std::string(), 0); });
+	return true;
+}
+
+bool DirectoryScanner::Wait()
+{
+	m_Scheduler->Wait();
+
+	// All directories of a round are entered before any is scanned, so the order scans finish in
+	// cannot decide which link to a directory lists it
+	for (bool entered = true; entered;)
+	{
+		entered = false;
+		for (const auto& root : m_Roots)
+		{
+			std::vector<FileInfo> dirs;
+			root->visited.EnterLinked(&root->linkedDirs, &dirs);
+			for (const FileInfo& dir : dirs)
+			{
+				RootScan* scan = root.get();
+				m_Scheduler->Submit(dir.status.st_dev, dir.status.st_dev, [this, scan, relDir = dir.relativePath, level = DirLevel(dir)]()
+				{
+					ScanTask(*scan, relDir, level);
+				});
+				entered = true;
+			}
+		}
+		m_Scheduler->Wait();
+	}
+
+	return !m_Failed;
+}
+
+void DirectoryScanner::ScanTask(RootScan& root, const std::string& relDir, const int dirLevel)
+{
+	std::vector<FileInfo> files;
+	if (!ScanDirectory(root.baseDir, relDir, dirLevel, m_Options, &files))
+	{
+		m_Failed = true;
+		return;
+	}
+
+	// Subdirectories on another device (mount points) are queued on that device
+	std::vector<FileInfo> linkedDirs;
+	for (const FileInfo& fileInfo : files)
+	{
+		if (!IsDir(fileInfo))
+			continue;
+		if (fileInfo.throughLink)
+		{
+			linkedDirs.push_back(fileInfo);
+			continue;
+		}
+		if (!root.visited.Enter(fileInfo))
+			continue;
+		const dev_t device = fileInfo.status.st_dev;
+		m_Scheduler->Submit(device, device, [this, &root, relDir = fileInfo.relativePath, level = DirLevel(fileInfo)]()
+		{
+			ScanTask(root, relDir, level);
+		});
+	}
+
+	std::lock_guard<std::mutex> lock(root.mutex);
+	root.files->insert(root.files->end(), std::make_move_iterator(files.begin()), std::make_move_iterator(files.end()));
+	root.linkedDirs.insert(root.linkedDirs.end(), std::make_move_iterator(linkedDirs.begin()), std::make_move_iterator(linkedDirs.end()));
+}
+
+void SetPathMatchKey(const ScanOptions& options, not_null<FileInfo> f)
+{
+	if (options.pathMatch == kPathMatchExact)
+		return;
+	f->matchKey = GetPathMatchKey(f->relativePath, options.pathMatch);
+	f->matchHash = HashBytes(f->matchKey.data(), f->matchKey.size());
+}
+
+bool SameRelativeFile(const FileInfo& f1, const FileInfo f2)
+{	
+	if (IsDir(f1) != IsDir(f2))
+		return false;
+	if (f1.matchKey.empty() && f2.matchKey.empty())
+		return f1.relativePath == f2.relativePath;
+	return f1.matchHash == f2.matchHash && f1.matchKey == f2.matchKey;
+}
+
+int GetPathDepth(const char* path, const size_t length)
+{
+	int depth = 0;
+	for (size_t i = 0; i < length; ++i)
+		depth += (path[i] == '/') ? 1 : 0;
+	return depth;
+}
+
+int64_t GetModificationTimeNs(const struct stat& status)
+{
+#ifdef __APPLE__
+	return (int64_t)status.st_mtimespec.tv_sec * 1000000000ll + status.st_mtimespec.tv_nsec;
+#else
+	return (int64_t)status.st_mtim.tv_sec * 1000000000ll + status.st_mtim.tv_nsec;
+#endif
+}
+
+int64_t GetChangeTimeNs(const struct stat& status)
+{
+#ifdef __APPLE__
+	return (int64_t)status.st_ctimespec.tv_sec * 1000000000ll + status.st_ctimespec.tv_nsec;
+#else
+	return (int64_t)status.st_ctim.tv_sec * 1000000000ll + status.st_ctim.tv_nsec;
+#endif
+}
+
+void SetModificationTimeNs(const int64_t timeNs, not_null<struct stat> outStatus)
+{
+#ifdef __APPLE__
+	outStatus->st_mtimespec.tv_sec = timeNs / 1000000000ll;
+	outStatus->st_mtimespec.tv_nsec = timeNs % 1000000000ll;
+#else
+	outStatus->st_mtim.tv_sec = timeNs / 1000000000ll;
+	outStatus->st_mtim.tv_nsec = timeNs % 1000000000ll;
+#endif
+}
+
+bool ParseSymlinkPolicy(const std::string& name, not_null<SymlinkPolicy> outPolicy)
+{
+	if (name == "follow")
+		*outPolicy = kSymlinkFollow;
+	else if (name == "link")
+		*outPolicy = kSymlinkLink;
+	else if (name == "skip")
+		*outPolicy = kSymlinkSkip;
+	else
+		return false;
+	return true;
+}
+
+bool GetLinkTarget(const FileInfo& f, not_null<std::string> outTarget)
+{
+	if (f.archiveMember)
+	{
+		*outTarget = f.archiveMember->linkTarget;
+		return true;
+	}
+
+	if (!HasLocalFile(f))
+		return false;
+
+	char target[PATH_MAX];
+	CountStat(kCounterRead);
+	const ssize_t length = readlink(f.absolutePath.c_str(), target, sizeof(target));
+	if (length < 0 || length == (ssize_t)sizeof(target))
+	{
+		LogLine(kError, "Could not read symlink '%s'", f.absolutePath.c_str());
+		return false;
+	}
+	outTarget->assign(target, length);
+	return true;
+}
+
+bool GetContentHash(const FileInfo& f, not_null<uint64_t> outHash, const IoPolicy ioPolicy, const std::atomic<bool>* cancel)
+{
+	if (f.hasContentHash)
+	{
+		CountStat(kCounterCacheHits);
+		*outHash = f.contentHash;
+		return true;
+	}
+
+	// The contents of a symlink are the path it points to
+	if (IsSymlink(f))
+	{
+		std::string target;
+		if (!GetLinkTarget(f, &target))
+			return false;
+		ContentHasher hasher;
+		hasher.Update(target.data(), target.size());
+		*outHash = hasher.Digest();
+		return true;
+	}
+
+	if (f.archiveMember)
+	{
+		CountStat(kCounterCacheMisses);
+		return HashArchiveMember(*f.archiveMember, outHash);
+	}
+
+	if (!HasLocalFile(f))
+		return false;
+
+	CountStat(kCounterCacheMisses);
+	TraceScope trace("HashFile", f.relativePath.c_str(), FileSize(f));
+
+	InputFile file;
+	if (!file.Open(f.absolutePath, ioPolicy))
+	{
+		LogLine(kError, "Could not read file '%s'", f.absolutePath.c_str());
+		return false;
+	}
+
+	ContentHasher hasher;
+	IoBuffer buf;
+	for (int64_t offset = 0;; )
+	{
+		const ssize_t bytesRead = file.ReadAt(buf.GetData(), IoBuffer::kSize, offset);
+		if (bytesRead < 0)
+		{
+			LogLine(kError, "Could not read file '%s'", f.absolutePath.c_str());
+			return false;
+		}
+		if (bytesRead == 0)
+			break;
+		if (cancel && cancel->load(std::memory_order_relaxed))
+			return false;
+		hasher.Update(buf.GetData(), bytesRead);
+		offset += bytesRead;
+	}
+
+	*outHash = hasher.Digest();
+	return true;
+}
+
+bool FileEquals(const FileInfo& f1, const FileInfo& f2)
+{
+	int64_t firstDiffOffset;
+	return FileEquals(f1, f2, CompareOptions(), &firstDiffOffset);
+}
+
+namespace
+{
+	bool ExactFileEquals(const FileInfo& f1, const FileInfo& f2, const CompareOptions& options, not_null<int64_t> outFirstDiffOffset)
+	{
+		if (FileSize(f1) != FileSize(f2))
+			return false;
+
+		CountStat(kCounterFilesCompared);
+
+		// Manifest and archive entries can only be compared by hash, hashes cached for both files
+		// spare reading them again
+		if (!HasLocalFile(f1) || !HasLocalFile(f2) || (f1.hasContentHash && f2.hasContentHash))
+		{
+			uint64_t hash1;
+			uint64_t hash2;
+			if (!GetContentHash(f1, &hash1, options.ioPolicy, options.cancel) || !GetContentHash(f2, &hash2, options.ioPolicy, options.cancel))
+				return false;
+			return hash1 == hash2;
+		}
+
+		// Everything else is read with pread, so the I/O policy applies to small files too
+		const bool largeFile = (options.largeFileThreshold > 0 && FileSize(f1) >= options.largeFileThreshold);
+		return CompareFileRegions(f1, f2, largeFile, options, outFirstDiffOffset);
+	}
+}
+
+bool FileEquals(const FileInfo& f1, const FileInfo& f2, const CompareOptions& options, not_null<int64_t> outFirstDiffOffset)
+{
+	TraceScope trace("FileEquals", f1.relativePath.c_str(), FileSize(f1));
+
+	*outFirstDiffOffset = -1;
+
+	// Symlinks are compared by where they point, not by what is there
+	if (IsSymlink(f1) || IsSymlink(f2))
+	{
+		if (!IsSymlink(f1) || !IsSymlink(f2))
+			return false;
+
+		CountStat(kCounterFilesCompared);
+		std::string target1;
+		std::string target2;
+		if (GetLinkTarget(f1, &target1) && GetLinkTarget(f2, &target2))
+			return target1 == target2;
+
+		uint64_t hash1;
+		uint64_t hash2;
+		return GetContentHash(f1, &hash1) && GetContentHash(f2, &hash2) && hash1 == hash2;
+	}
+
+	if (!options.normalizeText || !HasLocalFile(f1) || !HasLocalFile(f2))
+		return ExactFileEquals(f1, f2, options, outFirstDiffOffset);
+
+	// Files equal byte for byte are settled by the exact compare, the rest are compared as text
+	if (FileSize(f1) == FileSize(f2) && ExactFileEquals(f1, f2, options, outFirstDiffOffset))
+		return true;
+	if (FileSize(f1) != FileSize(f2))
+		CountStat(kCounterFilesCompared);
+
+	// Offsets into the normalized text would not point at the difference in either file
+	*outFirstDiffOffset = -1;
+	return TextFileEquals(f1, f2, options);
+}
+
+bool FileInfoSortFunc(const FileInfo& f1, const FileInfo& f2)
+{	
+	// Paths with the same key are ordered by the paths themselves, so the order is stable
+	const int order = f1.matchKey.compare(f2.matchKey);
+	return (order != 0) ? order < 0 : f1.relativePath < f2.relativePath;
+}
+
+void SortFileList(not_null<std::vector<FileInfo>> files)
+{
+	// The multikey sort only looks at paths
+	if (!files->empty() && !files->front().matchKey.empty())
+		std::sort(files->begin(), files->end(), &FileInfoSortFunc);
+	else
+		SortFileInfosByPath(files);
+}
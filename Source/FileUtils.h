@@ -1,9 +1,17 @@
 #pragma once
-#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <vector>
 #include <string>
 
-#include <dirent.h>
+#include <sys/stat.h>
+
+#include "Common.h"
+#include "FileIO.h"
+#include "PathMatch.h"
 
 enum PathId
 {
@@ -15,47 +23,11 @@ enum PathId
 
 using PathSet = std::vector<std::string>;
 
-const std::string* GetPath(const PathSet& pathSet, PathId id)
-{
-	const int size = pathSet.size();
-	if (size <= 0)
-		return nullptr;
-
-	switch (id)
-	{
-		case kBase:
-		{
-			return (size > 2) ? &pathSet[0] : nullptr;
-			break;
-		}
-		case kLeft:
-		{
-			return (size <= 2) ? &pathSet[0] : ((size > 2) ? &pathSet[1] : nullptr);
-			break;
-		}
-		case kRight:
-		{
-			return (size <= 2) ? &pathSet[1] : ((size > 2) ? &pathSet[2] : nullptr);
-			break;
-		}
-		case kMerge:
-		{
-			return (size > 3) ? &pathSet[3] : nullptr;
-			break;
-		}		
-	}
-
-	return nullptr;
-}
-
-void IsRegularFileOrDirectory(const std::string& path, not_null<bool> outIsRegFile, not_null<bool> outIsDirectory)
-{
-    struct stat pathStat;
-    stat(path.c_str(), &pathStat);
-    *outIsRegFile = S_ISREG(pathStat.st_mode);
-	*outIsDirectory = S_ISDIR(pathStat.st_mode);
-}
+const std::string* GetPath(const PathSet& pathSet, PathId id);
+
+void IsRegularFileOrDirectory(const std::string& path, not_null<bool> outIsRegFile, not_null<bool> outIsDirectory);
 
+struct ArchiveMember;
 
 struct FileInfo
 {
@@ -65,115 +37,154 @@ struct FileInfo
 	bool isDir;
 	int level;
 	struct stat status;
+
+	// Entries loaded from a manifest have no absolute path, only the hash of their contents.
+	// The daemon keeps the hashes of local files here too.
+	uint64_t contentHash = 0;
+	bool hasContentHash = false;
+
+	// Entries listed from an archive are read through it instead
+	std::shared_ptr<const ArchiveMember> archiveMember;
+
+	// A symlink that was followed, status describes what it points to
+	bool throughLink = false;
+
+	// Entries are paired with the other side's by this key unless paths match exactly, when it
+	// stays empty. The hash rules out most unequal keys in one comparison.
+	std::string matchKey;
+	uint64_t matchHash = 0;
 };
 
-bool IsDir(const FileInfo& f) { return f.isDir; }
-int DirLevel(const FileInfo& f) { return f.level; }
-int FileSize(const FileInfo& f) { return (int)f.status.st_size; }
+class PathFilter;
 
-bool ListFilesInDirRecursively(const std::string& baseDir, const std::string& relDir, const int dirLevel, not_null<std::vector<FileInfo>> outFiles)
+// What a scan does with symbolic links
+enum SymlinkPolicy
 {
-	const std::string dirPath = baseDir + "/" + relDir;
-
-	DIR* dir;
-	if ((dir = opendir(dirPath.c_str())) != nullptr) 
-	{
-		struct dirent* entry;
-		while ((entry = readdir(dir)) != nullptr)
-		{
-			if (strcmp(entry->d_name, ".") == 0)
-				continue;
-			else if (strcmp(entry->d_name, "..") == 0)
-				continue;
-
-		    FileInfo fileInfo;
-		    fileInfo.name = entry->d_name;
-		    fileInfo.relativePath = relDir.empty() ?  entry->d_name : relDir + "/" + entry->d_name;
-		    fileInfo.absolutePath = dirPath + "/" + entry->d_name;
-		    struct stat status;
-		   	stat(fileInfo.absolutePath.c_str(), &status);
-		   	fileInfo.status = status;
-
-		    if (S_ISDIR(status.st_mode))
-		    {
-		    	fileInfo.isDir = true;
-		    	fileInfo.level = dirLevel + 1;
-		    	outFiles->push_back(fileInfo);
-
-		    	if (!ListFilesInDirRecursively(baseDir, fileInfo.relativePath, dirLevel + 1, outFiles))
-		    	{
-		    		closedir(dir);
-		    		return false;
-		    	}
-		    }
-		    else if (S_ISREG(status.st_mode))
-		    {
-		    	fileInfo.isDir = false;
-		    	fileInfo.level = dirLevel;
-		    	outFiles->push_back(fileInfo);	
-		    }
-		    else
-		    {
-				LogLine(kDebug, "Skipping file '%s'", entry->d_name);
-		    }
-		}
-		closedir(dir);
-	}
-	else
-	{
-		LogLine(kError, "Could not read directory '%s'", dirPath.c_str());
-		return false;
-	}
-
-	return true;
-}
-
-bool SameRelativeFile(const FileInfo& f1, const FileInfo f2)
-{	
-	return (IsDir(f1) == IsDir(f2)) && (f1.relativePath == f2.relativePath);
-}
-
-bool FileEquals(const FileInfo& f1, const FileInfo& f2)
+	// Lists what a link points to, links that lead nowhere are listed as links
+	kSymlinkFollow,
+	// Lists the link itself, links are equal when they point to the same path
+	kSymlinkLink,
+	kSymlinkSkip
+};
+
+bool ParseSymlinkPolicy(const std::string& name, not_null<SymlinkPolicy> outPolicy);
+
+struct ScanOptions
+{
+	// Excluded entries are skipped before they are stat'ed, excluded directories are never opened
+	const PathFilter* filter = nullptr;
+
+	SymlinkPolicy symlinks = kSymlinkFollow;
+
+	PathMatch pathMatch = kPathMatchExact;
+};
+
+// Fills in the key an entry is paired by, every source lists its entries through this
+void SetPathMatchKey(const ScanOptions& options, not_null<FileInfo> f);
+
+struct CompareOptions
 {
-	if (FileSize(f1) != FileSize(f2))
-		return false;
-
-	std::ifstream fileStream1;
-	std::ifstream fileStream2;
-	fileStream1.open(f1.absolutePath, std::ios::binary);
-	fileStream2.open(f2.absolutePath, std::ios::binary);
-
-	if (fileStream1.fail() || fileStream2.fail())
-		return false; //TODO.
-
-	const int kBufSize = 256;
-	char buf1[kBufSize];
-	char buf2[kBufSize];
-	while(!fileStream1.eof())
-	{
-		const unsigned int bytesRead1 = (unsigned int)fileStream1.read(buf1, kBufSize).gcount();
-		const unsigned int bytesRead2 = (unsigned int)fileStream2.read(buf2, kBufSize).gcount();
-		assert(bytesRead1 == bytesRead2);
-		if(memcmp(buf1, buf2, bytesRead1) != 0)
-		{
-			return false;
-		}
-	}
-
-	return true;
-}
-
-bool FileInfoSortFunc(const FileInfo& f1, const FileInfo& f2)
-{	
-	return f1.relativePath < f2.relativePath;
-}
-
-void SortFileList(not_null<std::vector<FileInfo>> files)
+	// Files at least this large are compared in ranges on the compare pool, 0 compares every
+	// file on the calling thread
+	int64_t largeFileThreshold = 64 * 1024 * 1024;
+
+	IoPolicy ioPolicy = kIoCached;
+
+	// Files that differ are compared again as text, ignoring line endings and whitespace at the
+	// end of lines. Only applies where both files are local.
+	bool normalizeText = false;
+
+	// Set from another thread to abandon compares in progress, which then report a difference
+	const std::atomic<bool>* cancel = nullptr;
+};
+
+inline bool IsDir(const FileInfo& f) { return f.isDir; }
+inline int DirLevel(const FileInfo& f) { return f.level; }
+inline int64_t FileSize(const FileInfo& f) { return (int64_t)f.status.st_size; }
+inline bool HasLocalFile(const FileInfo& f) { return !f.absolutePath.empty(); }
+inline bool IsSymlink(const FileInfo& f) { return S_ISLNK(f.status.st_mode); }
+
+// Where a symlink points, false for entries that only have a hash of it, like manifest entries
+bool GetLinkTarget(const FileInfo& f, not_null<std::string> outTarget);
+
+// Number of '/' separators in a relative path
+int GetPathDepth(const char* path, const size_t length);
+
+int64_t GetModificationTimeNs(const struct stat& status);
+// Unlike the mtime it cannot be set back, any write or attribute change moves it
+int64_t GetChangeTimeNs(const struct stat& status);
+void SetModificationTimeNs(const int64_t timeNs, not_null<struct stat> outStatus);
+
+// Uses the stored hash if there is one, otherwise reads the file
+bool GetContentHash(const FileInfo& f, not_null<uint64_t> outHash, const IoPolicy ioPolicy = kIoCached, const std::atomic<bool>* cancel = nullptr);
+
+// Lists the entries of a single directory, subdirectories are listed but not entered
+bool ScanDirectory(const std::string& baseDir, const std::string& relDir, const int dirLevel, const ScanOptions& options, not_null<std::vector<FileInfo>> outFiles);
+
+// The directories a scan entered, by device and inode. Followed symlinks can otherwise lead a
+// scan in circles, or list the same directory under every link to it. Scans enter directories
+// reached through a link only after all others and in path order, so which path lists a
+// directory does not depend on the order a parallel scan happens to take.
+class VisitedDirectories
 {
-	std::sort(files->begin(), files->end(), &FileInfoSortFunc);
-}
+public:
+	VisitedDirectories(const ScanOptions& options);
+	VisitedDirectories(const VisitedDirectories&) = delete;
+	VisitedDirectories& operator=(const VisitedDirectories&) = delete;
+
+	// False if the directory was entered before, always true unless symlinks are followed
+	bool Enter(const struct stat& status);
+	bool Enter(const FileInfo& dir);
+
+	// Marks the directory a scan starts in as entered
+	void EnterRoot(const std::string& path);
+
+	// Enters the directories reached through symlinks that a scan collected, in path order, and
+	// returns the ones that were not entered before. Clears linkedDirs.
+	void EnterLinked(not_null<std::vector<FileInfo>> linkedDirs, not_null<std::vector<FileInfo>> outEntered);
+
+private:
+	const bool m_Tracking;
+	std::mutex m_Mutex;
+	std::set<std::pair<dev_t, ino_t>> m_Entered;
+};
+
+bool ListFilesInDirRecursively(const std::string& baseDir, const std::string& relDir, const int dirLevel, const ScanOptions& options, not_null<std::vector<FileInfo>> outFiles);
+bool ListFilesInDirRecursively(const std::string& baseDir, const std::string& relDir, const int dirLevel, not_null<std::vector<FileInfo>> outFiles);
 
+class DeviceScheduler;
 
+// Scans directory trees in parallel on the scan pool, each device with its own concurrency
+// limit. Several trees can be scanned at once, their files are listed unsorted.
+class DirectoryScanner
+{
+public:
+	DirectoryScanner(const ScanOptions& options);
+	~DirectoryScanner();
+	DirectoryScanner(const DirectoryScanner&) = delete;
+	DirectoryScanner& operator=(const DirectoryScanner&) = delete;
+
+	// Starts scanning baseDir, outFiles must not be touched until Wait returns
+	bool Add(const std::string& baseDir, not_null<std::vector<FileInfo>> outFiles);
+
+	// Waits for all scans, false if any directory could not be read
+	bool Wait();
+
+private:
+	struct RootScan;
+	void ScanTask(RootScan& root, const std::string& relDir, const int dirLevel);
+
+	const ScanOptions& m_Options;
+	std::unique_ptr<DeviceScheduler> m_Scheduler;
+	std::vector<std::unique_ptr<RootScan>> m_Roots;
+	std::atomic<bool> m_Failed;
+};
 
+bool SameRelativeFile(const FileInfo& f1, const FileInfo f2);
+bool FileEquals(const FileInfo& f1, const FileInfo& f2);
 
+// Also reports the offset of the first differing byte when it is known, -1 otherwise
+bool FileEquals(const FileInfo& f1, const FileInfo& f2, const CompareOptions& options, not_null<int64_t> outFirstDiffOffset);
 
+bool FileInfoSortFunc(const FileInfo& f1, const FileInfo& f2);
+void SortFileList(not_null<std::vector<FileInfo>> files);
@@ -1,17 +1,36 @@
 #pragma once
 
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 #include <FL/Fl.h>
 #include <FL/Fl_Double_Window.h>
 #include <FL/Fl_Box.h>
+#include <FL/Fl_Button.h>
+#include <FL/Fl_Check_Button.h>
+#include <FL/Fl_Choice.h>
+#include <FL/Fl_Input.h>
 #include <FL/Fl_Tree.h>
 #include <FL/Fl_Scroll.h>
+#include <FL/Fl_Table_Row.h>
+#include <FL/Fl_Text_Buffer.h>
+#include <FL/Fl_Text_Display.h>
 #include <FL/Fl_Tile.h>
+#include <FL/fl_draw.h>
 
 #include "Common.h"
+#include "DiffIndex.h"
 #include "DirectoryDiff.h"
+#include "FileIO.h"
+#include "LineDiff.h"
+#include "Trace.h"
 
 namespace GUI
 {
@@ -20,6 +39,10 @@ namespace GUI
 	public:
 		using Fl_Tree_Item::Fl_Tree_Item;
 		const DiffEntry* diffEntry;
+		// The item of the same entry in the other tree
+		CustomTreeItem* otherItem;
+		// A directory with added, removed or modified entries somewhere below it
+		bool hasChanges;
 	};
 
 	class CustomTree : public Fl_Tree
@@ -29,7 +52,7 @@ namespace GUI
 		int GetTreeHeight()
 		{
 			int totalH = 0;
-			for (Fl_Tree_Item* i =first(); i; i = next(i))
+			for (Fl_Tree_Item* i = first_visible_item(); i; i = next_visible_item(i, FL_Down))
 			{
 				// What a mess
 				totalH += 19;
@@ -39,24 +62,378 @@ namespace GUI
 		}
 	};
 
+	Fl_Color GetStatusColor(const DiffStatus status)
+	{
+		switch (status)
+		{
+			case kDiffAdded: return FL_GREEN;
+			case kDiffRemoved: return FL_RED;
+			case kDiffModified: return FL_DARK_MAGENTA;
+			default: return FL_BLACK;
+		}
+	}
+
+	const int kChangesRowHeight = 19;
+
+	// Flat list of the entries passing the filter bar. Only the rows in view are ever drawn, so
+	// showing another filter result is just a new row count.
+	class ChangesTable : public Fl_Table_Row
+	{
+	public:
+		enum Column
+		{
+			kColumnStatus,
+			kColumnPath,
+			kColumnSize,
+			kColumnChange,
+			kColumnCount
+		};
+
+		ChangesTable(int x, int y, int w, int h)
+			: Fl_Table_Row(x, y, w, h)
+			, entries(nullptr)
+		{
+			cols(kColumnCount);
+			col_header(1);
+			col_resize(1);
+			type(SELECT_SINGLE);
+			end();
+		}
+
+		const std::vector<DiffEntry>* entries;
+		// Positions in entries, in the order shown
+		std::vector<uint32_t> shownRows;
+
+	protected:
+		void draw_cell(TableContext context, int R, int C, int X, int Y, int W, int H) override
+		{
+			static const char* const kHeaders[kColumnCount] = { "", "Path", "Size", "Changed" };
+
+			if (context == CONTEXT_STARTPAGE)
+			{
+				fl_font(FL_HELVETICA, 14);
+			}
+			else if (context == CONTEXT_COL_HEADER)
+			{
+				fl_push_clip(X, Y, W, H);
+				fl_draw_box(FL_THIN_UP_BOX, X, Y, W, H, col_header_color());
+				fl_color(FL_BLACK);
+				fl_draw(kHeaders[C], X + 4, Y, W - 8, H, FL_ALIGN_LEFT);
+				fl_pop_clip();
+			}
+			else if (context == CONTEXT_CELL && R < (int)shownRows.size())
+			{
+				const DiffEntry& entry = (*entries)[shownRows[R]];
+				const FileInfo& f = entry.leftFile ? *entry.leftFile : *entry.rightFile;
+				const DiffStatus status = GetDiffStatus(entry);
+
+				static const char* const kStatusLabels[kDiffStatusCount] = { "[+]", "[-]", "[M]", "[=]" };
+				char text[64] = "";
+				const char* label = text;
+				if (C == kColumnStatus)
+					label = kStatusLabels[status];
+				else if (C == kColumnPath)
+					label = f.relativePath.c_str();
+				else if (C == kColumnSize && !IsDir(f))
+					snprintf(text, sizeof(text), "%lld", (long long)FileSize(entry.rightFile ? *entry.rightFile : *entry.leftFile));
+				else if (C == kColumnChange && entry.changedBytes >= 0)
+					snprintf(text, sizeof(text), "%lld (%.1f%% similar)", (long long)entry.changedBytes, 100.0 * entry.similarity);
+
+				fl_push_clip(X, Y, W, H);
+				fl_color(row_selected(R) ? selection_color() : FL_WHITE);
+				fl_rectf(X, Y, W, H);
+				fl_color(GetStatusColor(status));
+				fl_draw(label, X + 4, Y, W - 8, H, (C >= kColumnSize) ? FL_ALIGN_RIGHT : FL_ALIGN_LEFT);
+				fl_pop_clip();
+			}
+		}
+	};
+
+	// Larger files are not previewed, their line diff would take too long
+	const int64_t kMaxPreviewSize = 32 * 1024 * 1024;
+	// Files are scanned in blocks of this size, so selecting another entry stops a preview early
+	const size_t kPreviewBlockSize = 1024 * 1024;
+	const size_t kPreviewContext = 3;
+	// Hunks are added to the pane in batches of about this many lines, more on request
+	const size_t kPreviewBatchLines = 2000;
+	const size_t kMaxPreviewLineLength = 4096;
+
+	// The line diff of the selected pair. The hunks are only turned into text as they are shown,
+	// read from the mappings of both files.
+	struct Preview
+	{
+		uint64_t generation = 0;
+		// Shown instead of hunks when the pair has none to show
+		std::string message;
+		MappedFile leftFile;
+		MappedFile rightFile;
+		TextLines leftLines;
+		TextLines rightLines;
+		std::vector<LineChange> changes;
+		std::vector<LineHunk> hunks;
+		size_t shownHunks = 0;
+	};
+
+	// Maps one side, a missing side is empty. False with a message when it cannot be previewed.
+	bool MapPreviewFile(const FileInfo* f, not_null<MappedFile> outFile, not_null<std::string> outMessage)
+	{
+		if (f == nullptr)
+			return true;
+		if (!HasLocalFile(*f))
+		{
+			*outMessage = "Only listed in a manifest or archive, there is nothing to preview.";
+			return false;
+		}
+		if (IsSymlink(*f))
+		{
+			*outMessage = "Symlinks are compared by where they point.";
+			return false;
+		}
+		if (FileSize(*f) > kMaxPreviewSize)
+		{
+			*outMessage = "Too large to preview, use the diff tool.";
+			return false;
+		}
+		if (!outFile->Open(f->absolutePath))
+		{
+			*outMessage = "Could not read '" + f->absolutePath + "'.";
+			return false;
+		}
+		return true;
+	}
+
+	// Looks for a NUL anywhere, not only early on as git does: Fl_Text_Buffer takes C strings and
+	// would cut the text short of its styles at the first one. False when cancelled.
+	bool FindNul(const MappedFile& file, const std::function<bool()>& cancelled, not_null<bool> outFound)
+	{
+		*outFound = false;
+		for (size_t offset = 0; offset < file.GetSize() && !*outFound; offset += kPreviewBlockSize)
+		{
+			if (cancelled())
+				return false;
+			*outFound = memchr(file.GetData() + offset, 0, std::min(kPreviewBlockSize, file.GetSize() - offset)) != nullptr;
+		}
+		return true;
+	}
+
+	void AppendSimilarity(const DiffEntry& entry, not_null<std::string> outMessage)
+	{
+		if (entry.similarity >= 0)
+		{
+			char text[64];
+			snprintf(text, sizeof(text), " %.1f%% similar.", 100.0 * entry.similarity);
+			*outMessage += text;
+		}
+	}
+
+	// False when cancelled before it was done
+	bool BuildPreview(const DiffEntry& entry, const std::function<bool()>& cancelled, not_null<Preview> preview)
+	{
+		if (IsDir(entry.leftFile ? *entry.leftFile : *entry.rightFile))
+		{
+			preview->message = "Directory.";
+			return true;
+		}
+		if (entry.leftFile && entry.rightFile && !entry.differs)
+		{
+			preview->message = "Files are identical.";
+			return true;
+		}
+
+		if (!MapPreviewFile(entry.leftFile, &preview->leftFile, &preview->message)
+			|| !MapPreviewFile(entry.rightFile, &preview->rightFile, &preview->message))
+		{
+			AppendSimilarity(entry, &preview->message);
+			return true;
+		}
+
+		bool leftBinary = false;
+		bool rightBinary = false;
+		if (!FindNul(preview->leftFile, cancelled, &leftBinary) || (!leftBinary && !FindNul(preview->rightFile, cancelled, &rightBinary)))
+			return false;
+		if (leftBinary || rightBinary)
+		{
+			preview->message = "Binary files differ.";
+			AppendSimilarity(entry, &preview->message);
+			return true;
+		}
+
+		if (!preview->leftLines.Split(preview->leftFile.GetData(), preview->leftFile.GetSize(), cancelled)
+			|| !preview->rightLines.Split(preview->rightFile.GetData(), preview->rightFile.GetSize(), cancelled))
+			return false;
+		if (!DiffLines(preview->leftLines, preview->rightLines, cancelled, &preview->changes))
+			return false;
+		GroupLineHunks(preview->changes, preview->leftLines.GetCount(), preview->rightLines.GetCount(), kPreviewContext, &preview->hunks);
+		if (preview->hunks.empty())
+			preview->message = "No line differences.";
+		return true;
+	}
+
+	void PreviewReady(void*);
+
+	// Builds previews on a thread of its own. Every request bumps the generation, which abandons
+	// the preview in progress, and only the latest one is handed to the GUI thread.
+	class PreviewWorker
+	{
+	public:
+		PreviewWorker()
+			: m_Entry(nullptr)
+			, m_Stop(false)
+			, m_Generation(0)
+			, m_Thread(&PreviewWorker::Run, this)
+		{
+		}
+
+		~PreviewWorker()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				m_Stop = true;
+				++m_Generation;
+			}
+			m_Wake.notify_one();
+			m_Thread.join();
+		}
+
+		PreviewWorker(const PreviewWorker&) = delete;
+		PreviewWorker& operator=(const PreviewWorker&) = delete;
+
+		void Request(const DiffEntry* entry)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				m_Entry = entry;
+				++m_Generation;
+			}
+			m_Wake.notify_one();
+		}
+
+		// The latest finished preview, null when it was taken or replaced by another request
+		std::unique_ptr<Preview> TakeFinished()
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			if (m_Finished && m_Finished->generation != m_Generation)
+				m_Finished.reset();
+			return std::move(m_Finished);
+		}
+
+	private:
+		void Run()
+		{
+			SetTraceThreadName("preview");
+			for (;;)
+			{
+				const DiffEntry* entry;
+				uint64_t generation;
+				{
+					std::unique_lock<std::mutex> lock(m_Mutex);
+					m_Wake.wait(lock, [this]() { return m_Stop || m_Entry != nullptr; });
+					if (m_Stop)
+						return;
+					entry = m_Entry;
+					m_Entry = nullptr;
+					generation = m_Generation;
+				}
+
+				std::unique_ptr<Preview> preview(new Preview());
+				preview->generation = generation;
+				if (!BuildPreview(*entry, [this, generation]() { return m_Generation != generation; }, preview.get()))
+					continue;
+
+				{
+					std::lock_guard<std::mutex> lock(m_Mutex);
+					if (generation != m_Generation)
+						continue;
+					m_Finished = std::move(preview);
+				}
+				Fl::awake(PreviewReady);
+			}
+		}
+
+		std::mutex m_Mutex;
+		std::condition_variable m_Wake;
+		const DiffEntry* m_Entry;
+		bool m_Stop;
+		std::atomic<uint64_t> m_Generation;
+		std::unique_ptr<Preview> m_Finished;
+		// Declared last so it starts once everything it uses is in place
+		std::thread m_Thread;
+	};
+
 	struct Widgets
 	{
 		Fl_Double_Window* window;
 		Fl_Scroll* scroll;
 		CustomTree* tree1;
 		CustomTree* tree2;
+
+		// Filter bar, which drives the changes list
+		Fl_Choice* view;
+		Fl_Check_Button* statuses[kDiffStatusCount];
+		Fl_Input* search;
+		Fl_Choice* order;
+		Fl_Box* count;
+		Fl_Button* collapse;
+		ChangesTable* changes;
+		DiffIndex* index;
+		bool reversedOrder;
+
+		// Preview pane below the trees and the list
+		Fl_Box* previewTitle;
+		Fl_Button* moreHunks;
+		Fl_Text_Display* previewDisplay;
+		Fl_Text_Buffer* previewText;
+		Fl_Text_Buffer* previewStyle;
+		PreviewWorker* previewWorker;
+		Preview* preview;
 	};
 
+	const int kFilterBarHeight = 30;
+
 	void UpdateSizes(Widgets& widgets)
 	{
+		// The preview pane takes the lower two fifths
+		const int windowW = widgets.window->w();
+		const int windowH = widgets.window->h();
+		const int mainH = (windowH - kFilterBarHeight) * 3 / 5;
+		widgets.scroll->resize(0, kFilterBarHeight, windowW, mainH);
+		const int previewY = kFilterBarHeight + mainH;
+		widgets.previewTitle->resize(4, previewY, windowW - 168, 24);
+		widgets.moreHunks->resize(windowW - 160, previewY + 1, 156, 22);
+		widgets.previewDisplay->resize(0, previewY + 24, windowW, windowH - previewY - 24);
+
 		int w = widgets.scroll->w();
 		int h = widgets.scroll->h();
+		int y = widgets.scroll->y();
 
 		int tree1H = widgets.tree1->GetTreeHeight();
-		widgets.tree1->resize(0, 0, w / 2, (int)fmax(tree1H, h));
+		widgets.tree1->resize(0, y, w / 2, (int)fmax(tree1H, h));
 
 		int tree2H = widgets.tree2->GetTreeHeight();
-		widgets.tree2->resize(w / 2, 0, w / 2, (int)fmax(tree2H, h));
+		widgets.tree2->resize(w / 2, y, w / 2, (int)fmax(tree2H, h));
+
+		// Only the search field and the path column grow with the window
+		int x = 4;
+		widgets.view->resize(x, 4, 100, 22);
+		x += 108;
+		for (Fl_Check_Button* button : widgets.statuses)
+		{
+			button->resize(x, 4, 90, 22);
+			x += 90;
+		}
+		const int searchX = x + 40;
+		const int searchW = (int)fmax(w - searchX - 40 - 100 - 140 - 150 - 20, 60);
+		widgets.search->resize(searchX, 4, searchW, 22);
+		widgets.order->resize(searchX + searchW + 40, 4, 100, 22);
+		widgets.collapse->resize(searchX + searchW + 148, 4, 140, 22);
+		widgets.count->resize(w - 154, 4, 150, 22);
+
+		widgets.changes->resize(0, y, w, h);
+		const int fixedW = 40 + 110 + 200 + 20;
+		widgets.changes->col_width(ChangesTable::kColumnStatus, 40);
+		widgets.changes->col_width(ChangesTable::kColumnPath, (int)fmax(w - fixedW, 200));
+		widgets.changes->col_width(ChangesTable::kColumnSize, 110);
+		widgets.changes->col_width(ChangesTable::kColumnChange, 200);
 	}
 
 	Widgets g_Widgets;
@@ -65,6 +442,10 @@ namespace GUI
 
 	void HandleDoubleClick()
 	{
+		// The changes list opens its own rows
+		if (!g_Widgets.scroll->visible())
+			return;
+
 		CustomTreeItem* item = (CustomTreeItem*)(g_Widgets.tree1->first_selected_item());
 		if (item)
 		{
@@ -96,14 +477,13 @@ namespace GUI
 
 	};
 
+	// Only the rows in view are striped, collapsed subtrees are restriped when opened
 	void StripifyTreeBackground()
 	{
 		Widgets& widgets = g_Widgets;
 		int count = 0;
-		for (Fl_Tree_Item* i = widgets.tree1->first(); i; i = widgets.tree1->next(i))
+		for (Fl_Tree_Item* i = widgets.tree1->first_visible_item(); i; i = widgets.tree1->next_visible_item(i, FL_Down))
 		{
-			if (!widgets.tree1->is_open(i))
-				continue;
 			if (count % 2 == 0)
 				i->labelbgcolor(FL_LIGHT3);
 			else
@@ -111,10 +491,8 @@ namespace GUI
 			count++;
 		}
 		count = 0;
-		for (Fl_Tree_Item* i = widgets.tree2->first(); i; i = widgets.tree2->next(i))
+		for (Fl_Tree_Item* i = widgets.tree2->first_visible_item(); i; i = widgets.tree2->next_visible_item(i, FL_Down))
 		{
-			if (!widgets.tree2->is_open(i))
-				continue;
 			if (count % 2 == 0)
 				i->labelbgcolor(FL_LIGHT3);
 			else
@@ -123,28 +501,114 @@ namespace GUI
 		}
 	}
 
+	// Adds the next batch of hunks to the preview pane
+	void ShowMoreHunks()
+	{
+		Widgets& widgets = g_Widgets;
+		Preview& preview = *widgets.preview;
+
+		std::string text;
+		std::string style;
+		size_t lineCount = 0;
+		// Styles: A unchanged, B added, C removed, D hunk header
+		auto addLine = [&](const char marker, const TextLines& lines, const size_t line, const char styleChar)
+		{
+			const size_t length = std::min(lines.GetLength(line), kMaxPreviewLineLength);
+			text += marker;
+			text.append(lines.GetLine(line), length);
+			text += '\n';
+			style.append(length + 2, styleChar);
+			++lineCount;
+		};
+
+		for (; preview.shownHunks < preview.hunks.size() && lineCount < kPreviewBatchLines; ++preview.shownHunks)
+		{
+			const LineHunk& hunk = preview.hunks[preview.shownHunks];
+			char header[128];
+			const int headerLength = snprintf(header, sizeof(header), "@@ -%lu,%lu +%lu,%lu @@\n",
+				(unsigned long)hunk.leftStart + 1, (unsigned long)hunk.leftCount, (unsigned long)hunk.rightStart + 1, (unsigned long)hunk.rightCount);
+			text += header;
+			style.append(headerLength, 'D');
+
+			size_t left = hunk.leftStart;
+			for (size_t i = hunk.firstChange; i < hunk.firstChange + hunk.changeCount; ++i)
+			{
+				const LineChange& change = preview.changes[i];
+				for (; left < change.leftStart; ++left)
+					addLine(' ', preview.leftLines, left, 'A');
+				for (size_t line = change.leftStart; line < change.leftStart + change.leftCount; ++line)
+					addLine('-', preview.leftLines, line, 'C');
+				for (size_t line = change.rightStart; line < change.rightStart + change.rightCount; ++line)
+					addLine('+', preview.rightLines, line, 'B');
+				left = change.leftStart + change.leftCount;
+			}
+			for (; left < hunk.leftStart + hunk.leftCount; ++left)
+				addLine(' ', preview.leftLines, left, 'A');
+		}
+
+		widgets.previewText->append(text.c_str());
+		widgets.previewStyle->append(style.c_str());
+
+		const size_t hunksLeft = preview.hunks.size() - preview.shownHunks;
+		char label[64];
+		snprintf(label, sizeof(label), "More hunks (%lu left)", (unsigned long)hunksLeft);
+		widgets.moreHunks->copy_label(hunksLeft > 0 ? label : "More hunks");
+		if (hunksLeft > 0)
+			widgets.moreHunks->activate();
+		else
+			widgets.moreHunks->deactivate();
+	}
+
+	void MoreHunksCallback(Fl_Widget*, void*)
+	{
+		if (g_Widgets.preview)
+			ShowMoreHunks();
+	}
+
+	// Runs on the GUI thread once the worker finished a preview
+	void PreviewReady(void*)
+	{
+		Widgets& widgets = g_Widgets;
+		std::unique_ptr<Preview> preview = widgets.previewWorker->TakeFinished();
+		if (!preview)
+			return;
+
+		delete widgets.preview;
+		widgets.preview = preview.release();
+		widgets.previewText->text("");
+		widgets.previewStyle->text("");
+		widgets.moreHunks->deactivate();
+		if (widgets.preview->message.empty())
+		{
+			ShowMoreHunks();
+		}
+		else
+		{
+			widgets.previewText->text(widgets.preview->message.c_str());
+			widgets.previewStyle->text(std::string(widgets.preview->message.size(), 'A').c_str());
+		}
+		widgets.previewDisplay->redraw();
+	}
+
+	void RequestPreview(const DiffEntry* entry)
+	{
+		Widgets& widgets = g_Widgets;
+		const FileInfo& f = entry->leftFile ? *entry->leftFile : *entry->rightFile;
+		widgets.previewTitle->copy_label(f.relativePath.c_str());
+		widgets.previewWorker->Request(entry);
+	}
+
 	void TreeCallback(Fl_Widget *w, void *userdata)
 	{
 		Fl_Tree* tree = (Fl_Tree*)w;
 		Fl_Tree* other = tree == g_Widgets.tree1 ? g_Widgets.tree2 : g_Widgets.tree1;
 
-		CustomTreeItem* item = (CustomTreeItem*)(tree->callback_item());
-		assert(item);
+		CustomTreeItem* item = dynamic_cast<CustomTreeItem*>(tree->callback_item());
 		if (!item)
 			return;
 
-		const DiffEntry* entry = item->diffEntry;
-		assert(entry);
-
-		// Find the entry from the other tree
-		CustomTreeItem* otherItem = nullptr;
-		for (Fl_Tree_Item* i = other->first(); i; i = other->next(i))
-		{
-			CustomTreeItem* o = (CustomTreeItem*)(i);
-			assert(o);
-			if (o->diffEntry == entry)
-				otherItem = o;
-		}
+		CustomTreeItem* otherItem = item->otherItem;
+		assert(otherItem);
 
 		switch (tree->callback_reason()) 
 		{
@@ -156,16 +620,19 @@ namespace GUI
 			case FL_TREE_REASON_SELECTED: 
 			{
 				other->select(otherItem, 0);
+				RequestPreview(item->diffEntry);
 				break;
 			}
 		    case FL_TREE_REASON_OPENED:
 			{
 				other->open(otherItem, 0);
+				UpdateSizes(g_Widgets);
 				break;
 			}
 		    case FL_TREE_REASON_CLOSED:
 			{
 				other->close(otherItem, 0);
+				UpdateSizes(g_Widgets);
 				break;
 			}
 			default: break;
@@ -174,6 +641,224 @@ namespace GUI
 		StripifyTreeBackground();
 	}
 
+	void ApplyFilter()
+	{
+		Widgets& widgets = g_Widgets;
+		DiffFilter filter;
+		filter.statuses = 0;
+		for (int status = 0; status < kDiffStatusCount; ++status)
+		{
+			if (widgets.statuses[status]->value())
+				filter.statuses |= 1u << status;
+		}
+		filter.nameSearch = widgets.search->value();
+		filter.order = (DiffOrder)widgets.order->value();
+		filter.reversed = widgets.reversedOrder;
+
+		ChangesTable* table = widgets.changes;
+		widgets.index->Filter(filter, &table->shownRows);
+		table->select_all_rows(0);
+		table->rows((int)table->shownRows.size());
+		// Rows added to a table take the height of its last row, or FLTK's default without one
+		table->row_height_all(kChangesRowHeight);
+		table->row_position(0);
+		table->redraw();
+
+		char text[64];
+		snprintf(text, sizeof(text), "%lu of %lu entries", (unsigned long)table->shownRows.size(), (unsigned long)table->entries->size());
+		widgets.count->copy_label(text);
+	}
+
+	void ShowView()
+	{
+		Widgets& widgets = g_Widgets;
+		if (widgets.view->value() == 1)
+		{
+			widgets.scroll->hide();
+			widgets.changes->show();
+		}
+		else
+		{
+			widgets.changes->hide();
+			widgets.scroll->show();
+		}
+	}
+
+	void ViewCallback(Fl_Widget*, void*)
+	{
+		ShowView();
+	}
+
+	// Editing the filter bar shows the list it filters
+	void FilterCallback(Fl_Widget* w, void*)
+	{
+		Widgets& widgets = g_Widgets;
+		if (w == widgets.order)
+			widgets.reversedOrder = false;
+		ApplyFilter();
+		if (widgets.view->value() != 1)
+		{
+			widgets.view->value(1);
+			ShowView();
+		}
+	}
+
+	// Clicking a column header sorts by it, clicking it again reverses the order
+	void ChangesCallback(Fl_Widget*, void*)
+	{
+		Widgets& widgets = g_Widgets;
+		ChangesTable* table = widgets.changes;
+		if (Fl::event() != FL_RELEASE)
+			return;
+
+		if (table->callback_context() == Fl_Table::CONTEXT_COL_HEADER)
+		{
+			static const int kColumnOrders[ChangesTable::kColumnCount] = { -1, kOrderByPath, kOrderBySize, kOrderByChange };
+			const int order = kColumnOrders[table->callback_col()];
+			if (order < 0)
+				return;
+			widgets.reversedOrder = (widgets.order->value() == order && !widgets.reversedOrder);
+			widgets.order->value(order);
+			ApplyFilter();
+		}
+		else if (table->callback_context() == Fl_Table::CONTEXT_CELL)
+		{
+			// A click previews the row, a double click opens the diff tool
+			const int row = table->callback_row();
+			if (row < 0 || row >= (int)table->shownRows.size())
+				return;
+			const DiffEntry& entry = (*table->entries)[table->shownRows[row]];
+			if (Fl::event_clicks() > 0)
+				g_diffCallback(entry);
+			else
+				RequestPreview(&entry);
+		}
+	}
+
+	// Leaves only the paths to changes open
+	void CollapseUnchanged()
+	{
+		Widgets& widgets = g_Widgets;
+		for (Fl_Tree_Item* i = widgets.tree1->first(); i; i = widgets.tree1->next(i))
+		{
+			// The root and parents the tree added on its own have no entry
+			CustomTreeItem* item = dynamic_cast<CustomTreeItem*>(i);
+			if (item && IsDir(item->diffEntry->leftFile ? *item->diffEntry->leftFile : *item->diffEntry->rightFile) && !item->hasChanges)
+			{
+				widgets.tree1->close(item, 0);
+				widgets.tree2->close(item->otherItem, 0);
+			}
+		}
+		StripifyTreeBackground();
+		UpdateSizes(widgets);
+		widgets.window->redraw();
+	}
+
+	void CollapseCallback(Fl_Widget*, void*)
+	{
+		CollapseUnchanged();
+	}
+
+	void InitFilterBar(const DirectoryDiffState& diffState)
+	{
+		Widgets& widgets = g_Widgets;
+
+		widgets.view = new Fl_Choice(0, 0, 10, 10);
+		widgets.view->add("Tree");
+		widgets.view->add("Changes");
+		widgets.view->value(0);
+		widgets.view->callback(ViewCallback);
+
+		// The changes list starts out without the identical entries
+		static const char* const kStatusNames[kDiffStatusCount] = { "Added", "Removed", "Modified", "Identical" };
+		for (int status = 0; status < kDiffStatusCount; ++status)
+		{
+			widgets.statuses[status] = new Fl_Check_Button(0, 0, 10, 10, kStatusNames[status]);
+			widgets.statuses[status]->labelcolor(GetStatusColor((DiffStatus)status));
+			widgets.statuses[status]->value(status != kDiffIdentical);
+			widgets.statuses[status]->callback(FilterCallback);
+		}
+
+		widgets.search = new Fl_Input(0, 0, 10, 10, "Find");
+		widgets.search->when(FL_WHEN_CHANGED);
+		widgets.search->callback(FilterCallback);
+
+		widgets.order = new Fl_Choice(0, 0, 10, 10, "Sort");
+		widgets.order->add("Path");
+		widgets.order->add("Size");
+		widgets.order->add("Changed");
+		widgets.order->value(kOrderByPath);
+		widgets.order->callback(FilterCallback);
+
+		widgets.collapse = new Fl_Button(0, 0, 10, 10, "Collapse unchanged");
+		widgets.collapse->callback(CollapseCallback);
+
+		widgets.count = new Fl_Box(0, 0, 10, 10);
+		widgets.count->align(FL_ALIGN_RIGHT | FL_ALIGN_INSIDE);
+
+		widgets.index = new DiffIndex(diffState.sortedEntries);
+	}
+
+	std::string FormatBytes(const int64_t bytes)
+	{
+		static const char* const kUnits[] = { "B", "KB", "MB", "GB", "TB" };
+		double value = (double)bytes;
+		int unit = 0;
+		for (; value >= 1024 && unit < 4; ++unit)
+			value /= 1024;
+		char text[32];
+		snprintf(text, sizeof(text), (unit == 0) ? "%.0f %s" : "%.1f %s", value, kUnits[unit]);
+		return text;
+	}
+
+	// A directory name followed by the changes below it, like "src  (+2 -1 M4, 1.5 MB)"
+	std::string GetDirectoryLabel(const std::string& name, const DirectoryRollup& rollup)
+	{
+		if (!rollup.HasChanges())
+			return name;
+
+		std::string label = name + "  (";
+		static const char* const kPrefixes[] = { "+", "-", "M" };
+		for (int status = kDiffAdded; status <= kDiffModified; ++status)
+		{
+			if (rollup.counts[status] == 0)
+				continue;
+			if (label.back() != '(')
+				label += " ";
+			label += kPrefixes[status] + std::to_string(rollup.counts[status]);
+		}
+		return label + ", " + FormatBytes(rollup.changedBytes) + ")";
+	}
+
+	void InitPreviewPane()
+	{
+		static const Fl_Text_Display::Style_Table_Entry kPreviewStyles[] =
+		{
+			{ FL_BLACK, FL_COURIER, 12 },
+			{ FL_DARK_GREEN, FL_COURIER, 12 },
+			{ FL_DARK_RED, FL_COURIER, 12 },
+			{ FL_BLUE, FL_COURIER, 12 },
+		};
+
+		Widgets& widgets = g_Widgets;
+		widgets.previewTitle = new Fl_Box(0, 0, 10, 10, "Select a file to preview its changes, double click it for the diff tool.");
+		widgets.previewTitle->align(FL_ALIGN_LEFT | FL_ALIGN_INSIDE | FL_ALIGN_CLIP);
+
+		widgets.moreHunks = new Fl_Button(0, 0, 10, 10, "More hunks");
+		widgets.moreHunks->callback(MoreHunksCallback);
+		widgets.moreHunks->deactivate();
+
+		widgets.previewText = new Fl_Text_Buffer();
+		widgets.previewStyle = new Fl_Text_Buffer();
+		widgets.previewDisplay = new Fl_Text_Display(0, 0, 10, 10);
+		widgets.previewDisplay->buffer(widgets.previewText);
+		widgets.previewDisplay->textfont(FL_COURIER);
+		widgets.previewDisplay->textsize(12);
+		widgets.previewDisplay->highlight_data(widgets.previewStyle, kPreviewStyles, sizeof(kPreviewStyles) / sizeof(kPreviewStyles[0]), 'A', nullptr, nullptr);
+
+		widgets.previewWorker = new PreviewWorker();
+	}
+
 	void InitWindow(int windowWidth, int windowHeight, const DirectoryDiffState& diffState, DiffCallback diffCallback)
 	{
 		g_diffCallback = diffCallback;
@@ -182,7 +867,9 @@ namespace GUI
 		memset(&widgets, 0, sizeof(widgets));
 		widgets.window = new CustomWindow(windowWidth, windowHeight);
 
-		widgets.scroll = new Fl_Scroll(0, 0, windowWidth, windowHeight);
+		InitFilterBar(diffState);
+
+		widgets.scroll = new Fl_Scroll(0, kFilterBarHeight, windowWidth, windowHeight - kFilterBarHeight);
 		widgets.scroll->type(Fl_Scroll::VERTICAL);
 
 		widgets.tree1 = new CustomTree(0,0,10,10);
@@ -201,6 +888,10 @@ namespace GUI
 		widgets.tree2->item_labelfgcolor(FL_BLACK);
 		widgets.tree2->connectorstyle(FL_TREE_CONNECTOR_DOTTED);
 
+		std::vector<DirectoryRollup> rollups;
+		ComputeDirectoryRollups(diffState.sortedEntries, &rollups);
+		std::vector<std::pair<CustomTreeItem*, CustomTreeItem*>> directoryItems;
+
 		for (const DiffEntry& entry : diffState.sortedEntries)
 		{
 			CustomTreeItem* leftItem = nullptr;
@@ -241,6 +932,33 @@ namespace GUI
 				rightItem->labelcolor(FL_LIGHT2);
 				widgets.tree2->add(entry.leftFile->relativePath.c_str(), rightItem);	
 			}
+
+			leftItem->otherItem = rightItem;
+			rightItem->otherItem = leftItem;
+
+			// Directories show what changed below them, and start closed when nothing did
+			const DirectoryRollup& rollup = rollups[&entry - diffState.sortedEntries.data()];
+			leftItem->hasChanges = rollup.HasChanges();
+			rightItem->hasChanges = rollup.HasChanges();
+			if (IsDir(entry.leftFile ? *entry.leftFile : *entry.rightFile))
+			{
+				directoryItems.emplace_back(leftItem, rightItem);
+				if (!rollup.HasChanges())
+				{
+					widgets.tree1->close(leftItem, 0);
+					widgets.tree2->close(rightItem, 0);
+				}
+			}
+		}
+
+		// Fl_Tree::add finds the parents of a path by their labels, so directories only get their
+		// rollups once every entry was added
+		for (const auto& items : directoryItems)
+		{
+			const DiffEntry& entry = *items.first->diffEntry;
+			const DirectoryRollup& rollup = rollups[&entry - diffState.sortedEntries.data()];
+			items.first->label(GetDirectoryLabel(entry.leftFile ? entry.leftFile->name : entry.rightFile->name, rollup).c_str());
+			items.second->label(GetDirectoryLabel(entry.rightFile ? entry.rightFile->name : entry.leftFile->name, rollup).c_str());
 		}
 		
 		// Set tree striped backgrounds
@@ -248,21 +966,38 @@ namespace GUI
 
 		widgets.scroll->end();
 
+		widgets.changes = new ChangesTable(0, kFilterBarHeight, windowWidth, windowHeight - kFilterBarHeight);
+		widgets.changes->entries = &diffState.sortedEntries;
+		widgets.changes->callback(ChangesCallback);
+		widgets.changes->hide();
+		ApplyFilter();
+
+		InitPreviewPane();
+
 		widgets.window->end();
 		widgets.window->resizable(widgets.scroll);
+		UpdateSizes(widgets);
 	}
 
 	void CleanUp()
 	{
 		Widgets& widgets = g_Widgets;
+		// The worker goes first, it may still be reading entries
+		delete widgets.previewWorker;
 		if (widgets.window)
 			delete widgets.window;
+		delete widgets.preview;
+		delete widgets.previewText;
+		delete widgets.previewStyle;
+		delete widgets.index;
 		
 		memset(&widgets, 0, sizeof(Widgets));
 	}
 
 	int Run()
 	{
+		// Lets the preview worker wake the GUI thread with Fl::awake
+		Fl::lock();
 		g_Widgets.window->show();
 		Fl::run();
 		return EX_OK;
@@ -0,0 +1,142 @@
+#include "Hash.h"
+
+#include <cstring>
+
+namespace
+{
+	const uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+	const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+	const uint64_t kPrime3 = 0x165667B19E3779F9ull;
+	const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+	const uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+	inline uint64_t RotateLeft(const uint64_t x, const int r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+	// Lanes are little-endian on every host, compilers turn these into plain loads on x86 and ARM
+	inline uint32_t Read32(const unsigned char* p)
+	{
+		return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+	inline uint64_t Read64(const unsigned char* p)
+	{
+		return (uint64_t)Read32(p) | ((uint64_t)Read32(p + 4) << 32);
+	}
+
+	inline uint64_t Round(uint64_t acc, const uint64_t input)
+	{
+		acc += input * kPrime2;
+		acc = RotateLeft(acc, 31);
+		return acc * kPrime1;
+	}
+
+	inline uint64_t MergeRound(uint64_t acc, const uint64_t value)
+	{
+		acc ^= Round(0, value);
+		return acc * kPrime1 + kPrime4;
+	}
+}
+
+ContentHasher::ContentHasher(const uint64_t seed)
+	: m_TotalSize(0)
+	, m_Seed(seed)
+	, m_BufferSize(0)
+{
+	m_Acc[0] = seed + kPrime1 + kPrime2;
+	m_Acc[1] = seed + kPrime2;
+	m_Acc[2] = seed;
+	m_Acc[3] = seed - kPrime1;
+}
+
+void ContentHasher::Update(const void* data, size_t size)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	m_TotalSize += size;
+
+	if (m_BufferSize + size < 32)
+	{
+		memcpy(m_Buffer + m_BufferSize, p, size);
+		m_BufferSize += size;
+		return;
+	}
+
+	if (m_BufferSize > 0)
+	{
+		const size_t fill = 32 - m_BufferSize;
+		memcpy(m_Buffer + m_BufferSize, p, fill);
+		for (int i = 0; i < 4; ++i)
+			m_Acc[i] = Round(m_Acc[i], Read64(m_Buffer + i * 8));
+		p += fill;
+		size -= fill;
+		m_BufferSize = 0;
+	}
+
+	while (size >= 32)
+	{
+		for (int i = 0; i < 4; ++i)
+			m_Acc[i] = Round(m_Acc[i], Read64(p + i * 8));
+		p += 32;
+		size -= 32;
+	}
+
+	memcpy(m_Buffer, p, size);
+	m_BufferSize = size;
+}
+
+uint64_t ContentHasher::Digest() const
+{
+	uint64_t h;
+	if (m_TotalSize >= 32)
+	{
+		h = RotateLeft(m_Acc[0], 1) + RotateLeft(m_Acc[1], 7) + RotateLeft(m_Acc[2], 12) + RotateLeft(m_Acc[3], 18);
+		for (int i = 0; i < 4; ++i)
+			h = MergeRound(h, m_Acc[i]);
+	}
+	else
+	{
+		h = m_Seed + kPrime5;
+	}
+
+	h += m_TotalSize;
+
+	const unsigned char* p = m_Buffer;
+	size_t remaining = m_BufferSize;
+	while (remaining >= 8)
+	{
+		h ^= Round(0, Read64(p));
+		h = RotateLeft(h, 27) * kPrime1 + kPrime4;
+		p += 8;
+		remaining -= 8;
+	}
+	if (remaining >= 4)
+	{
+		h ^= (uint64_t)Read32(p) * kPrime1;
+		h = RotateLeft(h, 23) * kPrime2 + kPrime3;
+		p += 4;
+		remaining -= 4;
+	}
+	while (remaining > 0)
+	{
+		h ^= (*p) * kPrime5;
+		h = RotateLeft(h, 11) * kPrime1;
+		++p;
+		--remaining;
+	}
+
+	h ^= h >> 33;
+	h *= kPrime2;
+	h ^= h >> 29;
+	h *= kPrime3;
+	h ^= h >> 32;
+	return h;
+}
+
+uint64_t HashBytes(const void* data, const size_t size, const uint64_t seed)
+{
+	ContentHasher hasher(seed);
+	hasher.Update(data, size);
+	return hasher.Digest();
+}
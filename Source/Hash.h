@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// XXH64, used for manifest content hashes. Results are stable across platforms and versions.
+class ContentHasher
+{
+public:
+	ContentHasher(const uint64_t seed = 0);
+
+	void Update(const void* data, size_t size);
+	uint64_t Digest() const;
+
+private:
+	uint64_t m_Acc[4];
+	uint64_t m_TotalSize;
+	uint64_t m_Seed;
+	unsigned char m_Buffer[32];
+	size_t m_BufferSize;
+};
+
+uint64_t HashBytes(const void* data, const size_t size, const uint64_t seed = 0);
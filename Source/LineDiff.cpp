@@ -0,0 +1,188 @@
+#include "LineDiff.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Hash.h"
+#include "Trace.h"
+
+namespace
+{
+	// Bounds the snapshots kept to walk the edit script back, which grow with its cost squared
+	const int kMaxEditCost = 2048;
+
+	const size_t kSplitCancelInterval = 1024 * 1024;
+}
+
+TextLines::TextLines()
+	: m_Data(nullptr)
+{
+}
+
+bool TextLines::Split(const char* data, const size_t size, const std::function<bool()>& cancelled)
+{
+	m_Data = data;
+	m_Starts.clear();
+	m_Hashes.clear();
+
+	m_Starts.push_back(0);
+	size_t nextCancelCheck = kSplitCancelInterval;
+	for (size_t start = 0; start < size; )
+	{
+		if (start >= nextCancelCheck)
+		{
+			if (cancelled && cancelled())
+				return false;
+			nextCancelCheck = start + kSplitCancelInterval;
+		}
+
+		const char* lineFeed = (const char*)memchr(data + start, '\n', size - start);
+		// A last line without a line feed ends as if it had one
+		const size_t end = lineFeed ? (size_t)(lineFeed - data) : size;
+		m_Hashes.push_back(HashBytes(data + start, end - start));
+		m_Starts.push_back(end + 1);
+		start = end + 1;
+	}
+	return true;
+}
+
+bool TextLines::Equals(const size_t line, const TextLines& other, const size_t otherLine) const
+{
+	return m_Hashes[line] == other.m_Hashes[otherLine]
+		&& GetLength(line) == other.GetLength(otherLine)
+		&& memcmp(GetLine(line), other.GetLine(otherLine), GetLength(line)) == 0;
+}
+
+bool DiffLines(const TextLines& left, const TextLines& right, const std::function<bool()>& cancelled, not_null<std::vector<LineChange>> outChanges)
+{
+	TraceScope trace("DiffLines", nullptr, (int64_t)(left.GetCount() + right.GetCount()));
+	outChanges->clear();
+
+	size_t prefix = 0;
+	while (prefix < left.GetCount() && prefix < right.GetCount() && left.Equals(prefix, right, prefix))
+		++prefix;
+	size_t suffix = 0;
+	while (suffix < left.GetCount() - prefix && suffix < right.GetCount() - prefix
+		&& left.Equals(left.GetCount() - 1 - suffix, right, right.GetCount() - 1 - suffix))
+		++suffix;
+
+	const int n = (int)(left.GetCount() - prefix - suffix);
+	const int m = (int)(right.GetCount() - prefix - suffix);
+	if (n == 0 && m == 0)
+		return true;
+	const LineChange wholeMiddle = { prefix, (size_t)n, prefix, (size_t)m };
+	if (n == 0 || m == 0)
+	{
+		outChanges->push_back(wholeMiddle);
+		return true;
+	}
+
+	// Furthest x reached on each diagonal k = x - y. After every round the diagonals it reached,
+	// -d to d, are appended to the snapshots, so round d starts at d * d.
+	const int maxCost = std::min(n + m, kMaxEditCost);
+	const int offset = maxCost + 1;
+	std::vector<int> furthest(2 * maxCost + 3, 0);
+	std::vector<int> snapshots;
+	int cost = -1;
+	for (int d = 0; d <= maxCost && cost < 0; ++d)
+	{
+		if (cancelled && cancelled())
+			return false;
+
+		for (int k = -d; k <= d; k += 2)
+		{
+			int x = (k == -d || (k != d && furthest[offset + k - 1] < furthest[offset + k + 1])) ? furthest[offset + k + 1] : furthest[offset + k - 1] + 1;
+			int y = x - k;
+			while (x < n && y < m && left.Equals(prefix + x, right, prefix + y))
+			{
+				++x;
+				++y;
+			}
+			furthest[offset + k] = x;
+			if (x >= n && y >= m)
+				cost = d;
+		}
+		snapshots.insert(snapshots.end(), furthest.begin() + offset - d, furthest.begin() + offset + d + 1);
+	}
+
+	if (cost < 0)
+	{
+		LogLine(kDebug, "Line diff costs more than %d lines, showing it as one change.", kMaxEditCost);
+		outChanges->push_back(wholeMiddle);
+		return true;
+	}
+
+	// Back from the end, each round took one step right, deleting a left line, or down,
+	// inserting a right one, before following the equal lines along its diagonal
+	std::vector<char> leftChanged(n, 0);
+	std::vector<char> rightChanged(m, 0);
+	int x = n;
+	int y = m;
+	for (int d = cost; d > 0; --d)
+	{
+		const int k = x - y;
+		const int* previous = snapshots.data() + (d - 1) * (d - 1) + (d - 1);
+		const bool down = (k == -d || (k != d && previous[k - 1] < previous[k + 1]));
+		const int previousK = down ? k + 1 : k - 1;
+		const int previousX = previous[previousK];
+		const int previousY = previousX - previousK;
+		if (down)
+			rightChanged[previousY] = 1;
+		else
+			leftChanged[previousX] = 1;
+		x = previousX;
+		y = previousY;
+	}
+
+	for (int i = 0, j = 0; i < n || j < m; )
+	{
+		if (i < n && j < m && !leftChanged[i] && !rightChanged[j])
+		{
+			++i;
+			++j;
+			continue;
+		}
+
+		LineChange change = { prefix + i, 0, prefix + j, 0 };
+		for (; i < n && leftChanged[i]; ++i)
+			++change.leftCount;
+		for (; j < m && rightChanged[j]; ++j)
+			++change.rightCount;
+		if (change.leftCount == 0 && change.rightCount == 0)
+			break;
+		outChanges->push_back(change);
+	}
+	return true;
+}
+
+void GroupLineHunks(const std::vector<LineChange>& changes, const size_t leftCount, const size_t rightCount, const size_t context, not_null<std::vector<LineHunk>> outHunks)
+{
+	outHunks->clear();
+	for (size_t first = 0; first < changes.size(); )
+	{
+		// Unchanged lines come in equal numbers on both sides
+		const LineChange& firstChange = changes[first];
+		const size_t before = std::min(context, std::min(firstChange.leftStart, firstChange.rightStart));
+
+		size_t last = first;
+		while (last + 1 < changes.size()
+			&& changes[last + 1].leftStart - (changes[last].leftStart + changes[last].leftCount) <= 2 * context)
+			++last;
+
+		const LineChange& lastChange = changes[last];
+		const size_t leftEnd = lastChange.leftStart + lastChange.leftCount;
+		const size_t rightEnd = lastChange.rightStart + lastChange.rightCount;
+		const size_t after = std::min(context, std::min(leftCount - leftEnd, rightCount - rightEnd));
+
+		LineHunk hunk;
+		hunk.leftStart = firstChange.leftStart - before;
+		hunk.leftCount = leftEnd + after - hunk.leftStart;
+		hunk.rightStart = firstChange.rightStart - before;
+		hunk.rightCount = rightEnd + after - hunk.rightStart;
+		hunk.firstChange = first;
+		hunk.changeCount = last + 1 - first;
+		outHunks->push_back(hunk);
+
+		first = last + 1;
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "Common.h"
+
+// Line diffs of two texts held in memory or mapped, for previews of modified files
+
+// Where the lines of a text start, and a hash of each to compare them by
+class TextLines
+{
+public:
+	TextLines();
+
+	// The text must stay in place while the lines are used. A line feed at the very end does
+	// not start another line. False when cancelled returned true, which is asked every megabyte.
+	bool Split(const char* data, const size_t size, const std::function<bool()>& cancelled);
+
+	size_t GetCount() const { return m_Hashes.size(); }
+	const char* GetLine(const size_t line) const { return m_Data + m_Starts[line]; }
+	// Without the line feed
+	size_t GetLength(const size_t line) const { return m_Starts[line + 1] - m_Starts[line] - 1; }
+
+	bool Equals(const size_t line, const TextLines& other, const size_t otherLine) const;
+
+private:
+	const char* m_Data;
+	// One past the end of each line is the start of the next, the last one ending in a
+	// line feed or not
+	std::vector<uint64_t> m_Starts;
+	std::vector<uint64_t> m_Hashes;
+};
+
+// Lines of the left text replaced by lines of the right one, either count may be 0
+struct LineChange
+{
+	size_t leftStart;
+	size_t leftCount;
+	size_t rightStart;
+	size_t rightCount;
+};
+
+// Changes with the unchanged lines around them, as unified diffs show them
+struct LineHunk
+{
+	size_t leftStart;
+	size_t leftCount;
+	size_t rightStart;
+	size_t rightCount;
+	size_t firstChange;
+	size_t changeCount;
+};
+
+// Myers' O(ND) diff after the lines both texts start and end with are taken off. Differences
+// costing more than a few thousand inserted and deleted lines are reported as one change of the
+// whole middle instead. False when cancelled returned true, which is asked every so often.
+bool DiffLines(const TextLines& left, const TextLines& right, const std::function<bool()>& cancelled, not_null<std::vector<LineChange>> outChanges);
+
+// Groups changes that are at most 2 * context lines apart
+void GroupLineHunks(const std::vector<LineChange>& changes, const size_t leftCount, const size_t rightCount, const size_t context, not_null<std::vector<LineHunk>> outHunks);
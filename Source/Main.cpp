@@ -12,9 +12,24 @@
 #include <thread>
 
 #include "Common.h"
+#include "Stats.h"
+#include "Trace.h"
 #include "FileUtils.h"
 #include "DirectoryDiff.h"
+#include "Archive.h"
+#include "Daemon.h"
+#include "Manifest.h"
+#include "PathFilter.h"
+#include "Session.h"
+
+// The folder compare view is optional, headless builds define DWRAP_WITH_GUI=0
+#ifndef DWRAP_WITH_GUI
+#define DWRAP_WITH_GUI 1
+#endif
+
+#if DWRAP_WITH_GUI
 #include "GUI.h"
+#endif
 
 struct RunParams
 {
@@ -22,8 +37,27 @@ struct RunParams
 	std::vector<std::string> toolParams;
 	PathSet paths;
 
+	DiffOptions diffOptions;
+	PathFilter pathFilter;
+
 	bool noGUI;
 	bool allowMultipleDiffs;
+	bool printStats;
+	StatsFormat statsFormat;
+	std::string tracePath;
+	std::string saveManifestPath;
+
+	// Archives are only read as trees next to a directory or manifest, unless this asks for it
+	bool openArchives;
+
+	// Verdicts are checkpointed here, and with resume taken from a previous run
+	std::string sessionPath;
+	bool resume;
+
+	bool quick;
+	bool daemon;
+	bool client;
+	std::string socketPath;
 };
 
 void ParseDiffToolCommand(const std::string& toolArgs, not_null<RunParams> outRunParams)
@@ -41,10 +75,43 @@ void ParseDiffToolCommand(const std::string& toolArgs, not_null<RunParams> outRu
 	}
 }
 
+// Byte counts with an optional K, M or G suffix
+bool ParseSize(const std::string& text, not_null<int64_t> outSize)
+{
+	char* end = nullptr;
+	const long long value = strtoll(text.c_str(), &end, 10);
+	if (end == text.c_str() || value < 0)
+		return false;
+
+	int64_t scale = 1;
+	switch (*end)
+	{
+		case '\0': break;
+		case 'K': case 'k': scale = 1024ll; ++end; break;
+		case 'M': case 'm': scale = 1024ll * 1024; ++end; break;
+		case 'G': case 'g': scale = 1024ll * 1024 * 1024; ++end; break;
+		default: return false;
+	}
+	if (*end != '\0')
+		return false;
+
+	*outSize = (int64_t)value * scale;
+	return true;
+}
+
 bool InitRunParams(const std::vector<std::string>& arguments, not_null<RunParams> outRunParams)
 {
-	outRunParams->noGUI = false;
+	// Headless builds have no folder compare view to show
+	outRunParams->noGUI = !DWRAP_WITH_GUI;
 	outRunParams->allowMultipleDiffs = false;
+	outRunParams->printStats = false;
+	outRunParams->statsFormat = kStatsTable;
+	outRunParams->openArchives = false;
+	outRunParams->resume = false;
+	outRunParams->quick = false;
+	outRunParams->daemon = false;
+	outRunParams->client = false;
+	outRunParams->socketPath = GetDefaultDaemonSocketPath();
 
 	for (int i = 0, argCount = arguments.size(); i < argCount; ++i)
 	{
@@ -65,6 +132,129 @@ bool InitRunParams(const std::vector<std::string>& arguments, not_null<RunParams
 			{
 				outRunParams->noGUI = true;
 			}
+			else if (s == "--save-manifest")
+			{
+				if (i >= argCount - 1)
+				{
+					LogLine(kError, "param '--save-manifest' found but no output file supplied.");
+					return false;
+				}
+
+				outRunParams->saveManifestPath = arguments[++i];
+			}
+			else if (s == "--session")
+			{
+				if (i >= argCount - 1)
+				{
+					LogLine(kError, "param '--session' found but no session file supplied.");
+					return false;
+				}
+
+				outRunParams->sessionPath = arguments[++i];
+			}
+			else if (s == "--openArchives")
+			{
+				outRunParams->openArchives = true;
+			}
+			else if (s == "--resume")
+			{
+				outRunParams->resume = true;
+			}
+			else if (s == "--normalizeText")
+			{
+				outRunParams->diffOptions.compareOptions.normalizeText = true;
+			}
+			else if (s == "--similarity")
+			{
+				outRunParams->diffOptions.measureSimilarity = true;
+			}
+			else if (s == "--sizeOnly")
+			{
+				outRunParams->diffOptions.compareContents = false;
+			}
+			else if (s == "--largeFileThreshold")
+			{
+				if (i >= argCount - 1 || !ParseSize(arguments[i + 1], &outRunParams->diffOptions.compareOptions.largeFileThreshold))
+				{
+					LogLine(kError, "param '--largeFileThreshold' requires a size such as '256M', or 0 to disable.");
+					return false;
+				}
+				++i;
+			}
+			else if (s == "--exclude" || s == "--include" || s == "--ignoreFile")
+			{
+				if (i >= argCount - 1)
+				{
+					LogLine(kError, "param '%s' found but no pattern supplied.", s.c_str());
+					return false;
+				}
+
+				const std::string& value = arguments[++i];
+				bool added;
+				if (s == "--exclude")
+					added = outRunParams->pathFilter.AddExclude(value);
+				else if (s == "--include")
+					added = outRunParams->pathFilter.AddInclude(value);
+				else
+					added = outRunParams->pathFilter.AddRulesFromFile(value);
+
+				if (!added)
+					return false;
+			}
+			else if (s == "--max-memory")
+			{
+				if (i >= argCount - 1 || !ParseSize(arguments[i + 1], &outRunParams->diffOptions.maxMemory) || outRunParams->diffOptions.maxMemory <= 0)
+				{
+					LogLine(kError, "param '--max-memory' requires a size such as '512M'.");
+					return false;
+				}
+				++i;
+			}
+			else if (s.compare(0, 5, "--io=") == 0)
+			{
+				if (!ParseIoPolicy(s.substr(5), &outRunParams->diffOptions.compareOptions.ioPolicy))
+				{
+					LogLine(kError, "param '--io=' must be one of 'cached', 'dropBehind' or 'direct'.");
+					return false;
+				}
+			}
+			else if (s.compare(0, 11, "--symlinks=") == 0)
+			{
+				if (!ParseSymlinkPolicy(s.substr(11), &outRunParams->diffOptions.scanOptions.symlinks))
+				{
+					LogLine(kError, "param '--symlinks=' must be one of 'follow', 'link' or 'skip'.");
+					return false;
+				}
+			}
+			else if (s.compare(0, 12, "--pathMatch=") == 0)
+			{
+				if (!ParsePathMatch(s.substr(12), &outRunParams->diffOptions.scanOptions.pathMatch))
+				{
+					LogLine(kError, "param '--pathMatch=' must be one of 'exact', 'nfc' or 'fold'.");
+					return false;
+				}
+			}
+			else if (s == "--quick")
+			{
+				outRunParams->quick = true;
+			}
+			else if (s == "--daemon")
+			{
+				outRunParams->daemon = true;
+			}
+			else if (s == "--client")
+			{
+				outRunParams->client = true;
+			}
+			else if (s.compare(0, 9, "--socket=") == 0)
+			{
+				outRunParams->socketPath = s.substr(9);
+				if (outRunParams->socketPath.empty())
+				{
+					LogLine(kError, "param '--socket=' requires a socket path.");
+					return false;
+				}
+			}
 			else if (s == "--allowMultipleDiffs")
 			{
 				outRunParams->allowMultipleDiffs = true;
@@ -73,6 +263,25 @@ bool InitRunParams(const std::vector<std::string>& arguments, not_null<RunParams
 			{
 				SetLogLevel(kDebug);
 			}
+			else if (s == "--stats" || s == "--stats=table")
+			{
+				outRunParams->printStats = true;
+				outRunParams->statsFormat = kStatsTable;
+			}
+			else if (s == "--stats=json")
+			{
+				outRunParams->printStats = true;
+				outRunParams->statsFormat = kStatsJson;
+			}
+			else if (s.compare(0, 8, "--trace=") == 0)
+			{
+				outRunParams->tracePath = s.substr(8);
+				if (outRunParams->tracePath.empty())
+				{
+					LogLine(kError, "param '--trace=' requires an output file.");
+					return false;
+				}
+			}
 			else
 			{
 				LogLine(kError, "unrecognized parameter '%s'", s.c_str());
@@ -84,11 +293,25 @@ bool InitRunParams(const std::vector<std::string>& arguments, not_null<RunParams
 		}
 	}
 
+	if (!outRunParams->pathFilter.IsEmpty())
+		outRunParams->diffOptions.scanOptions.filter = &outRunParams->pathFilter;
+
 	return true;
 }
 
-bool VerifyPathParams(const PathSet& paths, not_null<bool> outAllRegularFiles, not_null<bool> outAllDirectories)
+bool VerifyPathParams(const PathSet& paths, const bool openArchives, not_null<bool> outAllRegularFiles, not_null<bool> outAllDirectories)
 {
+	// Files such as .docx, .jar or tarballs given on their own are files to hand to the tool.
+	// They are only read as trees next to a directory or manifest, or when asked to.
+	bool readArchives = openArchives;
+	for (const auto& p : paths)
+	{
+		bool isFile = false;
+		bool isDir = false;
+		IsRegularFileOrDirectory(p, &isFile, &isDir);
+		readArchives |= isDir || (isFile && IsManifestFile(p));
+	}
+
 	bool allFiles = true;
 	bool allDirs = true;
 	for (const auto& p : paths)
@@ -96,6 +319,14 @@ bool VerifyPathParams(const PathSet& paths, not_null<bool> outAllRegularFiles, n
 		bool isFile = false;
 		bool isDir = false;
 		IsRegularFileOrDirectory(p, &isFile, &isDir);
+
+		// Manifests and archives stand in for the directory they were made from
+		if (isFile && (IsManifestFile(p) || (readArchives && IsArchiveFile(p))))
+		{
+			isFile = false;
+			isDir = true;
+		}
+
 		allFiles &= isFile;
 		allDirs &= isDir;
 
@@ -112,6 +343,21 @@ bool VerifyPathParams(const PathSet& paths, not_null<bool> outAllRegularFiles, n
 	return true;
 }
 
+// Files can be members extracted from an archive, whose names must not reach the shell as syntax
+std::string QuoteShellArgument(const std::string& argument)
+{
+	std::string quoted = "'";
+	for (const char c : argument)
+	{
+		if (c == '\'')
+			quoted += "'\\''";
+		else
+			quoted += c;
+	}
+	quoted += '\'';
+	return quoted;
+}
+
 int CallDiffTool(const RunParams& runParams, const PathSet& files)
 {
 	LogLine(kDebug, "Parsing command with %lu files.", files.size());
@@ -135,7 +381,7 @@ int CallDiffTool(const RunParams& runParams, const PathSet& files)
 						return EX_IOERR;
 					}
 
-					stringBuilder << " " << files[index];
+					stringBuilder << " " << QuoteShellArgument(files[index]);
 				}
 			}
 			else
@@ -150,16 +396,24 @@ int CallDiffTool(const RunParams& runParams, const PathSet& files)
 	{
 		// if we had no command parameters, just append the original files in order
 		for (const auto& f : files)
-			stringBuilder << " " << f;
+			stringBuilder << " " << QuoteShellArgument(f);
 	}
 
 	auto str = stringBuilder.str();
 	LogLine(kDebug, "Command Executed: %s", str.c_str());
+	LogFlush();
 
-
-	return system(str.c_str());;
+	ScopedPhase phase(kPhaseToolLaunch);
+	TraceScope trace("ToolLaunch", str.c_str());
+	return system(str.c_str());
 }
 
+struct LogFlusherScope
+{
+	LogFlusherScope() { StartLogFlusher(); }
+	~LogFlusherScope() { StopLogFlusher(); }
+};
+
 struct Worker
 {
 	std::thread thread;
@@ -169,15 +423,43 @@ static std::vector<Worker*> s_workers;
 
 static RunParams s_runParams;
 
+// Archive members extracted for the diff tool, removed on exit since tools may still read them after returning
+static std::vector<std::string> s_tempFiles;
+
+bool GetToolPath(const FileInfo& f, not_null<std::string> outPath)
+{
+	if (HasLocalFile(f))
+	{
+		*outPath = f.absolutePath;
+		return true;
+	}
+
+	if (!f.archiveMember)
+	{
+		LogLine(kError, "'%s' only exists in a manifest and cannot be opened in a diff tool.", f.relativePath.c_str());
+		return false;
+	}
+
+	if (!ExtractArchiveMember(*f.archiveMember, f.name, outPath))
+		return false;
+	s_tempFiles.push_back(*outPath);
+	return true;
+}
+
 void DoCallDiffTool(const DiffEntry& entry)
 {
 	PathSet paths;
-	if (entry.leftFile)
-		paths.push_back(entry.leftFile->absolutePath);
-	if (entry.rightFile)
-	paths.push_back(entry.rightFile->absolutePath);
+	for (const FileInfo* f : { entry.leftFile, entry.rightFile })
+	{
+		std::string path;
+		if (f == nullptr)
+			continue;
+		if (!GetToolPath(*f, &path))
+			return;
+		paths.push_back(path);
+	}
 
-	LogLine(kDebug, "Diffing '%s' and '%s'", paths[0].c_str(), paths[1].c_str());
+	LogLine(kDebug, "Diffing '%s'", entry.leftFile ? entry.leftFile->relativePath.c_str() : entry.rightFile->relativePath.c_str());
 
 	RunParams& runParams = s_runParams;	
 	if (runParams.allowMultipleDiffs)
@@ -187,6 +469,7 @@ void DoCallDiffTool(const DiffEntry& entry)
 		auto* doneAtomicPtr = &worker->done;
 		worker->thread = std::thread([paths, &runParams, doneAtomicPtr]() 
 		{
+			SetTraceThreadName("diff tool");
             CallDiffTool(runParams, paths);
             *doneAtomicPtr = true;
         });
@@ -197,14 +480,167 @@ void DoCallDiffTool(const DiffEntry& entry)
 		CallDiffTool(runParams, paths);
 }
 
+void PrintDiffEntry(const DiffEntry& entry)
+{
+	assert(entry.leftFile != entry.rightFile);
+	if (entry.leftFile == nullptr)
+		LogLine(kOutput, "    [+] '%s'", entry.rightFile->relativePath.c_str());
+	else if (entry.rightFile == nullptr)
+		LogLine(kOutput, "    [-] '%s'", entry.leftFile->relativePath.c_str());	
+	else if (entry.differs && entry.similarity >= 0)
+		LogLine(kOutput, "    [M] '%s' (%.1f%% similar, %lld bytes changed)", entry.leftFile->relativePath.c_str(), 100.0 * entry.similarity, (long long)entry.changedBytes);
+	else if (entry.differs)
+		LogLine(kOutput, "    [M] '%s'", entry.leftFile->relativePath.c_str());	
+	else
+		LogLine(kOutput, "    [=] '%s'", entry.leftFile->relativePath.c_str());	
+}
+
+// Exits with EX_OK when the paths are identical and EX_DIFFERENT when they are not
+int RunQuickCompare(const RunParams& runParams)
+{
+	if (!GetPath(runParams.paths, kLeft) || !GetPath(runParams.paths, kRight))
+	{
+		LogLine(kError, "You must supply at least two paths to diff.");
+		return EX_USAGE;
+	}
+
+	bool allRegularFiles = true;
+	bool allDirectories = false;
+	if (!VerifyPathParams(runParams.paths, runParams.openArchives, &allRegularFiles, &allDirectories))
+		return EX_IOERR;
+
+	bool identical = false;
+	std::string difference;
+	if (allRegularFiles && runParams.paths.size() == 2)
+	{
+		FileInfo files[2];
+		for (int i = 0; i < 2; ++i)
+		{
+			files[i].absolutePath = runParams.paths[i];
+			files[i].relativePath = runParams.paths[i];
+			files[i].isDir = false;
+			CountStat(kCounterStat);
+			stat(files[i].absolutePath.c_str(), &files[i].status);
+		}
+
+		int64_t firstDiffOffset = -1;
+		identical = runParams.diffOptions.compareContents
+			? FileEquals(files[0], files[1], runParams.diffOptions.compareOptions, &firstDiffOffset)
+			: FileSize(files[0]) == FileSize(files[1]);
+		if (!identical && FileSize(files[0]) != FileSize(files[1]) && !runParams.diffOptions.compareOptions.normalizeText)
+			difference = "Size differs";
+		else if (!identical)
+			difference = (firstDiffOffset >= 0) ? "Content differs at byte " + std::to_string(firstDiffOffset) : "Content differs";
+	}
+	else if (allDirectories)
+	{
+		if (!QuickCompare(runParams.paths, runParams.diffOptions, &identical, &difference))
+			return EX_IOERR;
+	}
+	else
+	{
+		LogLine(kError, "'--quick' compares either two files or two directories.");
+		return EX_USAGE;
+	}
+
+	LogLine(kOutput, "%s", identical ? "Identical." : difference.c_str());
+
+	WriteTrace();
+	if (runParams.printStats)
+	{
+		LogFlush();
+		PrintStats(runParams.statsFormat);
+	}
+	return identical ? EX_OK : EX_DIFFERENT;
+}
+
 int main(const int argc, const char* argv[])
 {
+	LogFlusherScope logFlusher;
+
 	std::vector<std::string> arguments(argv + 1, argv + argc);
 
 	RunParams& runParams = s_runParams;
 	if (!InitRunParams(arguments, &runParams))
 		return EX_USAGE;
 
+	if (!runParams.tracePath.empty())
+	{
+		StartTrace(runParams.tracePath);
+		SetTraceThreadName("main");
+	}
+
+	if (!runParams.saveManifestPath.empty())
+	{
+		const std::string* dir = GetPath(runParams.paths, kLeft);
+		if (runParams.paths.size() != 1 || dir == nullptr)
+		{
+			LogLine(kError, "'--save-manifest <file>' takes exactly one directory.");
+			return EX_USAGE;
+		}
+
+		if (!SaveManifest(*dir, runParams.diffOptions.scanOptions, runParams.saveManifestPath))
+			return EX_IOERR;
+
+		WriteTrace();
+		if (runParams.printStats)
+			PrintStats(runParams.statsFormat);
+		return EX_OK;
+	}
+
+	if (runParams.resume && runParams.sessionPath.empty())
+	{
+		LogLine(kError, "'--resume' continues a session, use it with '--session <file>'.");
+		return EX_USAGE;
+	}
+
+	if (!runParams.sessionPath.empty() && (runParams.client || runParams.daemon || runParams.quick))
+	{
+		LogLine(kError, "'--session' only records full diffs, it cannot be used with '--client', '--daemon' or '--quick'.");
+		return EX_USAGE;
+	}
+
+	// The paths are the trees to scan before the first query comes in
+	if (runParams.daemon)
+	{
+		if (!RunDaemon(runParams.socketPath, runParams.paths, runParams.diffOptions))
+			return EX_IOERR;
+
+		WriteTrace();
+		if (runParams.printStats)
+		{
+			LogFlush();
+			PrintStats(runParams.statsFormat);
+		}
+		return EX_OK;
+	}
+
+	if (runParams.quick)
+		return RunQuickCompare(runParams);
+
+	if (runParams.diffOptions.maxMemory > 0 && !(runParams.noGUI && runParams.tool.empty()))
+	{
+		LogLine(kError, "'--max-memory' only bounds streamed diffs, use it with '--noGUI' and without '--tool'.");
+		return EX_USAGE;
+	}
+
+	// The daemon scans and compares with its own options, only sizeOnly is sent along
+	const DiffOptions defaultOptions;
+	const ScanOptions& scanOptions = runParams.diffOptions.scanOptions;
+	if (runParams.client && (scanOptions.filter || scanOptions.symlinks != defaultOptions.scanOptions.symlinks
+		|| scanOptions.pathMatch != defaultOptions.scanOptions.pathMatch || runParams.diffOptions.measureSimilarity
+		|| runParams.diffOptions.compareOptions.normalizeText))
+	{
+		LogLine(kError, "'--client' diffs with the daemon's options, '--exclude', '--include', '--ignoreFile', '--symlinks=', '--pathMatch=', '--similarity' and '--normalizeText' go to 'dwrap --daemon' instead.");
+		return EX_USAGE;
+	}
+
+	if (runParams.client && !(runParams.noGUI && runParams.tool.empty()))
+	{
+		LogLine(kError, "'--client' only prints the diff, use it with '--noGUI' and without '--tool'.");
+		return EX_USAGE;
+	}
+
 	if (!runParams.noGUI && runParams.tool.empty())
 	{
 		LogLine(kError, "Must supply diff tool for folder compare view. Use '--tool <tool>' to set tool or '--noGUI' to disable folder compare view.");
@@ -219,7 +655,7 @@ int main(const int argc, const char* argv[])
 
 	bool allRegularFiles = true;
 	bool allDirectories = false;
-	if (!VerifyPathParams(runParams.paths, &allRegularFiles, &allDirectories))
+	if (!VerifyPathParams(runParams.paths, runParams.openArchives, &allRegularFiles, &allDirectories))
 		return EX_IOERR;
 
 	if (!allRegularFiles && !allDirectories)
@@ -232,32 +668,45 @@ int main(const int argc, const char* argv[])
 
 	if (allRegularFiles)
 	{
-		return CallDiffTool(runParams, runParams.paths);
+		retCode = CallDiffTool(runParams, runParams.paths);
 	}
 	else
 	{
 		LogLine(kDebug, "Diffing directories.");
-		DirectoryDiffState diffState;
-		GenerateDirectoryDiffState(runParams.paths, &diffState);
 
-		LogLine(kOutput, "Diff result:");
-
-		for (const DiffEntry& entry : diffState.sortedEntries)
+		DiffSession session;
+		if (!runParams.sessionPath.empty())
 		{
-			assert(entry.leftFile != entry.rightFile);
-			if (entry.leftFile == nullptr)
-				LogLine(kOutput, "    [+] '%s'", entry.rightFile->relativePath.c_str());
-			else if (entry.rightFile == nullptr)
-				LogLine(kOutput, "    [-] '%s'", entry.leftFile->relativePath.c_str());	
-			else if (entry.differs)
-				LogLine(kOutput, "    [M] '%s'", entry.leftFile->relativePath.c_str());	
-			else
-				LogLine(kOutput, "    [=] '%s'", entry.leftFile->relativePath.c_str());	
+			if (!session.Open(runParams.sessionPath, runParams.paths, runParams.diffOptions, runParams.resume))
+				return EX_IOERR;
+			runParams.diffOptions.session = &session;
 		}
 
-		if (runParams.noGUI)
+		// Without GUI or tool nothing needs the entries afterwards, so just stream them out
+		if (runParams.noGUI && runParams.tool.empty())
 		{
-			if (!runParams.tool.empty())
+			LogLine(kOutput, "Diff result:");
+			const bool diffed = runParams.client
+				? QueryDaemon(runParams.socketPath, runParams.paths, runParams.diffOptions, PrintDiffEntry)
+				: StreamDirectoryDiff(runParams.paths, runParams.diffOptions, PrintDiffEntry);
+			const bool sessionKept = session.Close();
+			if (!diffed || !sessionKept)
+				retCode = EX_IOERR;
+		}
+		else
+		{
+			DirectoryDiffState diffState;
+			if (!GenerateDirectoryDiffState(runParams.paths, runParams.diffOptions, &diffState))
+				return EX_IOERR;
+			// The last verdicts are kept before any tool or view opens, the diff is shown even when they could not be
+			const bool sessionKept = session.Close();
+
+			LogLine(kOutput, "Diff result:");
+
+			for (const DiffEntry& entry : diffState.sortedEntries)
+				PrintDiffEntry(entry);
+
+			if (runParams.noGUI)
 			{
 				LogLine(kDebug, "Using tool to compare modified files...");
 
@@ -272,11 +721,20 @@ int main(const int argc, const char* argv[])
 					}
 				}
 			}
-		}
-		else
-		{
-			GUI::InitWindow(800, 600, diffState, DoCallDiffTool);
-			retCode = GUI::Run();
+#if DWRAP_WITH_GUI
+			else
+			{
+				{
+					ScopedPhase phase(kPhaseGUIBuild);
+					TraceScope trace("BuildGUI");
+					GUI::InitWindow(800, 600, diffState, DoCallDiffTool);
+				}
+				LogFlush();
+				retCode = GUI::Run();
+			}
+#endif
+			if (!sessionKept)
+				retCode = EX_IOERR;
 		}
 	}
 
@@ -303,6 +761,20 @@ int main(const int argc, const char* argv[])
 		delete worker;
 	}
 	s_workers.clear();
+
+	for (const std::string& tempFile : s_tempFiles)
+		remove(tempFile.c_str());
+	s_tempFiles.clear();
+
+	WriteTrace();
+
+	if (runParams.printStats)
+	{
+		LogFlush();
+		PrintStats(runParams.statsFormat);
+	}
+
+	return retCode;
 }
 
 
@@ -0,0 +1,332 @@
+#include "Manifest.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "PathFilter.h"
+#include "Stats.h"
+
+namespace
+{
+	bool ValidateHeader(const ManifestHeader& header, const size_t fileSize, const std::string& path)
+	{
+		if (memcmp(header.magic, DWRAP_MANIFEST_MAGIC, sizeof(header.magic)) != 0)
+		{
+			LogLine(kError, "'%s' is not a manifest file", path.c_str());
+			return false;
+		}
+		if (header.byteOrderMark != kManifestByteOrderMark)
+		{
+			LogLine(kError, "Manifest '%s' was written on a machine with a different byte order", path.c_str());
+			return false;
+		}
+		if (header.version != kManifestVersion)
+		{
+			LogLine(kError, "Manifest '%s' has unsupported version %u", path.c_str(), header.version);
+			return false;
+		}
+		// Written so that no sum or product can overflow
+		if (header.recordsOffset > fileSize || header.entryCount > (fileSize - header.recordsOffset) / sizeof(ManifestRecord)
+			|| header.stringsOffset > fileSize || header.stringsSize > fileSize - header.stringsOffset)
+		{
+			LogLine(kError, "Manifest '%s' is truncated", path.c_str());
+			return false;
+		}
+		return true;
+	}
+}
+
+ManifestFile::ManifestFile()
+	: m_Mapping(nullptr)
+	, m_MappingSize(0)
+	, m_EntryCount(0)
+	, m_Records(nullptr)
+	, m_Strings(nullptr)
+	, m_StringsSize(0)
+{
+}
+
+ManifestFile::~ManifestFile()
+{
+	Close();
+}
+
+bool ManifestFile::Open(const std::string& path)
+{
+	Close();
+
+	CountStat(kCounterOpen);
+	const int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		LogLine(kError, "Could not open manifest '%s'", path.c_str());
+		return false;
+	}
+
+	struct stat status;
+	CountStat(kCounterStat);
+	if (fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(ManifestHeader))
+	{
+		LogLine(kError, "Manifest '%s' is truncated", path.c_str());
+		close(fd);
+		return false;
+	}
+
+	void* mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+	{
+		LogLine(kError, "Could not map manifest '%s'", path.c_str());
+		return false;
+	}
+
+	const ManifestHeader& header = *(const ManifestHeader*)mapping;
+	if (!ValidateHeader(header, status.st_size, path))
+	{
+		munmap(mapping, status.st_size);
+		return false;
+	}
+
+	// Records are read front to back
+	madvise(mapping, status.st_size, MADV_SEQUENTIAL);
+
+	m_Mapping = mapping;
+	m_MappingSize = status.st_size;
+	m_EntryCount = header.entryCount;
+	m_Records = (const ManifestRecord*)((const char*)mapping + header.recordsOffset);
+	m_Strings = (const char*)mapping + header.stringsOffset;
+	m_StringsSize = header.stringsSize;
+	m_Path = path;
+	return true;
+}
+
+void ManifestFile::Close()
+{
+	if (m_Mapping)
+		munmap(m_Mapping, m_MappingSize);
+
+	m_Mapping = nullptr;
+	m_MappingSize = 0;
+	m_EntryCount = 0;
+	m_Records = nullptr;
+	m_Strings = nullptr;
+	m_StringsSize = 0;
+}
+
+void ManifestFile::ReleaseBefore(const size_t index)
+{
+	if (m_Mapping == nullptr || index == 0 || index > m_EntryCount)
+		return;
+
+	const uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+	auto release = [pageSize](const char* begin, const char* end)
+	{
+		const uintptr_t alignedBegin = ((uintptr_t)begin + pageSize - 1) & ~(pageSize - 1);
+		const uintptr_t alignedEnd = (uintptr_t)end & ~(pageSize - 1);
+		if (alignedEnd > alignedBegin)
+			madvise((void*)alignedBegin, alignedEnd - alignedBegin, MADV_DONTNEED);
+	};
+
+	release((const char*)m_Records, (const char*)(m_Records + index));
+	release(m_Strings, GetPathData(m_Records[index - 1]));
+}
+
+ManifestCursor::ManifestCursor(ManifestFile& manifest, const ScanOptions& options)
+	: m_Manifest(manifest)
+	, m_Options(options)
+	, m_NextIndex(0)
+	, m_Failed(false)
+{
+}
+
+bool ManifestCursor::Next()
+{
+	// Keeps the resident size of large manifests bounded while walking them
+	const size_t kReleaseInterval = 1 << 16;
+
+	while (m_NextIndex < m_Manifest.GetEntryCount())
+	{
+		const size_t index = m_NextIndex++;
+		if (index > 0 && index % kReleaseInterval == 0)
+			m_Manifest.ReleaseBefore(index);
+
+		const ManifestRecord& record = m_Manifest.GetRecord(index);
+		if (!m_Manifest.IsRecordValid(record))
+		{
+			LogLine(kError, "Manifest '%s' is corrupt, record %lu points outside of its paths", m_Manifest.GetFilePath().c_str(), (unsigned long)index);
+			m_Failed = true;
+			return false;
+		}
+		FileInfoFromManifestRecord(m_Manifest, record, &m_FileInfo);
+		CountStat(kCounterEntriesScanned);
+
+		if (m_Options.filter && IsExcluded())
+		{
+			CountStat(kCounterEntriesExcluded);
+			continue;
+		}
+		SetPathMatchKey(m_Options, &m_FileInfo);
+		return true;
+	}
+	return false;
+}
+
+bool ManifestCursor::IsExcluded()
+{
+	const std::string& path = m_FileInfo.relativePath;
+
+	// Paths sharing the directory's name up to a character before '/', like "dir-1" after "dir",
+	// sort between it and its entries. Any other path sorts after all of them.
+	while (!m_ExcludedDirs.empty())
+	{
+		const std::string& dir = m_ExcludedDirs.back();
+		const bool hasPrefix = path.size() > dir.size() && path.compare(0, dir.size(), dir) == 0;
+		if (hasPrefix && path[dir.size()] == '/')
+			return true;
+		if (hasPrefix && (unsigned char)path[dir.size()] < '/')
+			break;
+		m_ExcludedDirs.pop_back();
+	}
+
+	if (!m_Options.filter->IsExcluded(path, m_FileInfo.name, IsDir(m_FileInfo)))
+		return false;
+
+	if (IsDir(m_FileInfo))
+		m_ExcludedDirs.push_back(path);
+	return true;
+}
+
+bool IsManifestFile(const std::string& path)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == nullptr)
+		return false;
+
+	char magic[8];
+	const bool isManifest = fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+		&& memcmp(magic, DWRAP_MANIFEST_MAGIC, sizeof(magic)) == 0;
+	fclose(file);
+	return isManifest;
+}
+
+bool SaveManifest(const std::string& rootDir, const ScanOptions& options, const std::string& outputPath)
+{
+	// Manifests are always sorted by the exact paths, matching only applies when they are read
+	ScanOptions scanOptions = options;
+	scanOptions.pathMatch = kPathMatchExact;
+
+	std::vector<FileInfo> files;
+	{
+		ScopedPhase phase(kPhaseScan);
+		DirectoryScanner scanner(scanOptions);
+		if (!scanner.Add(rootDir, &files) || !scanner.Wait())
+			return false;
+	}
+	{
+		ScopedPhase phase(kPhaseSort);
+		SortFileList(&files);
+	}
+
+	std::vector<ManifestRecord> records;
+	records.reserve(files.size());
+	uint64_t stringsSize = 0;
+	{
+		ScopedPhase phase(kPhaseCompare);
+		for (const FileInfo& f : files)
+		{
+			ManifestRecord record;
+			record.pathOffset = stringsSize;
+			record.pathLength = (uint32_t)f.relativePath.size();
+			record.flags = IsDir(f) ? kManifestDir : (IsSymlink(f) ? kManifestSymlink : 0);
+			record.size = IsDir(f) ? 0 : (uint64_t)f.status.st_size;
+			record.mtimeNs = GetModificationTimeNs(f.status);
+			record.contentHash = 0;
+			if (!IsDir(f))
+			{
+				if (!GetContentHash(f, &record.contentHash))
+					return false;
+				record.flags |= kManifestHasHash;
+			}
+			records.push_back(record);
+			stringsSize += record.pathLength;
+		}
+	}
+
+	ManifestHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DWRAP_MANIFEST_MAGIC, sizeof(header.magic));
+	header.version = kManifestVersion;
+	header.byteOrderMark = kManifestByteOrderMark;
+	header.entryCount = records.size();
+	header.recordsOffset = sizeof(ManifestHeader);
+	header.stringsOffset = header.recordsOffset + records.size() * sizeof(ManifestRecord);
+	header.stringsSize = stringsSize;
+
+	// Written to a temporary name first so a failed save never leaves a truncated manifest behind
+	const std::string tempPath = outputPath + ".tmp";
+	FILE* file = fopen(tempPath.c_str(), "wb");
+	if (file == nullptr)
+	{
+		LogLine(kError, "Could not write manifest '%s'", outputPath.c_str());
+		return false;
+	}
+
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+	if (written && !records.empty())
+		written = fwrite(records.data(), sizeof(ManifestRecord), records.size(), file) == records.size();
+	for (size_t i = 0; written && i < files.size(); ++i)
+		written = fwrite(files[i].relativePath.data(), 1, files[i].relativePath.size(), file) == files[i].relativePath.size();
+	written = (fclose(file) == 0) && written;
+
+	if (!written || rename(tempPath.c_str(), outputPath.c_str()) != 0)
+	{
+		LogLine(kError, "Could not write manifest '%s'", outputPath.c_str());
+		remove(tempPath.c_str());
+		return false;
+	}
+
+	LogLine(kDebug, "Wrote manifest '%s' with %lu entries", outputPath.c_str(), (unsigned long)records.size());
+	return true;
+}
+
+void FileInfoFromManifestRecord(const ManifestFile& manifest, const ManifestRecord& record, not_null<FileInfo> outFileInfo)
+{
+	FileInfo& f = *outFileInfo;
+	const char* path = manifest.GetPathData(record);
+	f.relativePath.assign(path, record.pathLength);
+	const size_t slash = f.relativePath.rfind('/');
+	f.name = (slash == std::string::npos) ? f.relativePath : f.relativePath.substr(slash + 1);
+	f.absolutePath.clear();
+	f.isDir = (record.flags & kManifestDir) != 0;
+
+	// Same levels as a directory scan assigns
+	const int depth = GetPathDepth(path, record.pathLength);
+	f.level = f.isDir ? depth + 1 : depth;
+
+	memset(&f.status, 0, sizeof(f.status));
+	f.status.st_mode = f.isDir ? S_IFDIR : ((record.flags & kManifestSymlink) ? S_IFLNK : S_IFREG);
+	f.status.st_size = record.size;
+	SetModificationTimeNs(record.mtimeNs, &f.status);
+
+	f.hasContentHash = (record.flags & kManifestHasHash) != 0;
+	f.contentHash = record.contentHash;
+}
+
+bool ListFilesInManifest(const std::string& manifestPath, const ScanOptions& options, not_null<std::vector<FileInfo>> outFiles)
+{
+	ManifestFile manifest;
+	if (!manifest.Open(manifestPath))
+		return false;
+
+	outFiles->reserve(outFiles->size() + manifest.GetEntryCount());
+
+	ManifestCursor cursor(manifest, options);
+	while (cursor.Next())
+		outFiles->push_back(cursor.GetFileInfo());
+
+	return !cursor.HasFailed();
+}
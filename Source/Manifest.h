@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "FileUtils.h"
+
+// Snapshot manifests: an index file of a tree's relative paths, sizes, mtimes and content hashes,
+// sorted by path so it can be memory mapped and merged against without loading it.
+//
+// Layout: ManifestHeader, entryCount ManifestRecords, then the path string blob.
+// All integers are stored in host byte order, the header records which one that is.
+
+#define DWRAP_MANIFEST_MAGIC "DWRAPIDX"
+const uint32_t kManifestVersion = 1;
+const uint32_t kManifestByteOrderMark = 0x01020304;
+
+enum ManifestRecordFlags
+{
+	kManifestDir = 1 << 0,
+	kManifestHasHash = 1 << 1,
+	// contentHash is the hash of the path the link points to
+	kManifestSymlink = 1 << 2,
+};
+
+struct ManifestHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrderMark;
+	uint64_t entryCount;
+	uint64_t recordsOffset;
+	uint64_t stringsOffset;
+	uint64_t stringsSize;
+};
+
+struct ManifestRecord
+{
+	uint64_t pathOffset;
+	uint32_t pathLength;
+	uint32_t flags;
+	uint64_t size;
+	int64_t mtimeNs;
+	uint64_t contentHash;
+};
+
+// Read-only memory mapping of a manifest file
+class ManifestFile
+{
+public:
+	ManifestFile();
+	~ManifestFile();
+	ManifestFile(const ManifestFile&) = delete;
+	ManifestFile& operator=(const ManifestFile&) = delete;
+
+	bool Open(const std::string& path);
+	void Close();
+
+	size_t GetEntryCount() const { return m_EntryCount; }
+	const ManifestRecord& GetRecord(const size_t index) const { return m_Records[index]; }
+	const char* GetPathData(const ManifestRecord& record) const { return m_Strings + record.pathOffset; }
+	std::string GetPath(const ManifestRecord& record) const { return std::string(GetPathData(record), record.pathLength); }
+
+	// Whether the path of the record lies within the path strings. Only the header is checked
+	// when the manifest is opened, records are checked as they are read.
+	bool IsRecordValid(const ManifestRecord& record) const
+	{
+		return record.pathOffset <= m_StringsSize && record.pathLength <= m_StringsSize - record.pathOffset;
+	}
+
+	const std::string& GetFilePath() const { return m_Path; }
+
+	// Drops the pages of records before index from this process, they stay in the page cache
+	void ReleaseBefore(const size_t index);
+
+private:
+	void* m_Mapping;
+	size_t m_MappingSize;
+	size_t m_EntryCount;
+	const ManifestRecord* m_Records;
+	const char* m_Strings;
+	uint64_t m_StringsSize;
+	std::string m_Path;
+};
+
+// Walks the records of a manifest in path order, skipping the ones the scan options exclude.
+// Entries get path match keys, but are not in key order.
+class ManifestCursor
+{
+public:
+	ManifestCursor(ManifestFile& manifest, const ScanOptions& options);
+
+	// Moves to the next entry, returns false once all entries were visited or a record is corrupt
+	bool Next();
+
+	bool HasFailed() const { return m_Failed; }
+
+	// The current entry, reused between calls to Next
+	const FileInfo& GetFileInfo() const { return m_FileInfo; }
+
+private:
+	bool IsExcluded();
+
+	ManifestFile& m_Manifest;
+	const ScanOptions& m_Options;
+	size_t m_NextIndex;
+	bool m_Failed;
+	FileInfo m_FileInfo;
+
+	// Everything below an excluded directory is excluded too. Records come in path order, so
+	// only excluded directories whose entries can still come are kept, innermost last.
+	std::vector<std::string> m_ExcludedDirs;
+};
+
+bool IsManifestFile(const std::string& path);
+
+// Scans rootDir and writes a manifest of it, hashing the contents of every regular file
+bool SaveManifest(const std::string& rootDir, const ScanOptions& options, const std::string& outputPath);
+
+// Fills in a FileInfo for a manifest record. It has no absolute path, only a content hash.
+void FileInfoFromManifestRecord(const ManifestFile& manifest, const ManifestRecord& record, not_null<FileInfo> outFileInfo);
+
+// Lists the entries of a manifest as if its tree had been scanned, already sorted
+bool ListFilesInManifest(const std::string& manifestPath, const ScanOptions& options, not_null<std::vector<FileInfo>> outFiles);
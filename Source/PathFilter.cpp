@@ -0,0 +1,320 @@
+#include "PathFilter.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include "Common.h"
+
+namespace
+{
+	bool HasGlobChars(const std::string& s, const size_t start = 0)
+	{
+		return s.find_first_of("*?[\\", start) != std::string::npos;
+	}
+}
+
+bool PathFilter::AddExclude(const std::string& pattern)
+{
+	return AddRule(pattern, false);
+}
+
+bool PathFilter::AddInclude(const std::string& pattern)
+{
+	return AddRule(pattern, true);
+}
+
+bool PathFilter::AddRulesFromFile(const std::string& path)
+{
+	std::ifstream file(path);
+	if (file.fail())
+	{
+		LogLine(kError, "Could not read rule file '%s'", path.c_str());
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+		if (!AddRule(line, false))
+			return false;
+	}
+
+	return true;
+}
+
+bool PathFilter::AddRule(std::string pattern, bool include)
+{
+	// Trailing whitespace (and CR from files with Windows line endings) is not significant
+	while (!pattern.empty() && (pattern.back() == ' ' || pattern.back() == '\t' || pattern.back() == '\r'))
+		pattern.pop_back();
+
+	if (!pattern.empty() && pattern[0] == '!')
+	{
+		include = !include;
+		pattern.erase(0, 1);
+	}
+
+	Rule rule;
+	rule.include = include;
+	rule.dirOnly = !pattern.empty() && pattern.back() == '/';
+	if (rule.dirOnly)
+		pattern.pop_back();
+
+	// A leading '**/' matches at any depth, which is what an unanchored pattern does anyway
+	if (pattern.compare(0, 3, "**/") == 0 && pattern.find('/', 3) == std::string::npos)
+		pattern.erase(0, 3);
+
+	rule.anchored = pattern.find('/') != std::string::npos;
+	if (!pattern.empty() && pattern[0] == '/')
+		pattern.erase(0, 1);
+
+	if (pattern.empty())
+		return true;
+
+	const int ruleIndex = (int)m_Rules.size();
+
+	if (!HasGlobChars(pattern))
+	{
+		(rule.anchored ? m_PathRules : m_NameRules)[pattern].push_back(ruleIndex);
+	}
+	else if (!rule.anchored && pattern[0] == '*' && !HasGlobChars(pattern, 1))
+	{
+		const std::string suffix = pattern.substr(1);
+		m_SuffixRules[suffix].push_back(ruleIndex);
+		if (std::find(m_SuffixLengths.begin(), m_SuffixLengths.end(), suffix.size()) == m_SuffixLengths.end())
+			m_SuffixLengths.push_back(suffix.size());
+	}
+	else
+	{
+		if (!CompileGlob(pattern, rule))
+		{
+			LogLine(kError, "Invalid pattern '%s'", pattern.c_str());
+			return false;
+		}
+		m_GlobRules.push_back(ruleIndex);
+	}
+
+	m_Rules.push_back(std::move(rule));
+	return true;
+}
+
+bool PathFilter::CompileGlob(const std::string& pattern, Rule& rule)
+{
+	auto& states = rule.states;
+	auto push = [&states](GlobState::Type type, int out, int out2 = -1, unsigned char c = 0, int classIndex = -1)
+	{
+		states.push_back(GlobState { type, c, classIndex, out, out2 });
+	};
+
+	const size_t length = pattern.size();
+	for (size_t i = 0; i < length; ++i)
+	{
+		const int s = (int)states.size();
+		const char c = pattern[i];
+		if (c == '*' && i + 1 < length && pattern[i + 1] == '*')
+		{
+			const bool segmentStart = (i == 0 || pattern[i - 1] == '/');
+			if (segmentStart && i + 2 < length && pattern[i + 2] == '/')
+			{
+				// '**/' matches zero or more whole directories
+				push(GlobState::kSplit, s + 1, s + 4);
+				push(GlobState::kSplit, s + 2, s + 3);
+				push(GlobState::kAny, s + 1);
+				push(GlobState::kChar, s + 4, -1, '/');
+				i += 2;
+			}
+			else if (segmentStart && i + 2 == length && i > 0)
+			{
+				// Trailing '/**' matches everything inside, but not the directory itself
+				push(GlobState::kAny, s + 1);
+				push(GlobState::kSplit, s + 2, s + 3);
+				push(GlobState::kAny, s + 1);
+				i += 1;
+			}
+			else
+			{
+				push(GlobState::kSplit, s + 1, s + 2);
+				push(GlobState::kAny, s);
+				i += 1;
+			}
+		}
+		else if (c == '*')
+		{
+			push(GlobState::kSplit, s + 1, s + 2);
+			push(GlobState::kAnyButSlash, s);
+		}
+		else if (c == '?')
+		{
+			push(GlobState::kAnyButSlash, s + 1);
+		}
+		else if (c == '[' && pattern.find(']', i + 2) != std::string::npos)
+		{
+			std::vector<bool> charClass(256, false);
+			size_t j = i + 1;
+			const bool negate = (pattern[j] == '!' || pattern[j] == '^');
+			if (negate)
+				++j;
+
+			// A ']' right after the opening bracket is part of the class
+			bool first = true;
+			for (; j < length && (pattern[j] != ']' || first); ++j, first = false)
+			{
+				const unsigned char from = (unsigned char)pattern[j];
+				unsigned char to = from;
+				if (j + 2 < length && pattern[j + 1] == '-' && pattern[j + 2] != ']')
+				{
+					to = (unsigned char)pattern[j + 2];
+					j += 2;
+				}
+				for (int ch = from; ch <= to; ++ch)
+					charClass[ch] = true;
+			}
+			if (j >= length)
+				return false;
+
+			if (negate)
+				charClass.flip();
+			charClass['/'] = false;
+
+			m_Classes.push_back(std::move(charClass));
+			push(GlobState::kClass, s + 1, -1, 0, (int)m_Classes.size() - 1);
+			i = j;
+		}
+		else if (c == '\\' && i + 1 < length)
+		{
+			push(GlobState::kChar, s + 1, -1, (unsigned char)pattern[++i]);
+		}
+		else
+		{
+			push(GlobState::kChar, s + 1, -1, (unsigned char)c);
+		}
+	}
+
+	push(GlobState::kMatch, -1);
+	return true;
+}
+
+bool PathFilter::MatchGlob(const Rule& rule, const std::string& text) const
+{
+	const auto& states = rule.states;
+
+	// Thompson simulation, the state lists are reused between calls on the same thread
+	thread_local std::vector<int> current;
+	thread_local std::vector<int> next;
+	thread_local std::vector<unsigned int> marks;
+	thread_local unsigned int generation = 0;
+
+	if (marks.size() < states.size())
+		marks.assign(states.size(), 0);
+
+	auto addState = [&states](std::vector<int>& list, int s)
+	{
+		// Splits are followed right away so the lists only hold consuming states
+		int stack[64];
+		int stackSize = 0;
+		stack[stackSize++] = s;
+		while (stackSize > 0)
+		{
+			const int i = stack[--stackSize];
+			if (marks[i] == generation)
+				continue;
+			marks[i] = generation;
+			if (states[i].type == GlobState::kSplit && stackSize + 2 <= 64)
+			{
+				stack[stackSize++] = states[i].out2;
+				stack[stackSize++] = states[i].out;
+			}
+			else
+			{
+				list.push_back(i);
+			}
+		}
+	};
+
+	current.clear();
+	++generation;
+	addState(current, 0);
+
+	for (const char ch : text)
+	{
+		const unsigned char c = (unsigned char)ch;
+		next.clear();
+		++generation;
+		for (const int i : current)
+		{
+			const GlobState& state = states[i];
+			bool matches = false;
+			switch (state.type)
+			{
+				case GlobState::kChar: matches = (state.c == c); break;
+				case GlobState::kAny: matches = true; break;
+				case GlobState::kAnyButSlash: matches = (c != '/'); break;
+				case GlobState::kClass: matches = m_Classes[state.classIndex][c]; break;
+				default: break;
+			}
+			if (matches)
+				addState(next, state.out);
+		}
+
+		current.swap(next);
+		if (current.empty())
+			return false;
+	}
+
+	for (const int i : current)
+	{
+		if (states[i].type == GlobState::kMatch)
+			return true;
+	}
+	return false;
+}
+
+void PathFilter::UpdateBestMatch(const RuleIndices& candidates, const bool isDir, int& bestRule) const
+{
+	for (auto it = candidates.rbegin(); it != candidates.rend() && *it > bestRule; ++it)
+	{
+		if (m_Rules[*it].dirOnly && !isDir)
+			continue;
+		bestRule = *it;
+		return;
+	}
+}
+
+bool PathFilter::IsExcluded(const std::string& relativePath, const std::string& name, const bool isDir) const
+{
+	int bestRule = -1;
+
+	auto nameRules = m_NameRules.find(name);
+	if (nameRules != m_NameRules.end())
+		UpdateBestMatch(nameRules->second, isDir, bestRule);
+
+	auto pathRules = m_PathRules.find(relativePath);
+	if (pathRules != m_PathRules.end())
+		UpdateBestMatch(pathRules->second, isDir, bestRule);
+
+	for (const size_t suffixLength : m_SuffixLengths)
+	{
+		if (name.size() < suffixLength)
+			continue;
+		auto suffixRules = m_SuffixRules.find(name.substr(name.size() - suffixLength));
+		if (suffixRules != m_SuffixRules.end())
+			UpdateBestMatch(suffixRules->second, isDir, bestRule);
+	}
+
+	// Later rules win, so stop at the first glob that matches or can no longer beat the best rule
+	for (auto it = m_GlobRules.rbegin(); it != m_GlobRules.rend() && *it > bestRule; ++it)
+	{
+		const Rule& rule = m_Rules[*it];
+		if (rule.dirOnly && !isDir)
+			continue;
+		if (MatchGlob(rule, rule.anchored ? relativePath : name))
+		{
+			bestRule = *it;
+			break;
+		}
+	}
+
+	return bestRule >= 0 && !m_Rules[bestRule].include;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Gitignore style include/exclude rules, compiled once into lookup tables and glob automatons.
+//
+// Patterns without a slash match the entry name at any depth, patterns with a slash are anchored
+// to the scanned root. A trailing slash only matches directories, a leading '!' re-includes
+// entries excluded by earlier rules, '*' and '?' do not cross '/', '**' does. When several rules
+// match an entry the last one wins, like in a .gitignore file.
+class PathFilter
+{
+public:
+	bool AddExclude(const std::string& pattern);
+	bool AddInclude(const std::string& pattern);
+
+	// Adds all rules of a .gitignore style file, blank lines and '#' comments are skipped
+	bool AddRulesFromFile(const std::string& path);
+
+	bool IsEmpty() const { return m_Rules.empty(); }
+
+	// name is the last component of relativePath
+	bool IsExcluded(const std::string& relativePath, const std::string& name, const bool isDir) const;
+
+private:
+	struct GlobState
+	{
+		enum Type
+		{
+			kChar,
+			kAny,
+			kAnyButSlash,
+			kClass,
+			kSplit,
+			kMatch,
+		};
+
+		Type type;
+		unsigned char c;
+		int classIndex;
+		int out;
+		int out2;
+	};
+
+	struct Rule
+	{
+		bool include;
+		bool dirOnly;
+		bool anchored;
+		// Glob automaton, only used for rules that are not plain literals or suffixes
+		std::vector<GlobState> states;
+	};
+
+	using RuleIndices = std::vector<int>;
+
+	bool AddRule(std::string pattern, bool include);
+	bool CompileGlob(const std::string& pattern, Rule& rule);
+	bool MatchGlob(const Rule& rule, const std::string& text) const;
+	void UpdateBestMatch(const RuleIndices& candidates, const bool isDir, int& bestRule) const;
+
+	std::vector<Rule> m_Rules;
+	std::vector<std::vector<bool>> m_Classes;
+
+	// Literal rules are hash lookups, '*.ext' style rules are looked up by suffix
+	std::unordered_map<std::string, RuleIndices> m_NameRules;
+	std::unordered_map<std::string, RuleIndices> m_PathRules;
+	std::unordered_map<std::string, RuleIndices> m_SuffixRules;
+	std::vector<size_t> m_SuffixLengths;
+	RuleIndices m_GlobRules;
+};
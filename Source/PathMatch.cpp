@@ -0,0 +1,274 @@
+#include "PathMatch.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "UnicodeData.h"
+
+namespace
+{
+	const uint32_t kInvalid = 0xFFFFFFFF;
+
+	// Hangul syllables are a leading consonant, a vowel and an optional trailing consonant jamo
+	const uint32_t kHangulBase = 0xAC00;
+	const uint32_t kLeadingBase = 0x1100;
+	const uint32_t kVowelBase = 0x1161;
+	const uint32_t kTrailingBase = 0x11A7;
+	const uint32_t kLeadingCount = 19;
+	const uint32_t kVowelCount = 21;
+	const uint32_t kTrailingCount = 28;
+	const uint32_t kHangulCount = kLeadingCount * kVowelCount * kTrailingCount;
+
+	void Decompose(const uint32_t c, not_null<std::vector<uint32_t>> outCodes)
+	{
+		if (c >= kHangulBase && c < kHangulBase + kHangulCount)
+		{
+			const uint32_t index = c - kHangulBase;
+			outCodes->push_back(kLeadingBase + index / (kVowelCount * kTrailingCount));
+			outCodes->push_back(kVowelBase + (index % (kVowelCount * kTrailingCount)) / kTrailingCount);
+			if (index % kTrailingCount != 0)
+				outCodes->push_back(kTrailingBase + index % kTrailingCount);
+			return;
+		}
+
+		uint32_t first;
+		uint32_t second;
+		if (!GetCanonicalDecomposition(c, &first, &second))
+		{
+			outCodes->push_back(c);
+			return;
+		}
+		Decompose(first, outCodes);
+		if (second != 0)
+			Decompose(second, outCodes);
+	}
+
+	uint32_t Compose(const uint32_t first, const uint32_t second)
+	{
+		if (first >= kLeadingBase && first < kLeadingBase + kLeadingCount && second >= kVowelBase && second < kVowelBase + kVowelCount)
+			return kHangulBase + ((first - kLeadingBase) * kVowelCount + (second - kVowelBase)) * kTrailingCount;
+		if (first >= kHangulBase && first < kHangulBase + kHangulCount && (first - kHangulBase) % kTrailingCount == 0
+			&& second > kTrailingBase && second < kTrailingBase + kTrailingCount)
+			return first + (second - kTrailingBase);
+		const uint32_t composed = GetCanonicalComposition(first, second);
+		return (composed == kNoComposition) ? kInvalid : composed;
+	}
+
+	// Takes fully decomposed code points to NFC: marks are put in canonical order, then every
+	// mark that is not blocked from the starter before it by a mark of the same or a higher class
+	// is composed into it
+	void ComposeCodes(not_null<std::vector<uint32_t>> codes)
+	{
+		std::vector<uint32_t>& c = *codes;
+		for (size_t i = 1; i < c.size(); ++i)
+		{
+			const uint8_t canonicalClass = GetCanonicalClass(c[i]);
+			for (size_t j = i; canonicalClass != 0 && j > 0 && GetCanonicalClass(c[j - 1]) > canonicalClass; --j)
+				std::swap(c[j - 1], c[j]);
+		}
+
+		if (c.empty())
+			return;
+		size_t starter = 0;
+		bool hasStarter = (GetCanonicalClass(c[0]) == 0);
+		int lastClass = hasStarter ? 0 : 256;
+		size_t kept = 1;
+		for (size_t i = 1; i < c.size(); ++i)
+		{
+			const int canonicalClass = GetCanonicalClass(c[i]);
+			const uint32_t composed = hasStarter ? Compose(c[starter], c[i]) : kInvalid;
+			if (composed != kInvalid && (lastClass < canonicalClass || lastClass == 0))
+			{
+				c[starter] = composed;
+				continue;
+			}
+			if (canonicalClass == 0)
+			{
+				starter = kept;
+				hasStarter = true;
+			}
+			lastClass = canonicalClass;
+			c[kept++] = c[i];
+		}
+		c.resize(kept);
+	}
+
+	// Simple case folding, one code point to one
+	uint32_t FoldCase(const uint32_t c)
+	{
+		if (c < 0x80)
+			return (c >= 'A' && c <= 'Z') ? c + 32 : c;
+
+		// Latin-1 capitals, except the multiplication sign
+		if (c >= 0xC0 && c <= 0xDE && c != 0xD7)
+			return c + 32;
+
+		// Latin Extended-A mostly pairs an even capital with the small letter after it
+		if (c >= 0x100 && c <= 0x17F)
+		{
+			if (c == 0x178)
+				return 0xFF;
+			if (c == 0x17F)
+				return 's';
+			if (c == 0x130 || c == 0x131 || c == 0x138 || c == 0x149)
+				return c;
+			if ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17E))
+				return (c & 1) ? c + 1 : c;
+			return (c & 1) ? c : c + 1;
+		}
+
+		// Greek, with the accented capitals and final sigma
+		if (c >= 0x391 && c <= 0x3AB && c != 0x3A2)
+			return c + 32;
+		if (c == 0x386)
+			return 0x3AC;
+		if (c >= 0x388 && c <= 0x38A)
+			return c + 37;
+		if (c == 0x38C)
+			return 0x3CC;
+		if (c == 0x38E || c == 0x38F)
+			return c + 63;
+		if (c == 0x3C2)
+			return 0x3C3;
+
+		// Cyrillic
+		if (c >= 0x410 && c <= 0x42F)
+			return c + 32;
+		if (c >= 0x400 && c <= 0x40F)
+			return c + 80;
+		return c;
+	}
+
+	// Decodes the code point at *index and moves past it, kInvalid for a byte that does not start valid UTF-8
+	uint32_t DecodeUtf8(const std::string& text, not_null<size_t> index)
+	{
+		const unsigned char* data = (const unsigned char*)text.data() + *index;
+		const size_t left = text.size() - *index;
+		const unsigned char lead = data[0];
+
+		size_t length;
+		uint32_t c;
+		if (lead < 0x80)
+		{
+			*index += 1;
+			return lead;
+		}
+		else if ((lead & 0xE0) == 0xC0)
+		{
+			length = 2;
+			c = lead & 0x1F;
+		}
+		else if ((lead & 0xF0) == 0xE0)
+		{
+			length = 3;
+			c = lead & 0x0F;
+		}
+		else if ((lead & 0xF8) == 0xF0)
+		{
+			length = 4;
+			c = lead & 0x07;
+		}
+		else
+		{
+			return kInvalid;
+		}
+
+		if (length > left)
+			return kInvalid;
+		for (size_t i = 1; i < length; ++i)
+		{
+			if ((data[i] & 0xC0) != 0x80)
+				return kInvalid;
+			c = (c << 6) | (data[i] & 0x3F);
+		}
+		*index += length;
+		return c;
+	}
+
+	void AppendUtf8(const uint32_t c, not_null<std::string> outText)
+	{
+		if (c < 0x80)
+		{
+			outText->push_back((char)c);
+		}
+		else if (c < 0x800)
+		{
+			outText->push_back((char)(0xC0 | (c >> 6)));
+			outText->push_back((char)(0x80 | (c & 0x3F)));
+		}
+		else if (c < 0x10000)
+		{
+			outText->push_back((char)(0xE0 | (c >> 12)));
+			outText->push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+			outText->push_back((char)(0x80 | (c & 0x3F)));
+		}
+		else
+		{
+			outText->push_back((char)(0xF0 | (c >> 18)));
+			outText->push_back((char)(0x80 | ((c >> 12) & 0x3F)));
+			outText->push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+			outText->push_back((char)(0x80 | (c & 0x3F)));
+		}
+	}
+}
+
+bool ParsePathMatch(const std::string& name, not_null<PathMatch> outMatch)
+{
+	if (name == "exact")
+		*outMatch = kPathMatchExact;
+	else if (name == "nfc")
+		*outMatch = kPathMatchNfc;
+	else if (name == "fold")
+		*outMatch = kPathMatchFold;
+	else
+		return false;
+	return true;
+}
+
+std::string GetPathMatchKey(const std::string& path, const PathMatch match)
+{
+	if (match == kPathMatchExact)
+		return path;
+
+	// Plain ASCII is already in NFC
+	if (std::all_of(path.begin(), path.end(), [](const char c) { return (unsigned char)c < 0x80; }))
+	{
+		if (match == kPathMatchNfc)
+			return path;
+		std::string key = path;
+		for (char& c : key)
+			c = (char)FoldCase((unsigned char)c);
+		return key;
+	}
+
+	std::string key;
+	key.reserve(path.size());
+
+	// Code points since the last one that nothing before it composes with, ASCII never does
+	std::vector<uint32_t> codes;
+	auto flushCodes = [&]()
+	{
+		ComposeCodes(&codes);
+		for (const uint32_t c : codes)
+			AppendUtf8((match == kPathMatchFold) ? FoldCase(c) : c, &key);
+		codes.clear();
+	};
+
+	for (size_t index = 0; index < path.size();)
+	{
+		const uint32_t c = DecodeUtf8(path, &index);
+		if (c == kInvalid)
+		{
+			flushCodes();
+			key.push_back(path[index++]);
+			continue;
+		}
+		if (c < 0x80)
+			flushCodes();
+		Decompose(c, &codes);
+	}
+	flushCodes();
+
+	return key;
+}
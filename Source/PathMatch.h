@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+
+#include "Common.h"
+
+// How entries of the two sides are paired by their relative paths
+enum PathMatch
+{
+	kPathMatchExact,
+	// Unicode NFC, so paths from file systems that store decomposed names (NFD) match composed ones
+	kPathMatchNfc,
+	// NFC and case folded, for trees from case-insensitive file systems
+	kPathMatchFold
+};
+
+bool ParsePathMatch(const std::string& name, not_null<PathMatch> outMatch);
+
+// The form paths are paired by. NFC is the full canonical composition of Unicode 14, including
+// Hangul, kana with voicing marks and stacked marks as in Vietnamese. Case folding covers Latin,
+// Greek and Cyrillic. Bytes that are not valid UTF-8 are kept as they are.
+std::string GetPathMatchKey(const std::string& path, const PathMatch match);
@@ -0,0 +1,166 @@
+#include "PathSort.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "ThreadPool.h"
+#include "Trace.h"
+
+namespace
+{
+	// Below this std::sort wins, the keys are not worth building
+	const size_t kMinMultikeySortCount = 64;
+	const size_t kInsertionSortCount = 16;
+	// Partitions at least this large are sorted as separate tasks
+	const size_t kParallelSortCount = 1 << 15;
+
+	struct PathKey
+	{
+		// The 8 path bytes at the current depth, big endian and zero padded past the end
+		uint64_t chunk;
+		const unsigned char* data;
+		uint32_t length;
+		uint32_t index;
+	};
+
+	inline uint64_t LoadChunk(const PathKey& key, const size_t depth)
+	{
+		uint64_t chunk = 0;
+		const size_t end = std::min<size_t>(key.length, depth + 8);
+		for (size_t i = depth; i < end; ++i)
+			chunk |= (uint64_t)key.data[i] << (8 * (7 - (i - depth)));
+		return chunk;
+	}
+
+	// Both keys share their first depth bytes
+	inline bool LessFrom(const PathKey& a, const PathKey& b, const size_t depth)
+	{
+		const size_t length = std::min(a.length, b.length);
+		const int order = (length > depth) ? memcmp(a.data + depth, b.data + depth, length - depth) : 0;
+		return (order != 0) ? order < 0 : a.length < b.length;
+	}
+
+	void ComparisonSort(PathKey* keys, const size_t count, const size_t depth)
+	{
+		if (count <= kInsertionSortCount)
+		{
+			for (size_t i = 1; i < count; ++i)
+			{
+				const PathKey key = keys[i];
+				size_t j = i;
+				for (; j > 0 && LessFrom(key, keys[j - 1], depth); --j)
+					keys[j] = keys[j - 1];
+				keys[j] = key;
+			}
+			return;
+		}
+		std::sort(keys, keys + count, [depth](const PathKey& a, const PathKey& b) { return LessFrom(a, b, depth); });
+	}
+
+	uint64_t MedianOfThree(const uint64_t a, const uint64_t b, const uint64_t c)
+	{
+		if (a < b)
+			return (b < c) ? b : ((a < c) ? c : a);
+		return (a < c) ? a : ((b < c) ? c : b);
+	}
+
+	// Multikey quicksort over 8 byte chunks. Chunks compare like the bytes they hold, and a path
+	// that ends inside a chunk is zero padded, which sorts it before its longer extensions.
+	void MultikeySort(PathKey* keys, size_t count, size_t depth)
+	{
+		while (count > kInsertionSortCount)
+		{
+			const uint64_t pivot = MedianOfThree(keys[0].chunk, keys[count / 2].chunk, keys[count - 1].chunk);
+
+			// Three way partition on the chunk: [0, lt) below, [lt, gt) equal, [gt, count) above
+			size_t lt = 0;
+			size_t gt = count;
+			for (size_t i = 0; i < gt; )
+			{
+				const uint64_t chunk = keys[i].chunk;
+				if (chunk < pivot)
+					std::swap(keys[lt++], keys[i++]);
+				else if (chunk > pivot)
+					std::swap(keys[i], keys[--gt]);
+				else
+					++i;
+			}
+
+			// Equal chunks with padding belong to paths ending at the same length, which are only
+			// distinct when a name holds a NUL byte. Otherwise the next chunk decides.
+			PathKey* const equalKeys = keys + lt;
+			const size_t equalCount = gt - lt;
+			const bool pathsEnd = (pivot & 0xff) == 0;
+			if (!pathsEnd)
+			{
+				for (size_t i = 0; i < equalCount; ++i)
+					equalKeys[i].chunk = LoadChunk(equalKeys[i], depth + 8);
+			}
+
+			// Every path shares the chunk, as with long common prefixes
+			if (lt == 0 && gt == count && !pathsEnd)
+			{
+				depth += 8;
+				continue;
+			}
+
+			if (count >= kParallelSortCount)
+			{
+				GetCpuPool().ParallelFor(3, [&](const size_t part)
+				{
+					if (part == 0)
+						MultikeySort(keys, lt, depth);
+					else if (part == 1)
+						pathsEnd ? ComparisonSort(equalKeys, equalCount, depth) : MultikeySort(equalKeys, equalCount, depth + 8);
+					else
+						MultikeySort(keys + gt, count - gt, depth);
+				});
+				return;
+			}
+
+			MultikeySort(keys, lt, depth);
+			MultikeySort(keys + gt, count - gt, depth);
+			if (pathsEnd)
+			{
+				ComparisonSort(equalKeys, equalCount, depth);
+				return;
+			}
+
+			// The equal part goes on with the next chunk, looping keeps shared prefixes off the stack
+			keys = equalKeys;
+			count = equalCount;
+			depth += 8;
+		}
+
+		ComparisonSort(keys, count, depth);
+	}
+}
+
+void SortFileInfosByPath(not_null<std::vector<FileInfo>> files)
+{
+	std::vector<FileInfo>& fileList = *files;
+	if (fileList.size() < kMinMultikeySortCount)
+	{
+		std::sort(fileList.begin(), fileList.end(), &FileInfoSortFunc);
+		return;
+	}
+
+	TraceScope trace("SortPaths", nullptr, (int64_t)fileList.size());
+
+	std::vector<PathKey> keys(fileList.size());
+	for (size_t i = 0; i < fileList.size(); ++i)
+	{
+		const std::string& path = fileList[i].relativePath;
+		keys[i] = PathKey { 0, (const unsigned char*)path.data(), (uint32_t)path.size(), (uint32_t)i };
+		keys[i].chunk = LoadChunk(keys[i], 0);
+	}
+
+	MultikeySort(keys.data(), keys.size(), 0);
+
+	std::vector<FileInfo> sorted;
+	sorted.reserve(fileList.size());
+	for (const PathKey& key : keys)
+		sorted.push_back(std::move(fileList[key.index]));
+	fileList.swap(sorted);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <vector>
+
+#include "FileUtils.h"
+
+// Sorts by relative path in exactly the order FileInfoSortFunc defines for entries without a
+// path match key, std::string's unsigned byte order with a prefix sorting first. A multikey
+// quicksort on the path bytes, so long shared prefixes are looked at once per partition instead
+// of once per comparison. Large partitions are sorted in parallel on the CPU pool.
+void SortFileInfosByPath(not_null<std::vector<FileInfo>> files);
@@ -0,0 +1,285 @@
+#include "Session.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Hash.h"
+#include "Stats.h"
+
+namespace
+{
+	// At most this much work is lost when a diff is interrupted
+	const std::chrono::seconds kCheckpointInterval(5);
+
+	// Records are read this many at a time
+	const size_t kReadBatchSize = 4096;
+
+	// Only local files have an identity to check, everything else is compared again
+	bool HasStatIdentity(const FileInfo& f)
+	{
+		return HasLocalFile(f) && !IsDir(f);
+	}
+
+	// Any write to a file changes its mtime or ctime, replacing it changes its inode
+	uint64_t GetStatIdentity(const FileInfo& f)
+	{
+		const int64_t identity[4] = { FileSize(f), GetModificationTimeNs(f.status), GetChangeTimeNs(f.status), (int64_t)f.status.st_ino };
+		return HashBytes(identity, sizeof(identity));
+	}
+
+	uint64_t GetPairHash(const FileInfo& leftFile, const FileInfo& rightFile)
+	{
+		ContentHasher hasher;
+		hasher.Update(leftFile.relativePath.data(), leftFile.relativePath.size());
+		hasher.Update("", 1);
+		hasher.Update(rightFile.relativePath.data(), rightFile.relativePath.size());
+		return hasher.Digest();
+	}
+
+	uint64_t GetRecordChecksum(const SessionRecord& record)
+	{
+		return HashBytes(&record, offsetof(SessionRecord, checksum));
+	}
+
+	// Everything that decides the verdict of a pair
+	uint64_t GetOptionsHash(const PathSet& paths, const DiffOptions& options)
+	{
+		ContentHasher hasher;
+		for (const PathId id : { kLeft, kRight })
+		{
+			const std::string* path = GetPath(paths, id);
+			hasher.Update(path->c_str(), path->size() + 1);
+		}
+		const int32_t values[5] = { options.compareContents, options.compareOptions.normalizeText, options.measureSimilarity,
+			(int32_t)options.scanOptions.pathMatch, (int32_t)options.scanOptions.symlinks };
+		hasher.Update(values, sizeof(values));
+		return hasher.Digest();
+	}
+
+	// Reads the records up to the first torn one. outValidSize stays 0 when there is no journal yet.
+	bool LoadJournal(const std::string& path, const uint64_t optionsHash, not_null<std::unordered_map<uint64_t, SessionRecord>> outVerdicts, not_null<size_t> outValidSize)
+	{
+		*outValidSize = 0;
+		CountStat(kCounterOpen);
+		FILE* file = fopen(path.c_str(), "rb");
+		if (file == nullptr)
+		{
+			LogLine(kDebug, "No session at '%s' yet, starting one.", path.c_str());
+			return true;
+		}
+
+		SessionHeader header;
+		if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, DWRAP_SESSION_MAGIC, sizeof(header.magic)) != 0)
+		{
+			LogLine(kError, "'%s' is not a session file", path.c_str());
+			fclose(file);
+			return false;
+		}
+		if (header.byteOrderMark != kSessionByteOrderMark || header.version != kSessionVersion)
+		{
+			LogLine(kError, "Session '%s' was written by another version or on another machine", path.c_str());
+			fclose(file);
+			return false;
+		}
+		if (header.optionsHash != optionsHash)
+		{
+			LogLine(kError, "Session '%s' was recorded for other paths or options", path.c_str());
+			fclose(file);
+			return false;
+		}
+
+		// Later verdicts of a pair were recorded after its files changed, they replace earlier ones
+		std::vector<SessionRecord> records(kReadBatchSize);
+		size_t validCount = 0;
+		bool torn = false;
+		while (!torn)
+		{
+			const size_t count = fread(records.data(), sizeof(SessionRecord), records.size(), file);
+			for (size_t i = 0; i < count && !torn; ++i)
+			{
+				torn = (records[i].checksum != GetRecordChecksum(records[i]));
+				if (!torn)
+				{
+					(*outVerdicts)[records[i].pairHash] = records[i];
+					++validCount;
+				}
+			}
+			if (count < records.size())
+				break;
+		}
+		fclose(file);
+
+		*outValidSize = sizeof(SessionHeader) + validCount * sizeof(SessionRecord);
+		LogLine(kDebug, "Resuming session '%s' with %lu verdicts%s.", path.c_str(), (unsigned long)outVerdicts->size(), torn ? ", dropped a torn record" : "");
+		return true;
+	}
+
+	// Starting over only truncates missing, empty and session files, never a mistyped operand
+	bool IsSafeToOverwrite(const std::string& path)
+	{
+		CountStat(kCounterOpen);
+		const int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return true;
+		char magic[sizeof(SessionHeader::magic)];
+		const ssize_t size = read(fd, magic, sizeof(magic));
+		close(fd);
+		// A crash while the header was written can leave only the start of the magic
+		if (size >= 0 && memcmp(magic, DWRAP_SESSION_MAGIC, size) == 0)
+			return true;
+		LogLine(kError, "'%s' exists and is not a session file, not overwriting it", path.c_str());
+		return false;
+	}
+}
+
+DiffSession::DiffSession()
+	: m_Fd(-1)
+	, m_WriteFailed(false)
+{
+}
+
+DiffSession::~DiffSession()
+{
+	Close();
+}
+
+bool DiffSession::Open(const std::string& path, const PathSet& paths, const DiffOptions& options, const bool resume)
+{
+	m_Path = path;
+	m_Verdicts.clear();
+
+	const uint64_t optionsHash = GetOptionsHash(paths, options);
+	size_t validSize = 0;
+	if (resume ? !LoadJournal(path, optionsHash, &m_Verdicts, &validSize) : !IsSafeToOverwrite(path))
+		return false;
+
+	CountStat(kCounterOpen);
+	m_Fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+	if (m_Fd < 0)
+	{
+		LogLine(kError, "Could not write session '%s'", path.c_str());
+		return false;
+	}
+
+	// Appending starts after the last whole record, or over from the header
+	bool opened = ftruncate(m_Fd, validSize) == 0 && lseek(m_Fd, validSize, SEEK_SET) == (off_t)validSize;
+	if (opened && validSize == 0)
+	{
+		SessionHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, DWRAP_SESSION_MAGIC, sizeof(header.magic));
+		header.version = kSessionVersion;
+		header.byteOrderMark = kSessionByteOrderMark;
+		header.optionsHash = optionsHash;
+		opened = write(m_Fd, &header, sizeof(header)) == (ssize_t)sizeof(header);
+	}
+	if (!opened)
+	{
+		LogLine(kError, "Could not write session '%s'", path.c_str());
+		close(m_Fd);
+		m_Fd = -1;
+		return false;
+	}
+
+	m_NextCheckpoint = std::chrono::steady_clock::now() + kCheckpointInterval;
+	return true;
+}
+
+bool DiffSession::Close()
+{
+	if (m_Fd < 0)
+		return !m_WriteFailed;
+
+	std::vector<SessionRecord> records;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		records.swap(m_Recorded);
+	}
+	WriteRecords(records);
+
+	close(m_Fd);
+	m_Fd = -1;
+	return !m_WriteFailed;
+}
+
+bool DiffSession::FindVerdict(const FileInfo& leftFile, const FileInfo& rightFile, not_null<DiffEntry> outEntry) const
+{
+	if (m_Verdicts.empty() || !HasStatIdentity(leftFile) || !HasStatIdentity(rightFile))
+		return false;
+
+	auto found = m_Verdicts.find(GetPairHash(leftFile, rightFile));
+	if (found == m_Verdicts.end())
+		return false;
+	const SessionRecord& record = found->second;
+	if (record.leftIdentity != GetStatIdentity(leftFile) || record.rightIdentity != GetStatIdentity(rightFile))
+		return false;
+
+	CountStat(kCounterSessionVerdicts);
+	*outEntry = DiffEntry { &leftFile, &rightFile, record.differs != 0, record.firstDiffOffset };
+	outEntry->similarity = record.similarity;
+	outEntry->changedBytes = record.changedBytes;
+	return true;
+}
+
+void DiffSession::RecordVerdict(const DiffEntry& entry)
+{
+	if (m_Fd < 0 || !entry.leftFile || !entry.rightFile || !HasStatIdentity(*entry.leftFile) || !HasStatIdentity(*entry.rightFile))
+		return;
+
+	SessionRecord record;
+	memset(&record, 0, sizeof(record));
+	record.pairHash = GetPairHash(*entry.leftFile, *entry.rightFile);
+	record.leftIdentity = GetStatIdentity(*entry.leftFile);
+	record.rightIdentity = GetStatIdentity(*entry.rightFile);
+	record.firstDiffOffset = entry.firstDiffOffset;
+	record.changedBytes = entry.changedBytes;
+	record.similarity = entry.similarity;
+	record.differs = entry.differs ? 1 : 0;
+	record.checksum = GetRecordChecksum(record);
+
+	std::vector<SessionRecord> records;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Recorded.push_back(record);
+		const auto now = std::chrono::steady_clock::now();
+		if (now < m_NextCheckpoint)
+			return;
+		m_NextCheckpoint = now + kCheckpointInterval;
+		records.swap(m_Recorded);
+	}
+	WriteRecords(records);
+}
+
+bool DiffSession::WriteRecords(const std::vector<SessionRecord>& records)
+{
+	std::lock_guard<std::mutex> lock(m_WriteMutex);
+	if (m_WriteFailed || records.empty())
+		return !m_WriteFailed;
+
+	const char* data = (const char*)records.data();
+	const size_t size = records.size() * sizeof(SessionRecord);
+	for (size_t offset = 0; offset < size; )
+	{
+		const ssize_t written = write(m_Fd, data + offset, size - offset);
+		if (written <= 0)
+		{
+			m_WriteFailed = true;
+			break;
+		}
+		offset += written;
+	}
+
+	// A checkpoint only counts once it would survive the host going down
+	if (m_WriteFailed || fsync(m_Fd) != 0)
+	{
+		LogLine(kError, "Could not write session '%s', later verdicts are not kept", m_Path.c_str());
+		m_WriteFailed = true;
+		return false;
+	}
+	LogLine(kDebug, "Checkpointed %lu verdicts to session '%s'.", (unsigned long)records.size(), m_Path.c_str());
+	return true;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "DirectoryDiff.h"
+
+// Resumable diffs: a journal of the verdicts of compared file pairs, appended to while a diff
+// runs and written out every few seconds. A resumed diff scans both trees again and takes the
+// verdict of every pair whose files still have the stat identity they were compared with, so
+// only new and changed pairs are read.
+//
+// Layout: SessionHeader, then SessionRecords, each with a checksum of its own. A crash can leave
+// a torn record at the end, reading stops before it and appending starts over there. All
+// integers are stored in host byte order, the header records which one that is.
+
+#define DWRAP_SESSION_MAGIC "DWRAPSES"
+const uint32_t kSessionVersion = 1;
+const uint32_t kSessionByteOrderMark = 0x01020304;
+
+struct SessionHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrderMark;
+	// Verdicts only carry over to diffs of the same paths with the same options
+	uint64_t optionsHash;
+};
+
+struct SessionRecord
+{
+	// Of both relative paths, a pair is only found under a colliding hash if the stat
+	// identities of both files collide as well
+	uint64_t pairHash;
+	uint64_t leftIdentity;
+	uint64_t rightIdentity;
+	int64_t firstDiffOffset;
+	int64_t changedBytes;
+	double similarity;
+	uint32_t differs;
+	uint32_t reserved;
+	// Of everything above
+	uint64_t checksum;
+};
+
+class DiffSession
+{
+public:
+	DiffSession();
+	~DiffSession();
+	DiffSession(const DiffSession&) = delete;
+	DiffSession& operator=(const DiffSession&) = delete;
+
+	// Starts the journal at path over, or with resume continues the one there, if any
+	bool Open(const std::string& path, const PathSet& paths, const DiffOptions& options, const bool resume);
+
+	// Writes out what was recorded since the last checkpoint
+	bool Close();
+
+	// A verdict from the journal, when both files are unchanged since it was recorded
+	bool FindVerdict(const FileInfo& leftFile, const FileInfo& rightFile, not_null<DiffEntry> outEntry) const;
+
+	// Called from any thread once a pair was compared, checkpoints when one is due
+	void RecordVerdict(const DiffEntry& entry);
+
+	size_t GetResumedCount() const { return m_Verdicts.size(); }
+
+private:
+	bool WriteRecords(const std::vector<SessionRecord>& records);
+
+	std::string m_Path;
+	int m_Fd;
+	std::unordered_map<uint64_t, SessionRecord> m_Verdicts;
+
+	std::mutex m_Mutex;
+	std::vector<SessionRecord> m_Recorded;
+	std::chrono::steady_clock::time_point m_NextCheckpoint;
+
+	// Held while a checkpoint writes, so records recorded meanwhile are not held up
+	std::mutex m_WriteMutex;
+	bool m_WriteFailed;
+};
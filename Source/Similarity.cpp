@@ -0,0 +1,149 @@
+#include "Similarity.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "FileIO.h"
+#include "Hash.h"
+#include "Trace.h"
+
+namespace
+{
+	const size_t kMinChunkSize = 2 * 1024;
+	const size_t kAverageChunkSize = 8 * 1024;
+	const size_t kMaxChunkSize = 64 * 1024;
+
+	// Normalized chunking: cuts are harder to hit below the average size and easier above it,
+	// which keeps chunk sizes close to the average. The gear hash shifts left once per byte, so
+	// its top bits depend on the most bytes.
+	const uint64_t kMaskBelowAverage = 0xfffe000000000000ull;
+	const uint64_t kMaskAboveAverage = 0xffe0000000000000ull;
+
+	// Bytes further back than this have been shifted out of the hash
+	const size_t kGearWindow = 64;
+
+	const uint64_t* GetGearTable()
+	{
+		static const struct GearTable
+		{
+			GearTable()
+			{
+				// splitmix64, so the table and with it every cut point is the same on every run
+				uint64_t state = 0x9e3779b97f4a7c15ull;
+				for (uint64_t& value : values)
+				{
+					uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+					z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+					z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+					value = z ^ (z >> 31);
+				}
+			}
+			uint64_t values[256];
+		} s_Table;
+		return s_Table.values;
+	}
+
+	struct Chunk
+	{
+		uint64_t hash;
+		uint32_t size;
+	};
+
+	// Cuts a file into chunks from an offset on, a block at a time
+	bool ChunkFile(const FileInfo& f, const int64_t startOffset, const CompareOptions& options, not_null<std::vector<Chunk>> outChunks)
+	{
+		InputFile file;
+		if (!file.Open(f.absolutePath, options.ioPolicy))
+		{
+			LogLine(kError, "Could not read file '%s'", f.absolutePath.c_str());
+			return false;
+		}
+
+		const uint64_t* gear = GetGearTable();
+		IoBuffer buf;
+		ContentHasher chunkHasher;
+		uint64_t gearHash = 0;
+		size_t chunkSize = 0;
+		for (int64_t offset = startOffset;; )
+		{
+			const ssize_t bytesRead = file.ReadAt(buf.GetData(), IoBuffer::kSize, offset);
+			if (bytesRead < 0)
+			{
+				LogLine(kError, "Could not read file '%s'", f.absolutePath.c_str());
+				return false;
+			}
+			if (bytesRead == 0)
+				break;
+			if (options.cancel && options.cancel->load(std::memory_order_relaxed))
+				return false;
+
+			const unsigned char* data = (const unsigned char*)buf.GetData();
+			size_t chunkStart = 0;
+			for (size_t i = 0; i < (size_t)bytesRead; ++i)
+			{
+				++chunkSize;
+				// Cuts below the minimum size are never taken, only the bytes that reach into the
+				// hash at the minimum size need to be rolled in
+				if (chunkSize + kGearWindow <= kMinChunkSize)
+					continue;
+				gearHash = (gearHash << 1) + gear[data[i]];
+				if (chunkSize < kMinChunkSize)
+					continue;
+
+				const uint64_t mask = (chunkSize < kAverageChunkSize) ? kMaskBelowAverage : kMaskAboveAverage;
+				if ((gearHash & mask) != 0 && chunkSize < kMaxChunkSize)
+					continue;
+
+				chunkHasher.Update(data + chunkStart, i + 1 - chunkStart);
+				outChunks->push_back(Chunk { chunkHasher.Digest(), (uint32_t)chunkSize });
+				chunkHasher = ContentHasher();
+				gearHash = 0;
+				chunkSize = 0;
+				chunkStart = i + 1;
+			}
+			chunkHasher.Update(data + chunkStart, bytesRead - chunkStart);
+			offset += bytesRead;
+		}
+
+		if (chunkSize > 0)
+			outChunks->push_back(Chunk { chunkHasher.Digest(), (uint32_t)chunkSize });
+		return true;
+	}
+}
+
+bool MeasureSimilarity(const FileInfo& f1, const FileInfo& f2, const int64_t sharedPrefix, const CompareOptions& options, not_null<FileSimilarity> outSimilarity)
+{
+	if (!HasLocalFile(f1) || !HasLocalFile(f2))
+		return false;
+
+	const int64_t largerSize = std::max(FileSize(f1), FileSize(f2));
+	TraceScope trace("Similarity", f1.relativePath.c_str(), largerSize);
+
+	const int64_t start = std::max<int64_t>(sharedPrefix, 0);
+	std::vector<Chunk> chunks1;
+	std::vector<Chunk> chunks2;
+	if (!ChunkFile(f1, start, options, &chunks1) || !ChunkFile(f2, start, options, &chunks2))
+		return false;
+
+	// A chunk repeated on one side only matches as often as it appears on the other
+	std::unordered_map<uint64_t, uint32_t> counts;
+	counts.reserve(chunks1.size());
+	for (const Chunk& chunk : chunks1)
+		++counts[chunk.hash];
+
+	int64_t sharedBytes = start;
+	for (const Chunk& chunk : chunks2)
+	{
+		auto found = counts.find(chunk.hash);
+		if (found != counts.end() && found->second > 0)
+		{
+			--found->second;
+			sharedBytes += chunk.size;
+		}
+	}
+
+	outSimilarity->similarity = (largerSize > 0) ? (double)sharedBytes / (double)largerSize : 1.0;
+	outSimilarity->changedBytes = largerSize - sharedBytes;
+	return true;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "FileUtils.h"
+
+// How much of a modified file survived, measured with content-defined chunks. Both files are cut
+// into FastCDC chunks of about 8KB, whose boundaries follow the content, so an insertion only
+// disturbs the chunks around it. Chunks found on both sides count as shared bytes.
+
+struct FileSimilarity
+{
+	// Share of the larger file found in the other one, from 0 to 1
+	double similarity = 0;
+	// Bytes of the larger file not found in the other one
+	int64_t changedBytes = 0;
+};
+
+// Measures two local files. The first sharedPrefix bytes are known to be equal, as found by the
+// compare that told the files apart, and are not read again.
+bool MeasureSimilarity(const FileInfo& f1, const FileInfo& f2, const int64_t sharedPrefix, const CompareOptions& options, not_null<FileSimilarity> outSimilarity);
@@ -0,0 +1,149 @@
+#include "Stats.h"
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <sys/resource.h>
+#include <time.h>
+
+thread_local ThreadStats* t_threadStats = nullptr;
+
+namespace
+{
+	struct PhaseTotals
+	{
+		std::atomic<uint64_t> wallNs;
+		std::atomic<uint64_t> cpuNs;
+		std::atomic<uint64_t> count;
+	};
+
+	PhaseTotals s_phases[kPhaseCount];
+
+	// Thread stats outlive their threads so nothing is lost when a worker exits before reporting
+	std::mutex s_registryMutex;
+	std::vector<std::unique_ptr<ThreadStats>> s_threadStats;
+
+	const char* const kPhaseNames[kPhaseCount] =
+	{
+		"scan",
+		"sort",
+		"compare",
+		"tool_launch",
+		"gui_build",
+	};
+
+	const char* const kCounterNames[kCounterCount] =
+	{
+		"stat_calls",
+		"open_calls",
+		"read_calls",
+		"bytes_read",
+		"entries_scanned",
+		"entries_excluded",
+		"files_compared",
+		"cache_hits",
+		"cache_misses",
+		"session_verdicts",
+	};
+
+	uint64_t GetProcessCpuNs()
+	{
+		timespec ts;
+		if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0)
+			return 0;
+		return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+	}
+
+	long GetPeakRssKb()
+	{
+		rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+			return 0;
+#ifdef __APPLE__
+		return usage.ru_maxrss / 1024;
+#else
+		return usage.ru_maxrss;
+#endif
+	}
+}
+
+ThreadStats* RegisterThreadStats()
+{
+	std::unique_ptr<ThreadStats> stats(new ThreadStats());
+	for (auto& counter : stats->counters)
+		counter.store(0, std::memory_order_relaxed);
+
+	t_threadStats = stats.get();
+
+	std::lock_guard<std::mutex> lock(s_registryMutex);
+	s_threadStats.push_back(std::move(stats));
+	return t_threadStats;
+}
+
+ScopedPhase::ScopedPhase(const StatsPhase phase)
+	: m_Phase(phase)
+	, m_WallStart(std::chrono::steady_clock::now())
+	, m_CpuStartNs(GetProcessCpuNs())
+{
+}
+
+ScopedPhase::~ScopedPhase()
+{
+	const auto wall = std::chrono::steady_clock::now() - m_WallStart;
+	PhaseTotals& totals = s_phases[m_Phase];
+	totals.wallNs += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(wall).count();
+	totals.cpuNs += GetProcessCpuNs() - m_CpuStartNs;
+	totals.count += 1;
+}
+
+uint64_t GetCounterTotal(const StatsCounter counter)
+{
+	std::lock_guard<std::mutex> lock(s_registryMutex);
+	uint64_t total = 0;
+	for (const auto& stats : s_threadStats)
+		total += stats->counters[counter].load(std::memory_order_relaxed);
+	return total;
+}
+
+void PrintStats(const StatsFormat format)
+{
+	uint64_t counters[kCounterCount];
+	for (int i = 0; i < kCounterCount; ++i)
+		counters[i] = GetCounterTotal((StatsCounter)i);
+
+	const long peakRssKb = GetPeakRssKb();
+
+	if (format == kStatsJson)
+	{
+		fprintf(stderr, "{\n  \"phases\": {\n");
+		for (int i = 0; i < kPhaseCount; ++i)
+		{
+			fprintf(stderr, "    \"%s\": { \"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"count\": %llu }%s\n",
+				kPhaseNames[i], s_phases[i].wallNs / 1e6, s_phases[i].cpuNs / 1e6,
+				(unsigned long long)s_phases[i].count.load(), (i < kPhaseCount - 1) ? "," : "");
+		}
+		fprintf(stderr, "  },\n  \"counters\": {\n");
+		for (int i = 0; i < kCounterCount; ++i)
+		{
+			fprintf(stderr, "    \"%s\": %llu%s\n", kCounterNames[i], (unsigned long long)counters[i],
+				(i < kCounterCount - 1) ? "," : "");
+		}
+		fprintf(stderr, "  },\n  \"peak_rss_kb\": %ld\n}\n", peakRssKb);
+	}
+	else
+	{
+		fprintf(stderr, "%-16s %12s %12s %8s\n", "Phase", "Wall (ms)", "CPU (ms)", "Count");
+		for (int i = 0; i < kPhaseCount; ++i)
+		{
+			fprintf(stderr, "%-16s %12.3f %12.3f %8llu\n", kPhaseNames[i], s_phases[i].wallNs / 1e6,
+				s_phases[i].cpuNs / 1e6, (unsigned long long)s_phases[i].count.load());
+		}
+		fprintf(stderr, "\n%-16s %12s\n", "Counter", "Value");
+		for (int i = 0; i < kCounterCount; ++i)
+			fprintf(stderr, "%-16s %12llu\n", kCounterNames[i], (unsigned long long)counters[i]);
+		fprintf(stderr, "\n%-16s %9ld KB\n", "peak_rss", peakRssKb);
+	}
+	fflush(stderr);
+}
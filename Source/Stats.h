@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Always-on instrumentation. Counters are per thread and only summed up when reported,
+// so counting is a relaxed load/store on thread local memory.
+
+enum StatsPhase
+{
+	kPhaseScan,
+	kPhaseSort,
+	kPhaseCompare,
+	kPhaseToolLaunch,
+	kPhaseGUIBuild,
+	kPhaseCount
+};
+
+enum StatsCounter
+{
+	kCounterStat,
+	kCounterOpen,
+	kCounterRead,
+	kCounterBytesRead,
+	kCounterEntriesScanned,
+	kCounterEntriesExcluded,
+	kCounterFilesCompared,
+	kCounterCacheHits,
+	kCounterCacheMisses,
+	// Compares skipped on a verdict resumed from a session
+	kCounterSessionVerdicts,
+	kCounterCount
+};
+
+enum StatsFormat
+{
+	kStatsTable,
+	kStatsJson
+};
+
+struct ThreadStats
+{
+	std::atomic<uint64_t> counters[kCounterCount];
+};
+
+extern thread_local ThreadStats* t_threadStats;
+ThreadStats* RegisterThreadStats();
+
+inline void CountStat(const StatsCounter counter, const uint64_t amount = 1)
+{
+	ThreadStats* stats = t_threadStats;
+	if (stats == nullptr)
+		stats = RegisterThreadStats();
+
+	// Only the owning thread writes, so no atomic read-modify-write is needed
+	std::atomic<uint64_t>& value = stats->counters[counter];
+	value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+// Accumulates wall and process CPU time spent in a phase
+class ScopedPhase
+{
+public:
+	ScopedPhase(const StatsPhase phase);
+	~ScopedPhase();
+private:
+	StatsPhase m_Phase;
+	std::chrono::steady_clock::time_point m_WallStart;
+	uint64_t m_CpuStartNs;
+};
+
+uint64_t GetCounterTotal(const StatsCounter counter);
+
+// Writes all phases, counters and peak RSS to stderr
+void PrintStats(const StatsFormat format);
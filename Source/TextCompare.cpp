@@ -0,0 +1,197 @@
+#include "TextCompare.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "FileIO.h"
+#include "Trace.h"
+
+namespace
+{
+	inline bool IsLineEndBlank(const char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	// Index of the first line feed or NUL byte, size if there is none
+	size_t FindLineEnd(const char* data, const size_t size)
+	{
+		size_t i = 0;
+#if defined(__SSE2__)
+		const __m128i lineFeed = _mm_set1_epi8('\n');
+		const __m128i zero = _mm_setzero_si128();
+		for (; i + 16 <= size; i += 16)
+		{
+			const __m128i block = _mm_loadu_si128((const __m128i*)(data + i));
+			const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, lineFeed), _mm_cmpeq_epi8(block, zero)));
+			if (mask != 0)
+				return i + __builtin_ctz(mask);
+		}
+#endif
+		for (; i < size; ++i)
+		{
+			if (data[i] == '\n' || data[i] == '\0')
+				return i;
+		}
+		return size;
+	}
+
+	// One side of a text compare, read and normalized a block at a time
+	class NormalizedFile
+	{
+	public:
+		NormalizedFile()
+			: m_Offset(0)
+			, m_Consumed(0)
+			, m_Done(false)
+		{
+		}
+
+		NormalizedFile(const NormalizedFile&) = delete;
+		NormalizedFile& operator=(const NormalizedFile&) = delete;
+
+		bool Open(const FileInfo& f, const IoPolicy ioPolicy)
+		{
+			m_Path = f.absolutePath;
+			if (!m_File.Open(f.absolutePath, ioPolicy))
+			{
+				LogLine(kError, "Could not read file '%s'", f.absolutePath.c_str());
+				return false;
+			}
+			return true;
+		}
+
+		// Normalizes the next block of the file, false if it could not be read
+		bool ReadMore()
+		{
+			const ssize_t bytesRead = m_File.ReadAt(m_Buffer.GetData(), IoBuffer::kSize, m_Offset);
+			if (bytesRead < 0)
+			{
+				LogLine(kError, "Could not read file '%s'", m_Path.c_str());
+				return false;
+			}
+
+			if (bytesRead == 0)
+			{
+				m_Normalizer.Finish();
+				m_Done = true;
+				return true;
+			}
+
+			m_Normalizer.Add(m_Buffer.GetData(), bytesRead, &m_Text);
+			m_Offset += bytesRead;
+			return true;
+		}
+
+		const char* GetText() const { return m_Text.data() + m_Consumed; }
+		size_t GetAvailable() const { return m_Text.size() - m_Consumed; }
+
+		void Consume(const size_t size)
+		{
+			m_Consumed += size;
+			if (m_Consumed == m_Text.size() || m_Consumed >= IoBuffer::kSize)
+			{
+				m_Text.erase(0, m_Consumed);
+				m_Consumed = 0;
+			}
+		}
+
+		bool IsDone() const { return m_Done; }
+		bool IsBinary() const { return m_Normalizer.IsBinary(); }
+
+	private:
+		std::string m_Path;
+		InputFile m_File;
+		IoBuffer m_Buffer;
+		TextNormalizer m_Normalizer;
+		int64_t m_Offset;
+		// Normalized text, the first m_Consumed bytes were compared already
+		std::string m_Text;
+		size_t m_Consumed;
+		bool m_Done;
+	};
+}
+
+TextNormalizer::TextNormalizer()
+	: m_Binary(false)
+{
+}
+
+void TextNormalizer::Add(const char* data, const size_t size, not_null<std::string> outText)
+{
+	for (size_t start = 0; start < size;)
+	{
+		// Only the blanks at the end of a line are dropped, the text before them goes out as is
+		const size_t lineEnd = start + FindLineEnd(data + start, size - start);
+		size_t textEnd = lineEnd;
+		while (textEnd > start && IsLineEndBlank(data[textEnd - 1]))
+			--textEnd;
+
+		if (textEnd > start)
+		{
+			outText->append(m_Whitespace);
+			m_Whitespace.clear();
+			outText->append(data + start, textEnd - start);
+		}
+		m_Whitespace.append(data + textEnd, lineEnd - textEnd);
+
+		if (lineEnd == size)
+			break;
+
+		if (data[lineEnd] == '\n')
+		{
+			m_Whitespace.clear();
+		}
+		else
+		{
+			m_Binary = true;
+			outText->append(m_Whitespace);
+			m_Whitespace.clear();
+		}
+		outText->push_back(data[lineEnd]);
+		start = lineEnd + 1;
+	}
+}
+
+void TextNormalizer::Finish()
+{
+	m_Whitespace.clear();
+}
+
+bool TextFileEquals(const FileInfo& f1, const FileInfo& f2, const CompareOptions& options)
+{
+	TraceScope trace("TextCompare", f1.relativePath.c_str(), std::max(FileSize(f1), FileSize(f2)));
+
+	NormalizedFile file1;
+	NormalizedFile file2;
+	if (!file1.Open(f1, options.ioPolicy) || !file2.Open(f2, options.ioPolicy))
+		return false;
+
+	while (!file1.IsDone() || !file2.IsDone())
+	{
+		if (options.cancel && options.cancel->load(std::memory_order_relaxed))
+			return false;
+
+		// The side with less text waiting is read next, so neither runs far ahead
+		const bool readFirst = file2.IsDone() || (!file1.IsDone() && file1.GetAvailable() <= file2.GetAvailable());
+		if (!(readFirst ? file1 : file2).ReadMore())
+			return false;
+		if (file1.IsBinary() || file2.IsBinary())
+			return false;
+
+		const size_t common = std::min(file1.GetAvailable(), file2.GetAvailable());
+		if (memcmp(file1.GetText(), file2.GetText(), common) != 0)
+			return false;
+		file1.Consume(common);
+		file2.Consume(common);
+
+		if ((file1.IsDone() && file2.GetAvailable() > 0) || (file2.IsDone() && file1.GetAvailable() > 0))
+			return false;
+	}
+
+	return true;
+}
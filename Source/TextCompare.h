@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+
+#include "FileUtils.h"
+
+// Text compares that ignore line endings and whitespace at the end of lines. A run of spaces,
+// tabs and carriage returns is dropped when a line feed or the end of the file follows it, so
+// CRLF and LF files compare equal. Files holding a NUL byte are binary and are not normalized.
+
+// Normalizes a file as it streams past, in blocks of any size
+class TextNormalizer
+{
+public:
+	TextNormalizer();
+
+	// Appends the normalized form of data to outText. Whitespace at the end of data is held
+	// back until it is known whether a line ends after it.
+	void Add(const char* data, const size_t size, not_null<std::string> outText);
+
+	// Drops the whitespace held back at the end of the file
+	void Finish();
+
+	bool IsBinary() const { return m_Binary; }
+
+private:
+	std::string m_Whitespace;
+	bool m_Binary;
+};
+
+// Compares two local files by their normalized text, without normalizing either as a whole.
+// Binary files are never equal here, they are left to the exact compare.
+bool TextFileEquals(const FileInfo& f1, const FileInfo& f2, const CompareOptions& options);
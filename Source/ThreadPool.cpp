@@ -0,0 +1,140 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "Trace.h"
+
+namespace
+{
+	struct ParallelForState
+	{
+		std::function<void(size_t)> body;
+		size_t count;
+		std::atomic<size_t> nextIndex;
+		std::atomic<size_t> doneCount;
+		std::mutex mutex;
+		std::condition_variable allDone;
+	};
+
+	// Claims indices until there are none left
+	void RunParallelFor(ParallelForState& state)
+	{
+		size_t index;
+		while ((index = state.nextIndex.fetch_add(1)) < state.count)
+		{
+			state.body(index);
+			if (state.doneCount.fetch_add(1) + 1 == state.count)
+			{
+				std::lock_guard<std::mutex> lock(state.mutex);
+				state.allDone.notify_all();
+			}
+		}
+	}
+}
+
+ThreadPool::ThreadPool(const char* name, const unsigned threadCount)
+	: m_Name(name)
+	, m_ThreadCount(0)
+	, m_Stopping(false)
+{
+	Reserve(threadCount);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+	}
+	m_TaskAvailable.notify_all();
+	for (std::thread& thread : m_Threads)
+		thread.join();
+}
+
+void ThreadPool::Reserve(const unsigned threadCount)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	while (m_Threads.size() < threadCount)
+		m_Threads.emplace_back([this]() { WorkerLoop(); });
+	m_ThreadCount = (unsigned)m_Threads.size();
+}
+
+void ThreadPool::Submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Tasks.push_back(std::move(task));
+	}
+	m_TaskAvailable.notify_one();
+}
+
+void ThreadPool::ParallelFor(const size_t count, const std::function<void(size_t)>& body, const unsigned maxConcurrency)
+{
+	if (count == 0)
+		return;
+
+	// Helpers that start late find no index left, the state is shared so they can still look
+	std::shared_ptr<ParallelForState> state = std::make_shared<ParallelForState>();
+	state->body = body;
+	state->count = count;
+	state->nextIndex = 0;
+	state->doneCount = 0;
+
+	size_t helperCount = std::min<size_t>(count - 1, GetThreadCount());
+	if (maxConcurrency > 0)
+		helperCount = std::min<size_t>(helperCount, maxConcurrency - 1);
+	for (size_t i = 0; i < helperCount; ++i)
+		Submit([state]() { RunParallelFor(*state); });
+
+	RunParallelFor(*state);
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->allDone.wait(lock, [&state]() { return state->doneCount.load() == state->count; });
+}
+
+void ThreadPool::WorkerLoop()
+{
+	SetTraceThreadName(m_Name);
+
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_TaskAvailable.wait(lock, [this]() { return m_Stopping || !m_Tasks.empty(); });
+			if (m_Stopping && m_Tasks.empty())
+				return;
+			task = std::move(m_Tasks.front());
+			m_Tasks.pop_front();
+		}
+		task();
+	}
+}
+
+namespace
+{
+	unsigned GetIoThreadCount()
+	{
+		return std::max(16u, std::thread::hardware_concurrency());
+	}
+}
+
+ThreadPool& GetScanPool()
+{
+	static ThreadPool s_scanPool("scan", GetIoThreadCount());
+	return s_scanPool;
+}
+
+ThreadPool& GetComparePool()
+{
+	static ThreadPool s_comparePool("compare", GetIoThreadCount());
+	return s_comparePool;
+}
+
+ThreadPool& GetCpuPool()
+{
+	static ThreadPool s_cpuPool("cpu", std::max(1u, std::thread::hardware_concurrency()));
+	return s_cpuPool;
+}
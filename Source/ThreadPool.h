@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Set of worker threads running queued tasks, which only ever grows
+class ThreadPool
+{
+public:
+	ThreadPool(const char* name, const unsigned threadCount);
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	unsigned GetThreadCount() const { return m_ThreadCount.load(); }
+
+	// Starts more threads until there are at least threadCount
+	void Reserve(const unsigned threadCount);
+
+	void Submit(std::function<void()> task);
+
+	// Calls body for every index in [0, count) and returns once all calls finished, with at most
+	// maxConcurrency calls at once when it is not 0. The calling thread takes part, so this is
+	// safe to use from inside a task of the same pool.
+	void ParallelFor(const size_t count, const std::function<void(size_t)>& body, const unsigned maxConcurrency = 0);
+
+private:
+	void WorkerLoop();
+
+	const char* m_Name;
+	std::vector<std::thread> m_Threads;
+	std::atomic<unsigned> m_ThreadCount;
+	std::deque<std::function<void()>> m_Tasks;
+	std::mutex m_Mutex;
+	std::condition_variable m_TaskAvailable;
+	bool m_Stopping;
+};
+
+// Shared pools for directory scans and content comparisons. Their tasks mostly wait on I/O,
+// so there are more threads than cores and DeviceScheduler limits what runs on each device.
+// They start with enough threads for one solid state disk and grow as schedulers use more.
+ThreadPool& GetScanPool();
+ThreadPool& GetComparePool();
+
+// Shared pool for CPU bound work such as sorting, one thread per core
+ThreadPool& GetCpuPool();
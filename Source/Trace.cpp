@@ -0,0 +1,232 @@
+#include "Trace.h"
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "Common.h"
+
+std::atomic<bool> g_TraceEnabled(false);
+
+namespace
+{
+	const size_t kRingCapacity = 1 << 15;
+	// Rings grow by this many events as their thread records, so idle threads cost next to nothing
+	const size_t kChunkCapacity = 512;
+	const size_t kDetailSize = 96;
+
+	struct TraceEvent
+	{
+		const char* name;
+		int64_t startUs;
+		int64_t durationUs;
+		int64_t size;
+		char detail[kDetailSize];
+	};
+
+	struct TraceRing
+	{
+		int threadId;
+		// Guarded by s_registryMutex
+		std::string threadName;
+		std::vector<std::unique_ptr<TraceEvent[]>> chunks;
+		// Only the owning thread writes, WriteTrace reads once recording is over and no event is
+		// being recorded, which recording marks in recording
+		std::atomic<uint64_t> written;
+		std::atomic<bool> recording;
+	};
+
+	std::string s_outputPath;
+	std::chrono::steady_clock::time_point s_startTime;
+
+	std::mutex s_registryMutex;
+	std::vector<std::unique_ptr<TraceRing>> s_rings;
+
+	thread_local TraceRing* t_ring = nullptr;
+
+	// Ordered against the recording flag of the ring, unlike IsTraceEnabled
+	inline bool IsTraceEnabledForWrite()
+	{
+		return g_TraceEnabled.load(std::memory_order_seq_cst);
+	}
+
+	TraceRing& GetThreadRing()
+	{
+		if (t_ring == nullptr)
+		{
+			std::unique_ptr<TraceRing> ring(new TraceRing());
+			ring->written = 0;
+			ring->recording = false;
+
+			std::lock_guard<std::mutex> lock(s_registryMutex);
+			ring->threadId = (int)s_rings.size() + 1;
+			t_ring = ring.get();
+			s_rings.push_back(std::move(ring));
+		}
+		return *t_ring;
+	}
+
+	TraceEvent& GetEvent(TraceRing& ring, const uint64_t index)
+	{
+		const size_t position = (size_t)(index % kRingCapacity);
+		return ring.chunks[position / kChunkCapacity][position % kChunkCapacity];
+	}
+
+	int64_t ToTraceUs(const std::chrono::steady_clock::time_point time)
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(time - s_startTime).count();
+	}
+
+	void WriteJsonString(FILE* file, const char* str)
+	{
+		fputc('"', file);
+		for (const char* c = str; *c; ++c)
+		{
+			const unsigned char ch = (unsigned char)*c;
+			if (ch == '"' || ch == '\\')
+				fprintf(file, "\\%c", ch);
+			else if (ch < 0x20)
+				fprintf(file, "\\u%04x", ch);
+			else
+				fputc(ch, file);
+		}
+		fputc('"', file);
+	}
+}
+
+void StartTrace(const std::string& outputPath)
+{
+	s_outputPath = outputPath;
+	s_startTime = std::chrono::steady_clock::now();
+	g_TraceEnabled = true;
+}
+
+void SetTraceThreadName(const char* name)
+{
+	if (!IsTraceEnabled())
+		return;
+	TraceRing& ring = GetThreadRing();
+	std::lock_guard<std::mutex> lock(s_registryMutex);
+	ring.threadName = name;
+}
+
+void TraceScope::Begin(const char* name, const char* detail, const int64_t size)
+{
+	m_Name = name;
+	m_Detail = detail;
+	m_Size = size;
+	m_Start = std::chrono::steady_clock::now();
+}
+
+void TraceScope::End()
+{
+	const auto end = std::chrono::steady_clock::now();
+
+	TraceRing& ring = GetThreadRing();
+
+	// Marked before checking whether recording is still on, so WriteTrace either sees this event
+	// being recorded and waits for it, or this sees recording off and drops the event
+	ring.recording = true;
+	if (!IsTraceEnabledForWrite())
+	{
+		ring.recording.store(false, std::memory_order_release);
+		return;
+	}
+
+	const uint64_t written = ring.written.load(std::memory_order_relaxed);
+	if (written < kRingCapacity && written % kChunkCapacity == 0)
+		ring.chunks.emplace_back(new TraceEvent[kChunkCapacity]);
+	TraceEvent& event = GetEvent(ring, written);
+	event.name = m_Name;
+	event.startUs = ToTraceUs(m_Start);
+	event.durationUs = std::chrono::duration_cast<std::chrono::microseconds>(end - m_Start).count();
+	event.size = m_Size;
+
+	// Keep the tail of long paths, it is the part that tells entries apart
+	event.detail[0] = '\0';
+	if (m_Detail)
+	{
+		const size_t length = strlen(m_Detail);
+		const char* tail = (length < kDetailSize) ? m_Detail : m_Detail + length - (kDetailSize - 1);
+		while (((unsigned char)*tail & 0xC0) == 0x80)
+			++tail;
+		strncpy(event.detail, tail, kDetailSize - 1);
+		event.detail[kDetailSize - 1] = '\0';
+	}
+
+	ring.written.store(written + 1, std::memory_order_release);
+	ring.recording.store(false, std::memory_order_release);
+}
+
+bool WriteTrace()
+{
+	if (!IsTraceEnabled())
+		return true;
+
+	g_TraceEnabled = false;
+
+	// Pool threads may still be recording an event they began before, wait for them to finish
+	{
+		std::lock_guard<std::mutex> lock(s_registryMutex);
+		for (const auto& ring : s_rings)
+		{
+			while (ring->recording)
+				std::this_thread::yield();
+		}
+	}
+
+	FILE* file = fopen(s_outputPath.c_str(), "w");
+	if (file == nullptr)
+	{
+		LogLine(kError, "Could not write trace file '%s'", s_outputPath.c_str());
+		return false;
+	}
+
+	const int pid = (int)getpid();
+	uint64_t dropped = 0;
+	bool first = true;
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	std::lock_guard<std::mutex> lock(s_registryMutex);
+	for (const auto& ring : s_rings)
+	{
+		if (!ring->threadName.empty())
+		{
+			fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+				first ? "" : ",\n", pid, ring->threadId);
+			WriteJsonString(file, ring->threadName.c_str());
+			fprintf(file, "}}");
+			first = false;
+		}
+
+		const uint64_t written = ring->written.load(std::memory_order_acquire);
+		const uint64_t count = (written < kRingCapacity) ? written : kRingCapacity;
+		dropped += written - count;
+		for (uint64_t i = written - count; i < written; ++i)
+		{
+			const TraceEvent& event = GetEvent(*ring, i);
+			fprintf(file, "%s{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%lld,\"dur\":%lld,\"args\":{",
+				first ? "" : ",\n", event.name, pid, ring->threadId, (long long)event.startUs, (long long)event.durationUs);
+			fprintf(file, "\"detail\":");
+			WriteJsonString(file, event.detail);
+			if (event.size >= 0)
+				fprintf(file, ",\"size\":%lld", (long long)event.size);
+			fprintf(file, "}}");
+			first = false;
+		}
+	}
+
+	fprintf(file, "\n]}\n");
+	fclose(file);
+
+	if (dropped > 0)
+		LogLine(kDebug, "Trace ring buffers wrapped, %llu oldest events dropped", (unsigned long long)dropped);
+
+	return true;
+}
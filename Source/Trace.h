@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Event recording in the Chrome trace event format, viewable in Perfetto or chrome://tracing.
+// Every thread records into its own ring buffer, the oldest events are overwritten when it wraps.
+
+extern std::atomic<bool> g_TraceEnabled;
+
+inline bool IsTraceEnabled()
+{
+	return g_TraceEnabled.load(std::memory_order_relaxed);
+}
+
+// Enables recording, events are written to outputPath by WriteTrace
+void StartTrace(const std::string& outputPath);
+bool WriteTrace();
+
+// Names the calling thread in the trace output
+void SetTraceThreadName(const char* name);
+
+// Records a complete (begin + duration) event covering the lifetime of the scope.
+// name must be a string literal and detail must outlive the scope, it is copied (and possibly
+// truncated) when the event is recorded.
+class TraceScope
+{
+public:
+	TraceScope(const char* name, const char* detail = nullptr, const int64_t size = -1)
+		: m_Active(IsTraceEnabled())
+	{
+		if (m_Active)
+			Begin(name, detail, size);
+	}
+	~TraceScope()
+	{
+		if (m_Active)
+			End();
+	}
+private:
+	void Begin(const char* name, const char* detail, const int64_t size);
+	void End();
+
+	bool m_Active;
+	const char* m_Name;
+	const char* m_Detail;
+	int64_t m_Size;
+	std::chrono::steady_clock::time_point m_Start;
+};
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Common.h"
+
+// The parts of the Unicode character database that canonical normalisation needs. The tables in
+// UnicodeData.cpp are generated from UnicodeData.txt and CompositionExclusions.txt, for any
+// code point not in them the answers are those of an unassigned one. Hangul syllables are left
+// to the caller, they decompose and compose arithmetically.
+
+const uint32_t kNoComposition = 0xFFFFFFFF;
+
+// 0 for starters
+uint8_t GetCanonicalClass(const uint32_t c);
+
+// One level of the canonical decomposition, outSecond is 0 for a singleton. False when c has none.
+bool GetCanonicalDecomposition(const uint32_t c, not_null<uint32_t> outFirst, not_null<uint32_t> outSecond);
+
+// The primary composite of a pair, kNoComposition when canonical composition does not join them
+uint32_t GetCanonicalComposition(const uint32_t first, const uint32_t second);
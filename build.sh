@@ -1,2 +1,2 @@
 #!/bin/sh
-g++ -g -std=c++14 `/opt/fltk-1.3.4-1/fltk-config --cxxflags --ldflags` source/Main.cpp source/Common.cpp -o build/dwrap
+g++ -g -std=c++14 -pthread `/opt/fltk-1.3.4-1/fltk-config --cxxflags --ldflags` source/*.cpp -lz -o build/dwrap